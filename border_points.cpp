@@ -0,0 +1,287 @@
+#include "border_points.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#ifdef CHECK_BORDER_POINTS
+#include <CGAL/Orthogonal_k_neighbor_search.h>
+#include <CGAL/Search_traits_3.h>
+#include <CGAL/Search_traits_adapter.h>
+#endif
+
+// Mean number of points per cell of the grid of an arbitrary point cloud
+const double POINTS_PER_CELL = 4;
+
+// Distance to the raster lattice, in pixels, up to which a point is taken as a pixel
+const double LATTICE_TOLERANCE = 1e-3;
+
+namespace {
+
+	// Points of each cell of a uniform grid over XY, as positions in the list of points
+	struct Point_grid {
+		double x_0, y_0;
+		double cell_x, cell_y;
+		std::size_t columns, rows;
+		std::vector<std::uint32_t> first;
+		std::vector<std::uint32_t> points;
+
+		std::size_t column(double x) const {
+			double i = std::floor((x - x_0) / cell_x);
+			return (std::size_t) std::clamp<double>(i, 0, columns - 1);
+		}
+
+		std::size_t row(double y) const {
+			double j = std::floor((y - y_0) / cell_y);
+			return (std::size_t) std::clamp<double>(j, 0, rows - 1);
+		}
+	};
+
+	/*
+	 * Grid of the raster the points come from: the first two points give
+	 * the pixel width, there must be exactly one point on each node of the
+	 * lattice of the bounding box.
+	 */
+	bool raster_grid(const std::vector<std::array<double, 3>> &points, const CGAL::Bbox_3 &bbox, Point_grid &grid) {
+		std::size_t n = points.size();
+		if (n < 2) return false;
+
+		grid.cell_x = std::abs(points[1][0] - points[0][0]);
+		if (!(grid.cell_x > 0)) return false;
+		grid.columns = (std::size_t) std::llround((bbox.xmax() - bbox.xmin()) / grid.cell_x) + 1;
+		if (n % grid.columns != 0) return false;
+		grid.rows = n / grid.columns;
+		grid.cell_y = (grid.rows > 1) ? (bbox.ymax() - bbox.ymin()) / (grid.rows - 1) : grid.cell_x;
+		if (!(grid.cell_y > 0)) return false;
+
+		// Each point at the center of its cell
+		grid.x_0 = bbox.xmin() - grid.cell_x / 2;
+		grid.y_0 = bbox.ymin() - grid.cell_y / 2;
+
+		grid.points.assign(n, std::numeric_limits<std::uint32_t>::max());
+		for (std::size_t k = 0; k < n; k++) {
+			double i = (points[k][0] - bbox.xmin()) / grid.cell_x;
+			double j = (points[k][1] - bbox.ymin()) / grid.cell_y;
+			if (std::abs(i - std::round(i)) > LATTICE_TOLERANCE || std::abs(j - std::round(j)) > LATTICE_TOLERANCE) return false;
+			if (i < -0.5 || j < -0.5 || std::round(i) >= grid.columns || std::round(j) >= grid.rows) return false;
+			std::size_t cell = ((std::size_t) std::round(j)) * grid.columns + (std::size_t) std::round(i);
+			if (grid.points[cell] != std::numeric_limits<std::uint32_t>::max()) return false;
+			grid.points[cell] = k;
+		}
+
+		grid.first.resize(n + 1);
+		for (std::size_t cell = 0; cell <= n; cell++) grid.first[cell] = cell;
+		return true;
+	}
+
+	// Grid with about POINTS_PER_CELL points per cell, filled by a counting sort
+	void uniform_grid(const std::vector<std::array<double, 3>> &points, const CGAL::Bbox_3 &bbox, Point_grid &grid) {
+		std::size_t n = points.size();
+		double width = bbox.xmax() - bbox.xmin();
+		double height = bbox.ymax() - bbox.ymin();
+		double cell = std::sqrt(width * height * POINTS_PER_CELL / n);
+		if (!(cell > 0)) cell = std::max(width, height) * POINTS_PER_CELL / n;
+		if (!(cell > 0)) cell = 1;
+
+		grid.cell_x = grid.cell_y = cell;
+		grid.x_0 = bbox.xmin();
+		grid.y_0 = bbox.ymin();
+		grid.columns = std::min<std::size_t>((std::size_t) (width / cell) + 1, n);
+		grid.rows = std::min<std::size_t>((std::size_t) (height / cell) + 1, n / grid.columns + 1);
+
+		std::vector<std::uint32_t> cells (n);
+		grid.first.assign(grid.columns * grid.rows + 1, 0);
+		for (std::size_t k = 0; k < n; k++) {
+			cells[k] = grid.row(points[k][1]) * grid.columns + grid.column(points[k][0]);
+			grid.first[cells[k] + 1]++;
+		}
+		for (std::size_t cell = 0; cell < grid.columns * grid.rows; cell++) grid.first[cell + 1] += grid.first[cell];
+
+		std::vector<std::uint32_t> next (grid.first.begin(), grid.first.end() - 1);
+		grid.points.resize(n);
+		for (std::size_t k = 0; k < n; k++) grid.points[next[cells[k]]++] = k;
+	}
+
+	// Neighbours of point k sorted by squared distance, then by position
+	std::size_t nearest_neighbours(const std::vector<std::array<double, 3>> &points, const Point_grid &grid, std::size_t k, std::array<std::pair<double, std::uint32_t>, BORDER_NEIGHBOURS> &neighbours) {
+		const auto &p = points[k];
+		std::size_t i = grid.column(p[0]);
+		std::size_t j = grid.row(p[1]);
+		std::size_t last_ring = std::max({i, grid.columns - 1 - i, j, grid.rows - 1 - j});
+
+		std::size_t count = 0;
+		auto add_cell = [&](std::size_t ci, std::size_t cj) {
+			std::size_t cell = cj * grid.columns + ci;
+			for (std::size_t c = grid.first[cell]; c < grid.first[cell + 1]; c++) {
+				const auto &q = points[grid.points[c]];
+				std::pair<double, std::uint32_t> neighbour ((p[0] - q[0]) * (p[0] - q[0]) + (p[1] - q[1]) * (p[1] - q[1]) + (p[2] - q[2]) * (p[2] - q[2]), grid.points[c]);
+				if (count == BORDER_NEIGHBOURS) {
+					if (!(neighbour < neighbours[count - 1])) continue;
+					count--;
+				}
+				std::size_t position = count++;
+				for (; position > 0 && neighbour < neighbours[position - 1]; position--) neighbours[position] = neighbours[position - 1];
+				neighbours[position] = neighbour;
+			}
+		};
+
+		for (std::size_t r = 0; r <= last_ring; r++) {
+			std::size_t i_min = (i >= r) ? i - r : 0;
+			std::size_t i_max = std::min(i + r, grid.columns - 1);
+			std::size_t j_min = (j >= r) ? j - r : 0;
+			std::size_t j_max = std::min(j + r, grid.rows - 1);
+			for (std::size_t cj = j_min; cj <= j_max; cj++) {
+				if (cj + r == j || cj == j + r) {
+					for (std::size_t ci = i_min; ci <= i_max; ci++) add_cell(ci, cj);
+				} else {
+					if (i >= r) add_cell(i - r, cj);
+					if (r > 0 && i + r < grid.columns) add_cell(i + r, cj);
+				}
+			}
+
+			/*
+			 * The points not visited yet are in the columns or rows beyond the
+			 * ring, so at least as far in X or Y as their first line. This
+			 * holds for the points clamped to the last column or row of a
+			 * capped grid too, and for p itself, which may lie outside of its
+			 * cell: the bound is taken from its coordinates.
+			 */
+			if (count == BORDER_NEIGHBOURS) {
+				double bound = std::numeric_limits<double>::infinity();
+				if (i > r) bound = std::min(bound, p[0] - (grid.x_0 + (i - r) * grid.cell_x));
+				if (i + r + 1 < grid.columns) bound = std::min(bound, grid.x_0 + (i + r + 1) * grid.cell_x - p[0]);
+				if (j > r) bound = std::min(bound, p[1] - (grid.y_0 + (j - r) * grid.cell_y));
+				if (j + r + 1 < grid.rows) bound = std::min(bound, grid.y_0 + (j + r + 1) * grid.cell_y - p[1]);
+				if (bound == std::numeric_limits<double>::infinity() || neighbours[count - 1].first < std::max(bound, 0.) * std::max(bound, 0.)) break;
+			}
+		}
+
+		return count;
+	}
+
+}
+
+bool compute_border_points(const Point_set &point_cloud, Point_set::Property_map<bool> isborder) {
+	Point_set::Property_map<unsigned char> point_cloud_label;
+	bool has_label;
+	boost::tie(point_cloud_label, has_label) = point_cloud.property_map<unsigned char>("p:label");
+	assert(has_label);
+
+	std::vector<Point_set::Index> indices (point_cloud.begin(), point_cloud.end());
+	std::size_t n = indices.size();
+	if (n == 0) return false;
+
+	std::vector<std::array<double, 3>> points (n);
+	std::vector<unsigned char> labels (n);
+	CGAL::Bbox_3 bbox;
+	for (std::size_t k = 0; k < n; k++) {
+		const auto &p = point_cloud.point(indices[k]);
+		points[k] = {CGAL::to_double(p.x()), CGAL::to_double(p.y()), CGAL::to_double(p.z())};
+		labels[k] = point_cloud_label[indices[k]];
+		bbox += p.bbox();
+	}
+
+	Point_grid grid;
+	bool raster = raster_grid(points, bbox, grid);
+	if (!raster) uniform_grid(points, bbox, grid);
+
+	// Property_map<bool> may pack the flags into bits, they are set afterwards
+	std::vector<unsigned char> border (n, 0);
+	ParallelUtils::for_each_index(n, [&](std::size_t k) {
+		std::array<std::pair<double, std::uint32_t>, BORDER_NEIGHBOURS> neighbours;
+		std::size_t count = nearest_neighbours(points, grid, k, neighbours);
+		for (std::size_t m = 1; m < count; m++) {
+			if (labels[neighbours[m].second] != labels[neighbours[0].second]) {
+				border[k] = 1;
+				break;
+			}
+		}
+	}, 1024);
+
+	for (std::size_t k = 0; k < n; k++) isborder[indices[k]] = border[k];
+
+#ifdef CHECK_BORDER_POINTS
+	typedef CGAL::Search_traits_3<Point_set_kernel> Traits_base;
+	typedef CGAL::Search_traits_adapter<Point_set::Index, Point_set::Point_map, Traits_base> TreeTraits;
+	typedef CGAL::Orthogonal_k_neighbor_search<TreeTraits> Neighbor_search;
+	typedef Neighbor_search::Tree Point_tree;
+
+	Point_tree point_tree(point_cloud.begin(), point_cloud.end(), Point_tree::Splitter(), TreeTraits(point_cloud.point_map()));
+	Neighbor_search::Distance tr_dist(point_cloud.point_map());
+	std::size_t differences = 0;
+	for (std::size_t k = 0; k < n; k++) {
+		Neighbor_search search(point_tree, point_cloud.point(indices[k]), BORDER_NEIGHBOURS, 0, true, tr_dist, false);
+		unsigned char l = point_cloud_label[search.begin()->first];
+		bool tree_border = false;
+		for (auto it = search.begin() + 1; it != search.end() && !tree_border; ++it) {
+			if (point_cloud_label[it->first] != l) tree_border = true;
+		}
+		if (tree_border != (bool) border[k]) differences++;
+	}
+	std::cout << differences << " border points differ from the kd-tree" << std::endl;
+#endif
+
+	return raster;
+}
+
+std::size_t voxel_subsample(Point_set &point_cloud, double voxel_size, Point_set::Property_map<bool> isborder) {
+	Point_set::Property_map<unsigned char> point_cloud_label;
+	bool has_label;
+	boost::tie(point_cloud_label, has_label) = point_cloud.property_map<unsigned char>("p:label");
+	assert(has_label);
+
+	std::vector<Point_set::Index> indices (point_cloud.begin(), point_cloud.end());
+	std::size_t n = indices.size();
+	if (n == 0 || !(voxel_size > 0)) return 0;
+
+	CGAL::Bbox_3 bbox;
+	for (const auto &ph: indices) bbox += point_cloud.point(ph).bbox();
+
+	// Voxel (21 bits per axis) and label of each point, then its squared distance to the center of the voxel and its position
+	typedef std::pair<std::pair<std::uint64_t, unsigned char>, std::pair<double, std::uint32_t>> Voxel_point;
+	std::vector<Voxel_point> voxel_points (n);
+	ParallelUtils::for_each_index(n, [&](std::size_t k) {
+		const auto &p = point_cloud.point(indices[k]);
+		std::uint64_t key = 0;
+		double d = 0;
+		for (int i = 0; i < 3; i++) {
+			double t = std::floor((CGAL::to_double(p[i]) - bbox.min(i)) / voxel_size);
+			std::uint64_t cell = (std::uint64_t) std::clamp(t, 0., (double) 0x1fffff);
+			key |= cell << (21 * i);
+			double offset = CGAL::to_double(p[i]) - (bbox.min(i) + (cell + 0.5) * voxel_size);
+			d += offset * offset;
+		}
+		voxel_points[k] = std::make_pair(std::make_pair(key, point_cloud_label[indices[k]]), std::make_pair(d, (std::uint32_t) k));
+	}, 4096);
+
+	// Property_map<bool> may pack the flags into bits, they are read beforehand
+	std::vector<unsigned char> border (n);
+	for (std::size_t k = 0; k < n; k++) border[k] = isborder[indices[k]];
+
+	std::sort(voxel_points.begin(), voxel_points.end());
+
+	// Indexed by Point_set::Index
+	std::vector<unsigned char> keep (point_cloud.size() + point_cloud.number_of_removed_points(), 0);
+	bool kept = false;
+	for (std::size_t k = 0; k < n; k++) {
+		if (k == 0 || voxel_points[k].first != voxel_points[k - 1].first) kept = false;
+		std::uint32_t position = voxel_points[k].second.second;
+		if (border[position] || !kept) keep[indices[position]] = 1;
+		if (!border[position]) kept = true;
+	}
+
+	// The kept points stay in their order
+	auto first_to_remove = std::stable_partition(point_cloud.begin(), point_cloud.end(), [&](const Point_set::Index &ph) {
+		return keep[ph];
+	});
+	std::size_t removed = std::distance(first_to_remove, point_cloud.end());
+	point_cloud.remove(first_to_remove, point_cloud.end());
+	point_cloud.collect_garbage();
+
+	return removed;
+}
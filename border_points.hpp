@@ -0,0 +1,39 @@
+#ifndef BORDER_POINTS_H_
+#define BORDER_POINTS_H_
+
+#include "header.hpp"
+
+// Number of nearest neighbours (the point itself included) looked at to decide if a point is on a label border
+const std::size_t BORDER_NEIGHBOURS = 10;
+
+/*
+ * Sets isborder for the points having, among their BORDER_NEIGHBOURS
+ * nearest neighbours, a point with another label ("p:label").
+ *
+ * The points are bucketed in a uniform grid over XY, and each query visits
+ * the rings of cells around its point until no closer neighbour can be
+ * found, in parallel. If the points are the pixels of a raster, as built by
+ * compute_meshes, the grid is the raster itself with one point per cell.
+ * Otherwise the cell size gives a few points per cell.
+ *
+ * The result is the one of a k nearest neighbour search in a kd-tree, but
+ * for the choice between points at the same distance as the last
+ * neighbour: these ties are broken by the order of the points here, by the
+ * shape of the tree in CGAL. Define CHECK_BORDER_POINTS to count the
+ * points on which the kd-tree disagrees.
+ * Returns true if the raster was used as the grid.
+ */
+bool compute_border_points(const Point_set &point_cloud, Point_set::Property_map<bool> isborder);
+
+/*
+ * Thins the point cloud on a grid of cubic voxels of voxel_size: the border
+ * points (isborder) are all kept, and each voxel keeps, of its other points,
+ * one per label, the one closest to the center of the voxel (the first one
+ * in the point cloud on ties). The voxels are computed in parallel and the
+ * result only depends on the point cloud, not on the threads or a seed.
+ * The removed points are garbage collected.
+ * Returns the number of points removed.
+ */
+std::size_t voxel_subsample(Point_set &point_cloud, double voxel_size, Point_set::Property_map<bool> isborder);
+
+#endif  /* !BORDER_POINTS_H_ */
@@ -1,15 +1,19 @@
 #include "bridge.hpp"
+#include "point_location.hpp"
 
 #include <CGAL/boost/graph/Face_filtered_graph.h>
 #include <CGAL/Polygon_mesh_processing/locate.h>
 #include <CGAL/Polygon_mesh_processing/intersection.h>
 #include <CGAL/Polygon_mesh_processing/border.h>
-#include <CGAL/Polygon_mesh_processing/triangulate_hole.h>
+#include <CGAL/Polygon_mesh_processing/self_intersections.h>
+#include <CGAL/Polygon_mesh_processing/orientation.h>
 #include <CGAL/Polygon_mesh_processing/corefinement.h>
 #include <CGAL/Polygon_mesh_processing/extrude.h>
 #include <CGAL/Polygon_mesh_processing/distance.h>
 #include <CGAL/Polygon_mesh_processing/triangulate_faces.h>
 #include <CGAL/Side_of_triangle_mesh.h>
+#include <CGAL/AABB_triangle_primitive.h>
+#include <CGAL/point_generators_3.h>
 #include <CGAL/bounding_box.h>
 #include <CGAL/Exact_predicates_exact_constructions_kernel.h>
 #include <CGAL/Surface_mesh_simplification/edge_collapse.h>
@@ -17,6 +21,10 @@
 #include "ceres/ceres.h"
 
 #include <cmath>
+#include <numeric>
+#include <limits>
+#include <functional>
+#include <atomic>
 
 namespace PMP = CGAL::Polygon_mesh_processing;
 
@@ -533,6 +541,66 @@ std::set<pathLink> link_paths(const Surface_mesh &mesh, const std::vector<std::l
 
 }
 
+std::vector<std::vector<pathLink>> cluster_links(const std::set<pathLink> &links, K::FT radius) {
+	// Distance between links joining the same paths, as the largest distance between matching ends
+	auto link_distance = [](const pathLink &a, const pathLink &b) {
+		K::FT d = std::numeric_limits<K::FT>::infinity();
+		if (a.first.path == b.first.path && a.second.path == b.second.path) {
+			d = std::max(CGAL::squared_distance(a.first.point, b.first.point), CGAL::squared_distance(a.second.point, b.second.point));
+		}
+		if (a.first.path == b.second.path && a.second.path == b.first.path) {
+			d = std::min(d, std::max(CGAL::squared_distance(a.first.point, b.second.point), CGAL::squared_distance(a.second.point, b.first.point)));
+		}
+		return d;
+	};
+
+	std::map<std::pair<int, int>, std::vector<pathLink>> path_pairs;
+	for (const auto &link: links) {
+		path_pairs[std::make_pair(std::min(link.first.path, link.second.path), std::max(link.first.path, link.second.path))].push_back(link);
+	}
+
+	std::vector<std::vector<pathLink>> clusters;
+	for (const auto &path_pair: path_pairs) {
+		const auto &candidates = path_pair.second;
+
+		// Single linkage with a union find
+		std::vector<std::size_t> parent(candidates.size());
+		std::iota(parent.begin(), parent.end(), 0);
+		std::function<std::size_t(std::size_t)> find = [&parent, &find](std::size_t i) {
+			if (parent[i] != i) parent[i] = find(parent[i]);
+			return parent[i];
+		};
+		// A radius of 0 disables the clustering, even of identical links
+		for (std::size_t i = 0; radius > 0 && i < candidates.size(); i++) {
+			for (std::size_t j = i + 1; j < candidates.size(); j++) {
+				if (link_distance(candidates[i], candidates[j]) <= radius * radius) {
+					parent[find(j)] = find(i);
+				}
+			}
+		}
+
+		std::map<std::size_t, std::size_t> cluster_id;
+		std::size_t first_cluster = clusters.size();
+		for (std::size_t i = 0; i < candidates.size(); i++) {
+			auto root = find(i);
+			if (cluster_id.count(root) == 0) {
+				cluster_id[root] = clusters.size();
+				clusters.emplace_back();
+			}
+			clusters[cluster_id[root]].push_back(candidates[i]);
+		}
+
+		// The shortest link represents its cluster
+		for (std::size_t i = first_cluster; i < clusters.size(); i++) {
+			std::stable_sort(clusters[i].begin(), clusters[i].end(), [](const pathLink &a, const pathLink &b) {
+				return CGAL::squared_distance(a.first.point, a.second.point) < CGAL::squared_distance(b.first.point, b.second.point);
+			});
+		}
+	}
+
+	return clusters;
+}
+
 pathBridge::pathBridge(pathLink link): link(link), cost(0) {
 	N = ceil(sqrt(CGAL::squared_distance(link.first.point, link.second.point)));
 	xl = new double[N+1];
@@ -540,7 +608,7 @@ pathBridge::pathBridge(pathLink link): link(link), cost(0) {
 	z_segment = new double[N+1];
 }
 
-pathBridge::pathBridge(const pathBridge& other) : link(other.link), label(other.label), N(other.N), cost(other.cost), crossing_faces(other.crossing_faces) {
+pathBridge::pathBridge(const pathBridge& other) : link(other.link), label(other.label), N(other.N), cost(other.cost), crossing_faces(other.crossing_faces), stats(other.stats) {
 	// Copy all elements from 'other' to 'data'
 	xl = new double[N+1];
 	xr = new double[N+1];
@@ -556,6 +624,87 @@ pathBridge::~pathBridge() {
 	delete [] z_segment;
 }
 
+bool Bridge_telemetry::enabled = false;
+std::mutex Bridge_telemetry::buffers_mutex;
+std::list<std::unique_ptr<Bridge_telemetry::Buffer>> Bridge_telemetry::buffers;
+
+void Bridge_telemetry::enable() {
+	enabled = true;
+}
+
+Bridge_telemetry::Buffer &Bridge_telemetry::local_buffer() {
+	thread_local Buffer *buffer = nullptr;
+	if (buffer == nullptr) {
+		// Only the first record of each thread takes the lock
+		std::lock_guard<std::mutex> lock(buffers_mutex);
+		buffers.emplace_back(new Buffer);
+		buffer = buffers.back().get();
+	}
+	return *buffer;
+}
+
+void Bridge_telemetry::record(const pathBridge &bridge, bool accepted) {
+	if (!enabled) return;
+	Buffer &buffer = local_buffer();
+	buffer.path1.push_back(bridge.link.first.path);
+	buffer.path2.push_back(bridge.link.second.path);
+	buffer.label.push_back(bridge.label);
+	buffer.N.push_back(bridge.N);
+	buffer.iterations.push_back(bridge.stats.iterations);
+	buffer.residual_evaluations.push_back(bridge.stats.residual_evaluations);
+	buffer.surface_cost_evaluations.push_back(bridge.stats.surface_cost_evaluations);
+	buffer.solve_time.push_back(bridge.stats.solve_time);
+	buffer.final_cost.push_back(bridge.stats.final_cost);
+	buffer.cost.push_back(bridge.cost);
+	buffer.accepted.push_back(accepted);
+}
+
+Bridge_telemetry::Buffer Bridge_telemetry::merged_buffers() {
+	std::lock_guard<std::mutex> lock(buffers_mutex);
+	Buffer result;
+	auto append = [](auto &to, const auto &from) {
+		to.insert(to.end(), from.begin(), from.end());
+	};
+	for (const auto &buffer: buffers) {
+		append(result.path1, buffer->path1);
+		append(result.path2, buffer->path2);
+		append(result.label, buffer->label);
+		append(result.N, buffer->N);
+		append(result.iterations, buffer->iterations);
+		append(result.residual_evaluations, buffer->residual_evaluations);
+		append(result.surface_cost_evaluations, buffer->surface_cost_evaluations);
+		append(result.solve_time, buffer->solve_time);
+		append(result.final_cost, buffer->final_cost);
+		append(result.cost, buffer->cost);
+		append(result.accepted, buffer->accepted);
+	}
+	return result;
+}
+
+void Bridge_telemetry::save_csv(const char *filename) {
+	Buffer records = merged_buffers();
+	std::ofstream ofile (filename);
+	ofile << "path1,path2,label,N,iterations,residual_evaluations,surface_cost_evaluations,solve_time,final_cost,cost,accepted\n";
+	for (std::size_t i = 0; i < records.path1.size(); i++) {
+		ofile << records.path1[i] << "," << records.path2[i] << "," << ((int) records.label[i]) << "," << records.N[i] << "," << records.iterations[i] << "," << records.residual_evaluations[i] << "," << records.surface_cost_evaluations[i] << "," << records.solve_time[i] << "," << records.final_cost[i] << "," << records.cost[i] << "," << ((int) records.accepted[i]) << "\n";
+	}
+	ofile.close();
+}
+
+void Bridge_telemetry::save_json(const char *filename) {
+	Buffer records = merged_buffers();
+	std::ofstream ofile (filename);
+	ofile << "[\n";
+	for (std::size_t i = 0; i < records.path1.size(); i++) {
+		ofile << "\t{\"path1\": " << records.path1[i] << ", \"path2\": " << records.path2[i] << ", \"label\": " << ((int) records.label[i]) << ", \"N\": " << records.N[i];
+		ofile << ", \"iterations\": " << records.iterations[i] << ", \"residual_evaluations\": " << records.residual_evaluations[i] << ", \"surface_cost_evaluations\": " << records.surface_cost_evaluations[i];
+		ofile << ", \"solve_time\": " << records.solve_time[i] << ", \"final_cost\": " << records.final_cost[i] << ", \"cost\": " << records.cost[i] << ", \"accepted\": " << (records.accepted[i] ? "true" : "false") << "}";
+		ofile << (i + 1 < records.path1.size() ? ",\n" : "\n");
+	}
+	ofile << "]\n";
+	ofile.close();
+}
+
 // Surface solving
 
 // regularity of the surface
@@ -585,6 +734,7 @@ class SurfaceCost : public ceres::SizedCostFunction<1, 1, 1, 1> {
 		const AABB_tree &tree;
 		Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> mesh_labels;
 		Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> normal_angle_coef;
+		std::atomic<std::size_t> *evaluations; // nullptr when the telemetry is disabled
 
 		double cost_at_point(const double j, const double z, double *grad) const {
 			double local_cost = 0;
@@ -668,7 +818,8 @@ class SurfaceCost : public ceres::SizedCostFunction<1, 1, 1, 1> {
 					unsigned char label,
 					double tunnel_height,
 					const Surface_mesh &mesh,
-					const AABB_tree &tree) :
+					const AABB_tree &tree,
+					std::atomic<std::size_t> *evaluations = nullptr) :
 		coef(coef),
 		cost(cost),
 		start(start),
@@ -676,7 +827,8 @@ class SurfaceCost : public ceres::SizedCostFunction<1, 1, 1, 1> {
 		label(label),
 		tunnel_height(tunnel_height),
 		mesh(mesh),
-		tree(tree) {
+		tree(tree),
+		evaluations(evaluations) {
 			// Get label property
 			bool has_label;
 			boost::tie(mesh_labels, has_label) = mesh.property_map<Surface_mesh::Face_index, unsigned char>("f:label");
@@ -693,6 +845,8 @@ class SurfaceCost : public ceres::SizedCostFunction<1, 1, 1, 1> {
 			const double* const xr = parameters[1];
 			const double* const z = parameters[2];
 
+			if (evaluations != nullptr) evaluations->fetch_add(1, std::memory_order_relaxed);
+
 			if (xr[0] + xl[0] < 0) { // the road has a negative width
 				residual[0] = (-xl[0] - xr[0])*coef*10;
 
@@ -949,9 +1103,11 @@ pathBridge bridge (pathLink link, const Surface_mesh &mesh, const AABB_tree &tre
 	}
 
 	// attachment to DSM data
+	std::atomic<std::size_t> surface_cost_evaluations(0);
+	std::atomic<std::size_t> *evaluation_counter = Bridge_telemetry::is_enabled() ? &surface_cost_evaluations : nullptr;
 	for (int i = 0; i <= bridge.N; i++) {
 		problem.AddResidualBlock(
-			new SurfaceCost(beta, theta, link.first.point + ((float) i)/bridge.N*link_vector, n, bridge.label, tunnel_height, mesh, tree),
+			new SurfaceCost(beta, theta, link.first.point + ((float) i)/bridge.N*link_vector, n, bridge.label, tunnel_height, mesh, tree, evaluation_counter),
 			nullptr,
 			bridge.xl + i, //x^l_{i}
 			bridge.xr + i, //x^r_{i}
@@ -1056,6 +1212,14 @@ pathBridge bridge (pathLink link, const Surface_mesh &mesh, const AABB_tree &tre
 
 	//std::cerr << summary.FullReport() << "\n";
 
+	if (Bridge_telemetry::is_enabled()) {
+		bridge.stats.iterations = summary.iterations.size();
+		bridge.stats.residual_evaluations = summary.num_residual_evaluations;
+		bridge.stats.surface_cost_evaluations = surface_cost_evaluations.load();
+		bridge.stats.solve_time = summary.total_time_in_seconds;
+		bridge.stats.final_cost = summary.final_cost;
+	}
+
 	//Border constraint
 	if (bridge.xl[0] > dl0) bridge.xl[0] = dl0;
 	if (bridge.xl[bridge.N] > dlN) bridge.xl[bridge.N] = dlN;
@@ -1305,9 +1469,10 @@ void close_surface_mesh(Surface_mesh &mesh) {
 	assert(borders_edge.size() == 1);
 	auto border_edge = borders_edge[0];
 
-	std::vector<Point_3> points_top;
-	std::vector<Point_3> points_bottom;
-	std::vector<Surface_mesh::Halfedge_index> halfedges_border;
+	// Border cycle, stored before adding any face as next() changes on the border
+	std::vector<Surface_mesh::Halfedge_index> border_cycle;
+	// Position in border_cycle of the halfedge whose target is linked to each outer vertex
+	std::vector<std::size_t> border_position;
 	std::vector<Surface_mesh::Vertex_index> vertices_top;
 	std::vector<Surface_mesh::Vertex_index> vertices_bottom;
 	
@@ -1318,6 +1483,7 @@ void close_surface_mesh(Surface_mesh &mesh) {
 	K::Vector_2 vec (1, 0);
 	K::Direction_2 start = vec.direction();
 
+	// The outer ring is angularly monotone around center, so it is star-shaped from center
 	do {
 		auto pt = mesh.point(mesh.target(halfedge));
 		K::Vector_2 vec1 (center, Point_2(pt.x(), pt.y()));
@@ -1325,98 +1491,59 @@ void close_surface_mesh(Surface_mesh &mesh) {
 			auto p0 = K::Point_2(pt.x(), pt.y()) + vec1 / CGAL::sqrt(vec1.squared_length()) * 20;
 			auto va = mesh.add_vertex(Point_3(p0.x(), p0.y(), bb.zmin()));
 			auto vb = mesh.add_vertex(Point_3(p0.x(), p0.y(), bb.zmin() - 10));
-			halfedges_border.push_back(halfedge);
+			border_position.push_back(border_cycle.size());
 			vertices_top.push_back(va);
 			vertices_bottom.push_back(vb);
-			points_top.push_back(mesh.point(va));
-			points_bottom.push_back(mesh.point(vb));
 			vec = vec1;
 		}
+		border_cycle.push_back(halfedge);
 		halfedge = CGAL::next(halfedge, mesh);
 	} while (halfedge != border_edge);
+	assert(vertices_top.size() > 2);
 
-	//bottom
-	std::vector<CGAL::Triple<int, int, int>> patch;
-	patch.reserve(points_bottom.size() -2);
-	CGAL::Polygon_mesh_processing::triangulate_hole_polyline (points_bottom, points_top, std::back_inserter(patch));
-
-	for(auto face: patch) {
-		auto f = mesh.add_face(vertices_bottom[face.first], vertices_bottom[face.second], vertices_bottom[face.third]);
+	std::vector<Surface_mesh::Face_index> new_faces;
+	new_faces.reserve(2 * border_cycle.size() + 4 * vertices_top.size());
+	auto add_face = [&](Surface_mesh::Vertex_index v0, Surface_mesh::Vertex_index v1, Surface_mesh::Vertex_index v2) {
+		auto f = mesh.add_face(v0, v1, v2);
+		assert(f != Surface_mesh::null_face());
 		true_face[f] = false;
+		new_faces.push_back(f);
+	};
+
+	//bottom: fan from the center, valid as the ring is star-shaped from it
+	auto bottom_center = mesh.add_vertex(Point_3(center.x(), center.y(), bb.zmin() - 10));
+	for (std::size_t i = 0; i < vertices_bottom.size(); i++) {
+		add_face(vertices_bottom[i], vertices_bottom[(i+1) % vertices_bottom.size()], bottom_center);
 	}
 
 	//border
 	for (std::size_t i = 0; i < vertices_top.size(); i++) {
-		auto f = mesh.add_face(vertices_top[i], vertices_top[(i+1) % vertices_top.size()], vertices_bottom[(i+1) % vertices_top.size()]);
-		true_face[f] = false;
-		f = mesh.add_face(vertices_top[i], vertices_bottom[(i+1) % vertices_top.size()], vertices_bottom[i]);
-		true_face[f] = false;
+		add_face(vertices_top[i], vertices_top[(i+1) % vertices_top.size()], vertices_bottom[(i+1) % vertices_top.size()]);
+		add_face(vertices_top[i], vertices_bottom[(i+1) % vertices_top.size()], vertices_bottom[i]);
 	}
 
-	//check intersection
-	Surface_mesh new_faces;
-	std::list<Surface_mesh::Halfedge_index> holes;
-	for (std::size_t i = 1; i < vertices_top.size(); i+=50) {
-		/*bool do_intersect;
+	//skirt: strip between the mesh border and the top ring
+	for (std::size_t i = 0; i < vertices_top.size(); i++) {
+		std::size_t j = (i+1) % vertices_top.size();
+		add_face(mesh.target(border_cycle[border_position[i]]), vertices_top[j], vertices_top[i]);
+		std::size_t k = border_position[i];
 		do {
-			i++;
-			new_faces.clear();
-			auto v0 = new_faces.add_vertex(mesh.point(mesh.target(halfedges_border[i-1])));
-			auto v1 = new_faces.add_vertex(mesh.point(mesh.target(mesh.next(halfedges_border[i-1]))));
-			auto v2 = new_faces.add_vertex(points_top[i-1]);
-			auto v3 = new_faces.add_vertex(points_top[i]);
-
-			std::cerr << "face1: " << mesh.face(mesh.opposite(halfedges_border[i-1])) << "\n";
-			std::cerr << "face2: " << mesh.face(mesh.opposite(mesh.next(halfedges_border[i-1]))) << "\n";
-
-			new_faces.add_face(v0, v1, v3);
-			new_faces.add_face(v0, v3, v2);
-
-			std::list<std::pair<Surface_mesh::Face_index, Surface_mesh::Face_index>> intersecting_faces;
-			CGAL::Polygon_mesh_processing::internal::compute_face_face_intersection(mesh, new_faces, std::back_inserter(intersecting_faces), CGAL::parameters::all_default(), CGAL::parameters::all_default());
-			do_intersect = false;
-			if (intersecting_faces.size() > 0) {
-				for (auto& info: intersecting_faces) {
-					std::cerr << "f0: " << info.first << ", f1: " << info.second << "\n";
-					if (info.first.idx() != mesh.face(mesh.opposite(halfedges_border[i-1])).idx() && info.first.idx() != mesh.face(mesh.opposite(mesh.next(halfedges_border[i-1]))).idx()) {
-						do_intersect = true;
-						break;
-					}
-				}
-			}
-
-		} while (do_intersect && i + 1 < vertices_top.size());*/
-
-		if (i < vertices_top.size()) {
-			auto f = mesh.add_face(mesh.target(halfedges_border[i-1]), mesh.target(mesh.next(halfedges_border[i-1])), vertices_top.at(i));
-			true_face[f] = false;
-			f = mesh.add_face(mesh.target(halfedges_border[i-1]), vertices_top.at(i), vertices_top.at(i-1));
-			true_face[f] = false;
-
-			bool exist;
-			Surface_mesh::Halfedge_index border;
-			boost::tie(border, exist) = CGAL::halfedge(mesh.target(halfedges_border[i-1]), vertices_top.at(i-1), mesh);
-			assert(exist);
-			if (!mesh.is_border(border)) border = mesh.opposite(border);
-			assert(mesh.is_border(border));
-
-			holes.push_back(border);
-		}
-	}
-
-	for (auto & border: holes) {
-		std::vector<Surface_mesh::Face_index> patch_facets;
-		CGAL::Polygon_mesh_processing::triangulate_hole(mesh, border, std::back_inserter(patch_facets));
-		for (auto face: patch_facets) {
-			true_face[face] = false;
-		}
+			k = (k+1) % border_cycle.size();
+			add_face(mesh.source(border_cycle[k]), mesh.target(border_cycle[k]), vertices_top[j]);
+		} while (k != border_position[j]);
 	}
 
-	assert(!CGAL::Polygon_mesh_processing::does_self_intersect(mesh));
+	assert(!CGAL::Polygon_mesh_processing::does_self_intersect(new_faces, mesh));
 	assert(CGAL::is_closed(mesh));
-	CGAL::Polygon_mesh_processing::orient_to_bound_a_volume(mesh);
+	// Faces are added consistently with the mesh orientation, only the global sign may be wrong
+	if (!CGAL::Polygon_mesh_processing::is_outward_oriented(mesh)) {
+		CGAL::Polygon_mesh_processing::reverse_face_orientations(mesh);
+	}
 }
 
+typedef CGAL::AABB_triangle_primitive<K, std::vector<K::Triangle_3>::const_iterator> Triangle_primitive;
+typedef CGAL::AABB_tree<CGAL::AABB_traits<K, Triangle_primitive>>                    Triangle_tree;
+
 AABB_tree index_surface_mesh(Surface_mesh &mesh) {
 	AABB_tree tree;
 	PMP::build_AABB_tree(mesh, tree);
@@ -1436,6 +1563,33 @@ class Cost_stop_predicate {
 		const float cost;
 };
 
+// Parent to children lineage of the faces split by the corefinements
+struct Face_provenance {
+	// Face to the original face it comes from
+	std::map<Surface_mesh::Face_index, Surface_mesh::Face_index> origin;
+	// Original face to all the faces created from it (itself included)
+	std::map<Surface_mesh::Face_index, std::vector<Surface_mesh::Face_index>> children;
+	// Original face to the points to reassociate to one of its children
+	std::map<Surface_mesh::Face_index, std::vector<Point_set::Index>> points;
+
+	Surface_mesh::Face_index add_origin(Surface_mesh::Face_index face) {
+		auto it = origin.find(face);
+		if (it != origin.end()) return it->second;
+		origin[face] = face;
+		children[face].push_back(face);
+		return face;
+	}
+
+	// Forgets a removed face whose slot is reused by a face created by a later corefinement
+	void reset(Surface_mesh::Face_index face) {
+		auto it = origin.find(face);
+		if (it == origin.end()) return;
+		auto &siblings = children[it->second];
+		siblings.erase(std::find(siblings.begin(), siblings.end(), face));
+		origin.erase(it);
+	}
+};
+
 struct CorefinementVisitor : public CGAL::Polygon_mesh_processing::Corefinement::Default_visitor<Surface_mesh> {
 	Surface_mesh::Property_map<Surface_mesh::Face_index, int> path;
 	Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> label;
@@ -1448,10 +1602,11 @@ struct CorefinementVisitor : public CGAL::Polygon_mesh_processing::Corefinement:
 	unsigned char current_label;
 	bool current_true_face;
 	bool current_is_new_face;
+	Surface_mesh::Face_index current_origin;
 	const Surface_mesh *main_mesh;
-	std::set<Point_set::Index>& point_to_moves;
+	Face_provenance& provenance;
 
-	CorefinementVisitor (const Surface_mesh *mesh, std::set<Point_set::Index>& point_to_moves) : main_mesh(mesh), point_to_moves(point_to_moves) {
+	CorefinementVisitor (const Surface_mesh *mesh, Face_provenance& provenance) : main_mesh(mesh), provenance(provenance) {
 		if (main_mesh != nullptr) {
 			bool has_path;
 			boost::tie(path, has_path) = mesh->property_map<Surface_mesh::Face_index, int>("path");
@@ -1485,7 +1640,10 @@ struct CorefinementVisitor : public CGAL::Polygon_mesh_processing::Corefinement:
 			current_label = label[f_split];
 			current_true_face = true_face[f_split];
 			current_is_new_face = is_new_face[f_split];
-			point_to_moves.insert(point_in_face[f_split].begin(), point_in_face[f_split].end());
+			// f_split is kept as one of the subfaces
+			current_origin = provenance.add_origin(f_split);
+			auto &points = provenance.points[current_origin];
+			points.insert(points.end(), point_in_face[f_split].begin(), point_in_face[f_split].end());
 			point_in_face[f_split].clear();
 		} else {
 			Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> bridge_label;
@@ -1502,6 +1660,9 @@ struct CorefinementVisitor : public CGAL::Polygon_mesh_processing::Corefinement:
 			label[f_new] = current_label;
 			true_face[f_new] = current_true_face;
 			is_new_face[f_new] = current_is_new_face;
+			provenance.reset(f_new);
+			provenance.origin[f_new] = current_origin;
+			provenance.children[current_origin].push_back(f_new);
 		} else {
 			Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> bridge_label;
 			bool has_label;
@@ -1523,6 +1684,7 @@ struct CorefinementVisitor : public CGAL::Polygon_mesh_processing::Corefinement:
 			label[f_tgt] = bridge_label[f_src];
 			is_new_face[f_tgt] = true;
 			true_face[f_tgt] = true;
+			provenance.reset(f_tgt);
 		} else {
 			Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> bridge_label1, bridge_label2;
 			bool has_label;
@@ -1814,8 +1976,6 @@ void add_bridge_to_mesh(Surface_mesh &mesh, Point_set &point_cloud, const std::v
 	CGAL::Cartesian_converter<Surface_mesh::Point::R, CGAL::Exact_predicates_exact_constructions_kernel> to_exact;
 	CGAL::Cartesian_converter<CGAL::Exact_predicates_exact_constructions_kernel, Surface_mesh::Point::R> to_kernel;
 
-	Surface_mesh mesh_copy = mesh;
-
 	// Add exact points to mesh
 	Surface_mesh::Property_map<Surface_mesh::Vertex_index, CGAL::Exact_predicates_exact_constructions_kernel::Point_3> exact_points;
 	bool created;
@@ -1843,7 +2003,7 @@ void add_bridge_to_mesh(Surface_mesh &mesh, Point_set &point_cloud, const std::v
 	// change point location
 	CGAL::Cartesian_converter<Point_set_kernel, K> type_converter;
 
-	std::set<Point_set::Index> point_to_moves;
+	Face_provenance provenance;
 	std::vector<std::set<Point_set::Index>> point_to_checks(bridges.size());
 
 	// points for label changes
@@ -1853,10 +2013,32 @@ void add_bridge_to_mesh(Surface_mesh &mesh, Point_set &point_cloud, const std::v
 		}
 	}
 
+	// Surface under the bridges, before corefinement, for the level crossing detection
+	std::vector<K::Triangle_3> under_bridge_triangles;
+	std::vector<unsigned char> under_bridge_labels;
+	{
+		std::set<Surface_mesh::Face_index> under_bridge_faces;
+		for (const auto& bridge: bridges) {
+			for (const auto& face: bridge.crossing_faces) {
+				under_bridge_faces.insert(face);
+				for (auto he: CGAL::halfedges_around_face(mesh.halfedge(face), mesh)) {
+					if (!mesh.is_border(mesh.opposite(he))) under_bridge_faces.insert(mesh.face(mesh.opposite(he)));
+				}
+			}
+		}
+		for (const auto& face: under_bridge_faces) {
+			auto he = mesh.halfedge(face);
+			under_bridge_triangles.emplace_back(mesh.point(mesh.source(he)), mesh.point(mesh.target(he)), mesh.point(mesh.target(mesh.next(he))));
+			under_bridge_labels.push_back(mesh_label[face]);
+		}
+	}
+
 	// point to reassociate to faces
 	for (const auto& bridge: bridges) {
 		for (const auto& face: bridge.crossing_faces) {
-			point_to_moves.insert(point_in_face[face].begin(), point_in_face[face].end());
+			auto origin = provenance.add_origin(face);
+			auto &points = provenance.points[origin];
+			points.insert(points.end(), point_in_face[face].begin(), point_in_face[face].end());
 			point_in_face[face].clear();
 		}
 	}
@@ -1887,7 +2069,7 @@ void add_bridge_to_mesh(Surface_mesh &mesh, Point_set &point_cloud, const std::v
 		boost::tie(vpm2, has_exact_points) = support_meshes[i].property_map<Surface_mesh::Vertex_index, CGAL::Exact_predicates_exact_constructions_kernel::Point_3>("v:exact_point");
 		assert(has_exact_points);
 
-		std::cout << "Support bridge: " << CGAL::Polygon_mesh_processing::corefine_and_compute_union(mesh, support_meshes[i], mesh, CGAL::parameters::vertex_point_map(exact_points).visitor(CorefinementVisitor(&mesh, point_to_moves)), CGAL::parameters::vertex_point_map(vpm2), CGAL::parameters::vertex_point_map(exact_points)) << "\n";
+		std::cout << "Support bridge: " << CGAL::Polygon_mesh_processing::corefine_and_compute_union(mesh, support_meshes[i], mesh, CGAL::parameters::vertex_point_map(exact_points).visitor(CorefinementVisitor(&mesh, provenance)), CGAL::parameters::vertex_point_map(vpm2), CGAL::parameters::vertex_point_map(exact_points)) << "\n";
 
 		auto r_b = compute_remove_mesh(bridge, mesh_info);
 		boost::tie(vpm1, has_exact_points) = r_b.property_map<Surface_mesh::Vertex_index, CGAL::Exact_predicates_exact_constructions_kernel::Point_3>("v:exact_point");
@@ -1896,29 +2078,29 @@ void add_bridge_to_mesh(Surface_mesh &mesh, Point_set &point_cloud, const std::v
 		AABB_tree mesh_tree;
 		PMP::build_AABB_tree(r_b, mesh_tree);
 
+		std::vector<Point_set::Index> points_to_locate;
+		std::vector<unsigned char> new_labels;
+		std::vector<K::Ray_3> rays_top, rays_bottom;
 		for (auto &ph: point_to_checks[i]) {
-
+			unsigned char new_label;
 			if (point_cloud_label[ph] == LABEL_OTHER || point_cloud_label[ph] == LABEL_UNKNOWN) {
-				auto p = type_converter(point_cloud.point(ph));
-
-				const K::Ray_3 ray_top(p, K::Direction_3(0, 0, 1));
-				const K::Ray_3 ray_bottom(p, K::Direction_3(0, 0, -1));
-
-				auto location_top = PMP::locate_with_AABB_tree(ray_top, mesh_tree, r_b);
-				auto location_bottom = PMP::locate_with_AABB_tree(ray_bottom, mesh_tree, r_b);
-
-				if (location_top.first != r_b.null_face() || location_bottom.first != r_b.null_face()) point_cloud_label[ph] = bridge.label;
+				new_label = bridge.label;
 			} else if ((point_cloud_label[ph] == LABEL_RAIL && bridge.label == LABEL_ROAD) || (point_cloud_label[ph] == LABEL_ROAD && bridge.label == LABEL_RAIL)) {
-				auto p = type_converter(point_cloud.point(ph));
-
-				const K::Ray_3 ray_top(p, K::Direction_3(0, 0, 1));
-				const K::Ray_3 ray_bottom(p, K::Direction_3(0, 0, -1));
-
-				auto location_top = PMP::locate_with_AABB_tree(ray_top, mesh_tree, r_b);
-				auto location_bottom = PMP::locate_with_AABB_tree(ray_bottom, mesh_tree, r_b);
-
-				if (location_top.first != r_b.null_face() || location_bottom.first != r_b.null_face()) point_cloud_label[ph] = LABEL_LEVEL_CROSSING;
+				new_label = LABEL_LEVEL_CROSSING;
+			} else {
+				continue;
 			}
+			auto p = type_converter(point_cloud.point(ph));
+			points_to_locate.push_back(ph);
+			new_labels.push_back(new_label);
+			rays_top.emplace_back(p, K::Direction_3(0, 0, 1));
+			rays_bottom.emplace_back(p, K::Direction_3(0, 0, -1));
+		}
+
+		auto locations_top = PointLocation::locate(rays_top, mesh_tree, r_b);
+		auto locations_bottom = PointLocation::locate(rays_bottom, mesh_tree, r_b);
+		for (std::size_t j = 0; j < points_to_locate.size(); j++) {
+			if (locations_top[j].first != r_b.null_face() || locations_bottom[j].first != r_b.null_face()) point_cloud_label[points_to_locate[j]] = new_labels[j];
 		}
 
 		for (auto& path_id: crossing_paths[i]) {
@@ -1935,15 +2117,15 @@ void add_bridge_to_mesh(Surface_mesh &mesh, Point_set &point_cloud, const std::v
 					vpm3[vertex] = vpm2[vertex] + CGAL::Exact_predicates_exact_constructions_kernel::Vector_3(0, 0, bridges[i].z_segment[0]);
 				}
 
-				std::set<Point_set::Index> empty_set;
-				CGAL::Polygon_mesh_processing::corefine(r_b, path_corefine_mesh[path_id].second, CGAL::parameters::vertex_point_map(vpm1).visitor(CorefinementVisitor(nullptr, empty_set)), CGAL::parameters::vertex_point_map(vpm3).do_not_modify(true));
+				Face_provenance no_provenance;
+				CGAL::Polygon_mesh_processing::corefine(r_b, path_corefine_mesh[path_id].second, CGAL::parameters::vertex_point_map(vpm1).visitor(CorefinementVisitor(nullptr, no_provenance)), CGAL::parameters::vertex_point_map(vpm3).do_not_modify(true));
 
 				path_corefine_mesh[path_id].second.remove_property_map<Surface_mesh::Vertex_index, CGAL::Exact_predicates_exact_constructions_kernel::Point_3>(vpm3);
 
 			}
 		}
 
-		std::cout << "Remove bridge: " << CGAL::Polygon_mesh_processing::corefine_and_compute_difference(mesh, r_b, mesh, CGAL::parameters::vertex_point_map(exact_points).visitor(CorefinementVisitor(&mesh, point_to_moves)), CGAL::parameters::vertex_point_map(vpm1), CGAL::parameters::vertex_point_map(exact_points)) << "\n";
+		std::cout << "Remove bridge: " << CGAL::Polygon_mesh_processing::corefine_and_compute_difference(mesh, r_b, mesh, CGAL::parameters::vertex_point_map(exact_points).visitor(CorefinementVisitor(&mesh, provenance)), CGAL::parameters::vertex_point_map(vpm1), CGAL::parameters::vertex_point_map(exact_points)) << "\n";
 
 		//assert(!CGAL::Polygon_mesh_processing::does_self_intersect(mesh, CGAL::parameters::vertex_point_map(exact_points)));
 		assert(std::cout << CGAL::Polygon_mesh_processing::does_bound_a_volume(mesh, CGAL::parameters::vertex_point_map(exact_points)));
@@ -1954,14 +2136,65 @@ void add_bridge_to_mesh(Surface_mesh &mesh, Point_set &point_cloud, const std::v
 		mesh.point(vertex) = to_kernel(exact_points[vertex]);
 	}
 
-	// Reassociate point
-	AABB_tree mesh_tree;
-	PMP::build_AABB_tree(mesh, mesh_tree);
+	// Reassociate point to the closest face among the children of its original face
+	auto face_triangle = [&mesh](Surface_mesh::Face_index face) {
+		auto he = mesh.halfedge(face);
+		return K::Triangle_3(mesh.point(mesh.source(he)), mesh.point(mesh.target(he)), mesh.point(mesh.target(mesh.next(he))));
+	};
+
+	// Faces copied from the bridges, only searched for points whose original face was fully removed
+	std::vector<Surface_mesh::Face_index> bridge_faces;
+	std::vector<K::Triangle_3> bridge_triangles;
+	Triangle_tree bridge_tree;
+	bool bridge_tree_built = false;
+
+	std::vector<Surface_mesh::Face_index> candidates;
+	std::vector<K::Triangle_3> candidate_triangles;
+	for (const auto &origin_points: provenance.points) {
+		if (origin_points.second.empty()) continue;
+
+		candidates.clear();
+		candidate_triangles.clear();
+		for (auto face: provenance.children[origin_points.first]) {
+			if (!mesh.is_removed(face)) {
+				candidates.push_back(face);
+				candidate_triangles.push_back(face_triangle(face));
+			}
+		}
 
-	for (auto &ph: point_to_moves) {
-		auto p = type_converter(point_cloud.point(ph));
-		auto location = PMP::locate_with_AABB_tree(p, mesh_tree, mesh);
-		point_in_face[location.first].push_back(ph);
+		if (candidates.empty()) {
+			if (!bridge_tree_built) {
+				for (auto face: mesh.faces()) {
+					if (is_new_face[face]) {
+						bridge_faces.push_back(face);
+						bridge_triangles.push_back(face_triangle(face));
+					}
+				}
+				bridge_tree.insert(bridge_triangles.begin(), bridge_triangles.end());
+				bridge_tree.accelerate_distance_queries();
+				bridge_tree_built = true;
+			}
+			if (bridge_faces.empty()) continue;
+			for (auto &ph: origin_points.second) {
+				auto closest = bridge_tree.closest_point_and_primitive(type_converter(point_cloud.point(ph)));
+				point_in_face[bridge_faces[closest.second - bridge_triangles.begin()]].push_back(ph);
+			}
+			continue;
+		}
+
+		for (auto &ph: origin_points.second) {
+			auto p = type_converter(point_cloud.point(ph));
+			std::size_t best = 0;
+			K::FT best_d = CGAL::squared_distance(p, candidate_triangles[0]);
+			for (std::size_t i = 1; i < candidate_triangles.size(); i++) {
+				K::FT d = CGAL::squared_distance(p, candidate_triangles[i]);
+				if (d < best_d) {
+					best_d = d;
+					best = i;
+				}
+			}
+			point_in_face[candidates[best]].push_back(ph);
+		}
 	}
 
 	std::cout << "Add new points" << std::endl;
@@ -1981,63 +2214,71 @@ void add_bridge_to_mesh(Surface_mesh &mesh, Point_set &point_cloud, const std::v
 	}
 
 	if (count_to_be_sampled > 0) {
-		CGAL::Face_filtered_graph<Surface_mesh> filtered_sm(mesh, true, to_be_sampled);
-
-		std::list<K::Point_3> out;
-		PMP::sample_triangle_mesh(filtered_sm, std::back_inserter(out), CGAL::parameters::use_random_uniform_sampling(true).do_sample_edges(false).do_sample_vertices(false).number_of_points_per_area_unit(10));
-
-		mesh.remove_property_map<Surface_mesh::Face_index, bool>(to_be_sampled);
-
 		CGAL::Cartesian_converter<K, Point_set_kernel> to_point_set_kernel;
 
-		std::list<std::pair<Point_set::Index, K::Point_3>> new_points;
-		for (const auto& p: out) {
-			auto v = point_cloud.insert(to_point_set_kernel(p));
-			is_new_point[*v] = true;
-			new_points.push_back(std::make_pair(*v,p));
-			auto location = PMP::locate_with_AABB_tree(p, mesh_tree, mesh);
-			point_in_face[location.first].push_back(*v);
-			point_cloud_label[*v] = mesh_label[location.first];
+		// Uniform sampling at 10 points per area unit, each sample being generated in its face
+		CGAL::Random &random = CGAL::get_default_random();
+		std::vector<std::pair<Point_set::Index, K::Point_3>> new_points;
+		for(auto &face: mesh.faces()) {
+			if (!to_be_sampled[face]) continue;
+			auto triangle = face_triangle(face);
+			double expected = 10 * CGAL::sqrt(triangle.squared_area());
+			std::size_t n = (std::size_t) expected;
+			if (random.get_double() < expected - n) n++;
+			CGAL::Random_points_in_triangle_3<K::Point_3> generator(triangle, random);
+			for (std::size_t i = 0; i < n; i++, ++generator) {
+				auto p = *generator;
+				auto v = point_cloud.insert(to_point_set_kernel(p));
+				is_new_point[*v] = true;
+				new_points.push_back(std::make_pair(*v,p));
+				point_in_face[face].push_back(*v);
+				point_cloud_label[*v] = mesh_label[face];
+			}
 		}
 
+		mesh.remove_property_map<Surface_mesh::Face_index, bool>(to_be_sampled);
+
 		for (std::size_t i = 0; i < bridges.size(); i++) {
 			if (bridges[i].label == LABEL_RAIL || bridges[i].label == LABEL_ROAD) {
 				AABB_tree mesh_tree;
 				PMP::build_AABB_tree(support_meshes[i], mesh_tree);
 
-				for (const auto &p: new_points) {
+				std::vector<std::size_t> points_to_locate;
+				std::vector<K::Ray_3> rays_bottom;
+				for (std::size_t j = 0; j < new_points.size(); j++) {
+					const auto &p = new_points[j];
 					if ((point_cloud_label[p.first] == LABEL_RAIL || point_cloud_label[p.first] == LABEL_ROAD) && point_cloud_label[p.first] != bridges[i].label) {
 						auto np = K::Point_3(p.second.x(), p.second.y(), p.second.z() + 1);
-						const K::Ray_3 ray_bottom(np, K::Direction_3(0, 0, -1));
-						auto location = PMP::locate_with_AABB_tree(ray_bottom, mesh_tree, support_meshes[i]);
-						if (location.first != support_meshes[i].null_face()) {
-							auto m_p = PMP::construct_point(location, support_meshes[i]);
-							if (CGAL::squared_distance(p.second, m_p) - 1 < 1) {
-								point_cloud_label[p.first] = LABEL_LEVEL_CROSSING;
-							}
+						points_to_locate.push_back(j);
+						rays_bottom.emplace_back(np, K::Direction_3(0, 0, -1));
+					}
+				}
+
+				auto locations = PointLocation::locate(rays_bottom, mesh_tree, support_meshes[i]);
+				for (std::size_t j = 0; j < points_to_locate.size(); j++) {
+					const auto &p = new_points[points_to_locate[j]];
+					if (locations[j].first != support_meshes[i].null_face()) {
+						auto m_p = PMP::construct_point(locations[j], support_meshes[i]);
+						if (CGAL::squared_distance(p.second, m_p) - 1 < 1) {
+							point_cloud_label[p.first] = LABEL_LEVEL_CROSSING;
 						}
 					}
 				}
 			}
 		}
 
-		AABB_tree mesh_copy_tree;
-		PMP::build_AABB_tree(mesh_copy, mesh_copy_tree);
-
-		Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> mesh_copy_label;
-		bool has_mesh_copy_label;
-		boost::tie(mesh_copy_label, has_mesh_copy_label) = mesh_copy.property_map<Surface_mesh::Face_index, unsigned char>("f:label");
-		assert(has_mesh_copy_label);
+		Triangle_tree under_bridge_tree(under_bridge_triangles.begin(), under_bridge_triangles.end());
 
 		for (const auto &p: new_points) {
-			if (point_cloud_label[p.first] == LABEL_RAIL || point_cloud_label[p.first] == LABEL_ROAD) {
+			if ((point_cloud_label[p.first] == LABEL_RAIL || point_cloud_label[p.first] == LABEL_ROAD) && !under_bridge_triangles.empty()) {
 				auto np = K::Point_3(p.second.x(), p.second.y(), p.second.z() + 1);
 				const K::Ray_3 ray_bottom(np, K::Direction_3(0, 0, -1));
-				auto location = PMP::locate_with_AABB_tree(ray_bottom, mesh_copy_tree, mesh_copy);
-				if (location.first != mesh_copy.null_face()) {
-					if ((mesh_copy_label[location.first] == LABEL_RAIL || mesh_copy_label[location.first] == LABEL_ROAD) && mesh_copy_label[location.first] != point_cloud_label[p.first]) {
-						auto m_p = PMP::construct_point(location, mesh_copy);
-						if (CGAL::squared_distance(p.second, m_p) - 1 < 1) {
+				auto intersection = under_bridge_tree.first_intersection(ray_bottom);
+				if (intersection) {
+					const K::Point_3 *m_p = boost::get<K::Point_3>(&(intersection->first));
+					auto l = under_bridge_labels[intersection->second - under_bridge_triangles.begin()];
+					if (m_p != nullptr && (l == LABEL_RAIL || l == LABEL_ROAD) && l != point_cloud_label[p.first]) {
+						if (CGAL::squared_distance(p.second, *m_p) - 1 < 1) {
 							point_cloud_label[p.first] = LABEL_LEVEL_CROSSING;
 						}
 					}
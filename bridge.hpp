@@ -11,6 +11,9 @@
 
 #include <vector>
 #include <map>
+#include <list>
+#include <mutex>
+#include <memory>
 
 typedef std::pair<skeletonPoint,skeletonPoint> pathLink;
 
@@ -20,6 +23,18 @@ typedef CGAL::AABB_tree<AABB_face_graph_traits>                AABB_tree;
 
 std::set<pathLink> link_paths(const Surface_mesh &mesh, const std::vector<std::list<Surface_mesh::Face_index>> &paths, const std::map<int, CGAL::Polygon_with_holes_2<Exact_predicates_kernel>> &path_polygon, const std::map<int, boost::shared_ptr<CGAL::Straight_skeleton_2<K>>> &medial_axes, const Surface_mesh_info &mesh_info);
 
+// Group links between the same paths whose ends are closer than radius (no grouping if radius is 0), shortest link first
+std::vector<std::vector<pathLink>> cluster_links(const std::set<pathLink> &links, K::FT radius);
+
+// Solver statistics of a bridge, only filled when the telemetry is enabled
+struct Bridge_solve_stats {
+	int iterations = 0;
+	int residual_evaluations = 0;
+	std::size_t surface_cost_evaluations = 0;
+	double solve_time = 0; // in second
+	double final_cost = 0; // ceres cost
+};
+
 struct pathBridge {
 	pathLink link;
 	unsigned char label;
@@ -29,6 +44,7 @@ struct pathBridge {
 	double *z_segment;
 	float cost;
 	std::set<Surface_mesh::Face_index> crossing_faces;
+	Bridge_solve_stats stats;
 
 	pathBridge(pathLink link);
 	pathBridge(const pathBridge& other);
@@ -38,6 +54,38 @@ struct pathBridge {
 
 pathBridge bridge (pathLink link, const Surface_mesh &mesh, const AABB_tree &tree, const Surface_mesh_info &mesh_info);
 
+// Per link telemetry of the bridge solver, disabled by default.
+// Records are appended without lock to a per-thread structure of arrays.
+class Bridge_telemetry {
+	public:
+		static void enable();
+		static bool is_enabled() { return enabled; }
+		static void record(const pathBridge &bridge, bool accepted);
+		static void save_csv(const char *filename);
+		static void save_json(const char *filename);
+
+	private:
+		struct Buffer {
+			std::vector<int> path1;
+			std::vector<int> path2;
+			std::vector<unsigned char> label;
+			std::vector<int> N;
+			std::vector<int> iterations;
+			std::vector<int> residual_evaluations;
+			std::vector<std::size_t> surface_cost_evaluations;
+			std::vector<double> solve_time;
+			std::vector<double> final_cost;
+			std::vector<float> cost;
+			std::vector<unsigned char> accepted;
+		};
+
+		static bool enabled;
+		static std::mutex buffers_mutex;
+		static std::list<std::unique_ptr<Buffer>> buffers;
+		static Buffer &local_buffer();
+		static Buffer merged_buffers();
+};
+
 void close_surface_mesh(Surface_mesh &mesh);
 
 AABB_tree index_surface_mesh(Surface_mesh &mesh);
@@ -80,28 +80,21 @@ void change_vertical_faces(Surface_mesh &mesh) {
 	boost::tie(label, has_label) = mesh.property_map<Surface_mesh::Face_index, unsigned char>("f:label");
 	assert(has_label);
 
+	Surface_mesh::Property_map<Surface_mesh::Face_index, K::Vector_3> face_normals;
+	bool has_face_normals;
+	boost::tie(face_normals, has_face_normals) = mesh.property_map<Surface_mesh::Face_index, K::Vector_3>("f:normal");
+	assert(has_face_normals);
+
 	for (auto face : mesh.faces()) {
 		if (label[face] == LABEL_RAIL) {
 
-			CGAL::Vertex_around_face_iterator<Surface_mesh> vbegin, vend;
-			boost::tie(vbegin, vend) = vertices_around_face(mesh.halfedge(face), mesh);
-			auto p0 = mesh.point(*(vbegin++));
-			auto p1 = mesh.point(*(vbegin++));
-			auto p2 = mesh.point(*(vbegin++));
-
-			auto n = CGAL::orthogonal_vector(p0, p1, p2);
+			const auto &n = face_normals[face];
 			if (CGAL::scalar_product(n, K::Vector_3(0,0,1)) / CGAL::sqrt(n.squared_length()) < 0.98) {
 				label[face] = LABEL_UNKNOWN;
 			}
 		} else if (label[face] == LABEL_ROAD) {
 
-			CGAL::Vertex_around_face_iterator<Surface_mesh> vbegin, vend;
-			boost::tie(vbegin, vend) = vertices_around_face(mesh.halfedge(face), mesh);
-			auto p0 = mesh.point(*(vbegin++));
-			auto p1 = mesh.point(*(vbegin++));
-			auto p2 = mesh.point(*(vbegin++));
-
-			auto n = CGAL::orthogonal_vector(p0, p1, p2);
+			const auto &n = face_normals[face];
 			if (CGAL::scalar_product(n, K::Vector_3(0,0,1)) / CGAL::sqrt(n.squared_length()) < 0.95) {
 				label[face] = LABEL_UNKNOWN;
 			}
@@ -116,13 +109,12 @@ void compute_normal_angle_coef(Surface_mesh &mesh) {
 	boost::tie(normal_angle_coef, created_normal_angle_coef) = mesh.add_property_map<Surface_mesh::Face_index, K::FT>("f:n_a_coef", 1);
 	assert(created_normal_angle_coef);
 
+	Surface_mesh::Property_map<Surface_mesh::Face_index, K::Vector_3> face_normals;
+	bool has_face_normals;
+	boost::tie(face_normals, has_face_normals) = mesh.property_map<Surface_mesh::Face_index, K::Vector_3>("f:normal");
+	assert(has_face_normals);
+
 	for (auto face : mesh.faces()) {
-		CGAL::Vertex_around_face_iterator<Surface_mesh> vbegin, vend;
-		boost::tie(vbegin, vend) = vertices_around_face(mesh.halfedge(face), mesh);
-		auto p0 = mesh.point(*(vbegin++));
-		auto p1 = mesh.point(*(vbegin++));
-		auto p2 = mesh.point(*(vbegin++));
-		auto n = CGAL::orthogonal_vector (p0, p1, p2);
-		normal_angle_coef[face] = sin(-CGAL::approximate_angle(n, K::Vector_3(0,0,1)) * M_PI / 180) + 1;
+		normal_angle_coef[face] = sin(-CGAL::approximate_angle(face_normals[face], K::Vector_3(0,0,1)) * M_PI / 180) + 1;
 	}
 }
@@ -0,0 +1,881 @@
+#include "collapse_engine.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <queue>
+#include <utility>
+
+#include <CGAL/boost/graph/Euler_operations.h>
+
+typedef SMS::Edge_profile<Surface_mesh> Profile;
+
+struct Round_collapse {
+	Profile profile;
+	boost::optional<Point_3> placement;
+	Surface_mesh::Vertex_index vertex;
+};
+
+// Link condition, and no vertex joining two borders through an inner edge: a subset of the tests of SMS::edge_collapse
+static bool is_collapse_topologically_valid(const Surface_mesh &mesh, const Profile &profile) {
+	auto edge = mesh.edge(profile.v0_v1());
+	if (!CGAL::Euler::does_satisfy_link_condition(edge, mesh)) return false;
+	if (!mesh.is_border(edge) && mesh.is_border(profile.v0()) && mesh.is_border(profile.v1())) return false;
+	return true;
+}
+
+// The faces kept around the edge must not flip when its vertices move to the
+// placement, with the normals of "f:normal" and of the last cost evaluation
+static bool is_collapse_geometrically_valid(const Profile &profile, const Point_3 &placement) {
+	return is_normal_change_bounded(profile, placement);
+}
+
+int round_edge_collapse(Surface_mesh &mesh, const Round_stop_predicate &stop, const Custom_placement &placement, const Custom_cost &cost, My_visitor &visitor, const Round_filter &filter, float max_round_fraction, Round_collapse_statistics *statistics) {
+	Round_collapse_statistics local_statistics;
+	if (statistics == nullptr) statistics = &local_statistics;
+
+	visitor.OnStarted(mesh);
+	// The lazy lookup of the first evaluation is not thread safe
+	placement.prepare(mesh);
+	cost.prepare(mesh);
+
+	const Surface_mesh &const_mesh = mesh;
+	K traits;
+	auto vpm = get(CGAL::vertex_point, const_mesh);
+	bool has_border = false;
+	for (const auto &h: mesh.halfedges()) {
+		if (mesh.is_border(h)) {
+			has_border = true;
+			break;
+		}
+	}
+	auto make_profile = [&](Surface_mesh::Halfedge_index h) {
+		return Profile(h, const_mesh, traits, vpm, has_border);
+	};
+
+	bool created;
+	Surface_mesh::Property_map<Surface_mesh::Edge_index, boost::optional<K::FT>> round_cost;
+	boost::tie(round_cost, created) = mesh.add_property_map<Surface_mesh::Edge_index, boost::optional<K::FT>>("e:round_cost", boost::optional<K::FT>());
+	assert(created);
+	Surface_mesh::Property_map<Surface_mesh::Edge_index, boost::optional<Point_3>> round_placement;
+	boost::tie(round_placement, created) = mesh.add_property_map<Surface_mesh::Edge_index, boost::optional<Point_3>>("e:round_placement", boost::optional<Point_3>());
+	assert(created);
+	// Last round in which an edge was queued for evaluation or a vertex was reserved
+	Surface_mesh::Property_map<Surface_mesh::Edge_index, std::size_t> edge_round;
+	boost::tie(edge_round, created) = mesh.add_property_map<Surface_mesh::Edge_index, std::size_t>("e:round", 0);
+	assert(created);
+	Surface_mesh::Property_map<Surface_mesh::Vertex_index, std::size_t> vertex_round;
+	boost::tie(vertex_round, created) = mesh.add_property_map<Surface_mesh::Vertex_index, std::size_t>("v:round", 0);
+	assert(created);
+
+	// Each evaluation only writes the data of its own edge
+	auto evaluate = [&](const std::vector<Surface_mesh::Edge_index> &edges) {
+		ParallelUtils::for_each_index(edges.size(), [&](std::size_t i) {
+			auto profile = make_profile(mesh.halfedge(edges[i]));
+			round_placement[edges[i]] = placement(profile);
+			round_cost[edges[i]] = cost(profile, round_placement[edges[i]]);
+		});
+		statistics->evaluations += edges.size();
+	};
+
+	std::vector<Surface_mesh::Edge_index> to_evaluate (mesh.edges().begin(), mesh.edges().end());
+	evaluate(to_evaluate);
+	for (const auto &edge: to_evaluate) {
+		visitor.OnCollected(make_profile(mesh.halfedge(edge)), round_cost[edge]);
+	}
+
+	std::size_t initial_edge_count = mesh.number_of_edges();
+	std::size_t current_edge_count = initial_edge_count;
+	std::vector<std::pair<K::FT, Surface_mesh::Edge_index>> candidates;
+	std::vector<Round_collapse> collapses;
+	bool stopped = false;
+	std::size_t round = 0;
+
+	while (!stopped) {
+		round++;
+
+		candidates.clear();
+		for (const auto &edge: mesh.edges()) {
+			if (round_cost[edge]) candidates.emplace_back(*round_cost[edge], edge);
+		}
+		std::sort(candidates.begin(), candidates.end());
+
+		// Selection, in cost order
+		std::size_t max_collapses = std::max<std::size_t>(1, max_round_fraction * current_edge_count);
+		collapses.clear();
+		for (const auto &candidate: candidates) {
+			if (collapses.size() >= max_collapses) break;
+
+			auto edge = candidate.second;
+			auto profile = make_profile(mesh.halfedge(edge));
+
+			bool independent = vertex_round[profile.v0()] != round && vertex_round[profile.v1()] != round;
+			for (const auto &v: profile.link()) {
+				if (vertex_round[v] == round) independent = false;
+			}
+			if (!independent) continue;
+
+			visitor.OnSelected(profile, round_cost[edge], initial_edge_count, current_edge_count);
+
+			if (stop(candidate.first, profile, initial_edge_count, current_edge_count)) {
+				visitor.OnStopConditionReached(profile);
+				stopped = true;
+				break;
+			}
+
+			boost::optional<Point_3> p = round_placement[edge];
+			if (p && filter) p = filter(profile, p);
+			if (!p || !is_collapse_topologically_valid(mesh, profile) || !is_collapse_geometrically_valid(profile, *p)) {
+				// Not collapsible until its neighbourhood changes
+				round_cost[edge] = boost::none;
+				continue;
+			}
+
+			vertex_round[profile.v0()] = round;
+			vertex_round[profile.v1()] = round;
+			for (const auto &v: profile.link()) vertex_round[v] = round;
+
+			current_edge_count -= 1 + (profile.left_face_exists() ? 1 : 0) + (profile.right_face_exists() ? 1 : 0);
+			collapses.push_back({profile, p, Surface_mesh::null_vertex()});
+		}
+
+		if (collapses.size() == 0) break;
+		statistics->rounds++;
+		statistics->collapses += collapses.size();
+
+		// Collapse, the faces around two selected edges are disjoint
+		ParallelUtils::for_each_index(collapses.size(), [&](std::size_t i) {
+			visitor.OnCollapsing(collapses[i].profile, collapses[i].placement);
+		});
+		for (auto &collapse: collapses) {
+			collapse.vertex = CGAL::Euler::collapse_edge(mesh.edge(collapse.profile.v0_v1()), mesh);
+			mesh.point(collapse.vertex) = *collapse.placement;
+		}
+		ParallelUtils::for_each_index(collapses.size(), [&](std::size_t i) {
+			visitor.OnCollapsed(collapses[i].profile, collapses[i].vertex);
+		});
+
+		// Evaluate again the edges whose profile contains a modified face
+		to_evaluate.clear();
+		auto queue_edges_around = [&](Surface_mesh::Vertex_index v) {
+			for (const auto &h: mesh.halfedges_around_target(mesh.halfedge(v))) {
+				auto edge = mesh.edge(h);
+				if (edge_round[edge] != round) {
+					edge_round[edge] = round;
+					to_evaluate.push_back(edge);
+				}
+			}
+		};
+		for (const auto &collapse: collapses) {
+			queue_edges_around(collapse.vertex);
+			for (const auto &v: mesh.vertices_around_target(mesh.halfedge(collapse.vertex))) queue_edges_around(v);
+		}
+		evaluate(to_evaluate);
+	}
+
+	mesh.remove_property_map<Surface_mesh::Edge_index, boost::optional<K::FT>>(round_cost);
+	mesh.remove_property_map<Surface_mesh::Edge_index, boost::optional<Point_3>>(round_placement);
+	mesh.remove_property_map<Surface_mesh::Edge_index, std::size_t>(edge_round);
+	mesh.remove_property_map<Surface_mesh::Vertex_index, std::size_t>(vertex_round);
+
+	visitor.OnFinished(mesh);
+
+	return initial_edge_count - current_edge_count;
+}
+
+// What the value of a Lazy_entry is, from the least to the most precise
+enum Lazy_value : unsigned char {
+	LAZY_LOWER_BOUND,
+	// Low end of Custom_cost::estimate
+	LAZY_ESTIMATE,
+	LAZY_EXACT
+};
+
+struct Lazy_entry {
+	K::FT value;
+	Lazy_value kind;
+	Surface_mesh::Edge_index edge;
+	std::size_t stamp;
+
+	// Order of the heap: the cheapest on top, the most precise first for the same value
+	bool operator<(const Lazy_entry &other) const {
+		if (value != other.value) return value > other.value;
+		if (kind != other.kind) return kind < other.kind;
+		return other.edge < edge;
+	}
+};
+
+int lazy_edge_collapse(Surface_mesh &mesh, const Round_stop_predicate &stop, const Custom_placement &placement, const Custom_cost &cost, My_visitor &visitor, const Round_filter &filter, std::size_t sample_size, Lazy_collapse_statistics *statistics) {
+	Lazy_collapse_statistics local_statistics;
+	if (statistics == nullptr) statistics = &local_statistics;
+
+	visitor.OnStarted(mesh);
+	// The lazy lookup of the first evaluation is not thread safe
+	placement.prepare(mesh);
+	cost.prepare(mesh);
+
+	const Surface_mesh &const_mesh = mesh;
+	K traits;
+	auto vpm = get(CGAL::vertex_point, const_mesh);
+	bool has_border = false;
+	for (const auto &h: mesh.halfedges()) {
+		if (mesh.is_border(h)) {
+			has_border = true;
+			break;
+		}
+	}
+	auto make_profile = [&](Surface_mesh::Halfedge_index h) {
+		return Profile(h, const_mesh, traits, vpm, has_border);
+	};
+
+	bool created;
+	// Bumped each time the profile of an edge changes, the entries with an older stamp are stale
+	Surface_mesh::Property_map<Surface_mesh::Edge_index, std::size_t> edge_stamp;
+	boost::tie(edge_stamp, created) = mesh.add_property_map<Surface_mesh::Edge_index, std::size_t>("e:lazy_stamp", 0);
+	assert(created);
+	Surface_mesh::Property_map<Surface_mesh::Edge_index, boost::optional<Point_3>> lazy_placement;
+	boost::tie(lazy_placement, created) = mesh.add_property_map<Surface_mesh::Edge_index, boost::optional<Point_3>>("e:lazy_placement", boost::optional<Point_3>());
+	assert(created);
+	Surface_mesh::Property_map<Surface_mesh::Edge_index, boost::optional<K::FT>> lazy_cost;
+	boost::tie(lazy_cost, created) = mesh.add_property_map<Surface_mesh::Edge_index, boost::optional<K::FT>>("e:lazy_cost", boost::optional<K::FT>());
+	assert(created);
+
+	std::priority_queue<Lazy_entry> queue;
+	std::vector<Surface_mesh::Edge_index> to_bound;
+	std::vector<K::FT> bounds;
+
+	// Each bound only reads the mesh
+	auto push_lower_bounds = [&]() {
+		bounds.resize(to_bound.size());
+		ParallelUtils::for_each_index(to_bound.size(), [&](std::size_t i) {
+			bounds[i] = cost.lower_bound(make_profile(mesh.halfedge(to_bound[i])));
+		});
+		for (std::size_t i = 0; i < to_bound.size(); i++) {
+			queue.push({bounds[i], LAZY_LOWER_BOUND, to_bound[i], edge_stamp[to_bound[i]]});
+		}
+		statistics->lower_bounds += to_bound.size();
+	};
+
+	to_bound.assign(mesh.edges().begin(), mesh.edges().end());
+	push_lower_bounds();
+	for (std::size_t i = 0; i < to_bound.size(); i++) {
+		visitor.OnCollected(make_profile(mesh.halfedge(to_bound[i])), bounds[i]);
+	}
+
+	std::size_t initial_edge_count = mesh.number_of_edges();
+	std::size_t current_edge_count = initial_edge_count;
+
+	while (!queue.empty()) {
+		Lazy_entry entry = queue.top();
+		queue.pop();
+		auto edge = entry.edge;
+		if (mesh.is_removed(edge) || entry.stamp != edge_stamp[edge]) continue;
+
+		auto profile = make_profile(mesh.halfedge(edge));
+
+		if (entry.kind == LAZY_LOWER_BOUND) {
+			lazy_placement[edge] = placement(profile);
+			if (sample_size > 0) {
+				auto estimate = cost.estimate(profile, lazy_placement[edge], sample_size);
+				// Put off while the next entry is cheaper and the stop predicate gives the same answer over the whole interval
+				if (estimate && !queue.empty() && estimate->low > queue.top().value && stop(estimate->low, profile, initial_edge_count, current_edge_count) == stop(estimate->high, profile, initial_edge_count, current_edge_count)) {
+					statistics->estimates++;
+					queue.push({estimate->low, LAZY_ESTIMATE, edge, entry.stamp});
+					continue;
+				}
+			}
+		}
+		if (entry.kind != LAZY_EXACT) {
+			lazy_cost[edge] = cost(profile, lazy_placement[edge]);
+			statistics->evaluations++;
+			if (lazy_cost[edge]) queue.push({*lazy_cost[edge], LAZY_EXACT, edge, entry.stamp});
+			continue;
+		}
+
+		visitor.OnSelected(profile, lazy_cost[edge], initial_edge_count, current_edge_count);
+
+		if (stop(entry.value, profile, initial_edge_count, current_edge_count)) {
+			visitor.OnStopConditionReached(profile);
+			break;
+		}
+
+		boost::optional<Point_3> p = lazy_placement[edge];
+		if (p && filter) p = filter(profile, p);
+		// Not collapsible until its neighbourhood changes
+		if (!p || !is_collapse_topologically_valid(mesh, profile) || !is_collapse_geometrically_valid(profile, *p)) continue;
+
+		current_edge_count -= 1 + (profile.left_face_exists() ? 1 : 0) + (profile.right_face_exists() ? 1 : 0);
+		visitor.OnCollapsing(profile, p);
+		auto vertex = CGAL::Euler::collapse_edge(edge, mesh);
+		mesh.point(vertex) = *p;
+		visitor.OnCollapsed(profile, vertex);
+		statistics->collapses++;
+
+		// Bound again the edges whose profile contains a modified face
+		to_bound.clear();
+		auto queue_edges_around = [&](Surface_mesh::Vertex_index v) {
+			for (const auto &h: mesh.halfedges_around_target(mesh.halfedge(v))) {
+				to_bound.push_back(mesh.edge(h));
+			}
+		};
+		queue_edges_around(vertex);
+		for (const auto &v: mesh.vertices_around_target(mesh.halfedge(vertex))) queue_edges_around(v);
+		std::sort(to_bound.begin(), to_bound.end());
+		to_bound.erase(std::unique(to_bound.begin(), to_bound.end()), to_bound.end());
+		for (const auto &e: to_bound) edge_stamp[e]++;
+		push_lower_bounds();
+	}
+
+	mesh.remove_property_map<Surface_mesh::Edge_index, std::size_t>(edge_stamp);
+	mesh.remove_property_map<Surface_mesh::Edge_index, boost::optional<Point_3>>(lazy_placement);
+	mesh.remove_property_map<Surface_mesh::Edge_index, boost::optional<K::FT>>(lazy_cost);
+
+	visitor.OnFinished(mesh);
+
+	return initial_edge_count - current_edge_count;
+}
+
+// Entry of the heap of heap_edge_collapse, stale when its stamp is older than the one of its edge
+struct Heap_entry {
+	K::FT cost;
+	std::uint32_t edge;
+	std::uint32_t stamp;
+
+	// Order of std::push_heap: the cheapest on top, then the lowest edge
+	bool operator<(const Heap_entry &other) const {
+		if (cost != other.cost) return cost > other.cost;
+		return edge > other.edge;
+	}
+};
+
+// The vertex is on a constrained edge
+static bool is_constrained_vertex(const Surface_mesh &mesh, Surface_mesh::Vertex_index vertex, const Surface_mesh::Property_map<Surface_mesh::Edge_index, bool> &constrained) {
+	for (const auto &h: mesh.halfedges_around_target(mesh.halfedge(vertex))) {
+		if (constrained[mesh.edge(h)]) return true;
+	}
+	return false;
+}
+
+// Both vertices are on constrained edges: refused by SMS::edge_collapse, and a precondition of Euler::collapse_edge
+static bool joins_constrained_vertices(const Surface_mesh &mesh, const Profile &profile, const Surface_mesh::Property_map<Surface_mesh::Edge_index, bool> &constrained) {
+	return is_constrained_vertex(mesh, profile.v0(), constrained) && is_constrained_vertex(mesh, profile.v1(), constrained);
+}
+
+int heap_edge_collapse(Surface_mesh &mesh, const Round_stop_predicate &stop, const Custom_placement &placement, const Custom_cost &cost, My_visitor &visitor, const Round_filter &filter, const Surface_mesh::Property_map<Surface_mesh::Edge_index, bool> *edge_is_constrained, Heap_collapse_statistics *statistics) {
+	Heap_collapse_statistics local_statistics;
+	if (statistics == nullptr) statistics = &local_statistics;
+
+	visitor.OnStarted(mesh);
+	// The lazy lookup of the first evaluation is not thread safe
+	placement.prepare(mesh);
+	cost.prepare(mesh);
+
+	const Surface_mesh &const_mesh = mesh;
+	K traits;
+	auto vpm = get(CGAL::vertex_point, const_mesh);
+	bool has_border = false;
+	for (const auto &h: mesh.halfedges()) {
+		if (mesh.is_border(h)) {
+			has_border = true;
+			break;
+		}
+	}
+	auto make_profile = [&](Surface_mesh::Halfedge_index h) {
+		return Profile(h, const_mesh, traits, vpm, has_border);
+	};
+	auto is_constrained = [&](Surface_mesh::Edge_index edge) {
+		return edge_is_constrained != nullptr && (*edge_is_constrained)[edge];
+	};
+
+	// Indexed by Edge_index::idx(), the collapses do not add edges
+	std::vector<std::uint32_t> edge_stamp (mesh.num_edges(), 0);
+	std::vector<boost::optional<Point_3>> edge_placement (mesh.num_edges());
+	std::vector<boost::optional<K::FT>> edge_cost (mesh.num_edges());
+
+	std::vector<Heap_entry> heap;
+	std::vector<Surface_mesh::Edge_index> batch;
+
+	// Each edge of the batch only writes its own slots
+	auto evaluate_batch = [&]() {
+		ParallelUtils::for_each_index(batch.size(), [&](std::size_t i) {
+			auto profile = make_profile(mesh.halfedge(batch[i]));
+			auto e = batch[i].idx();
+			edge_placement[e] = placement(profile);
+			edge_cost[e] = cost(profile, edge_placement[e]);
+		});
+		statistics->evaluations += batch.size();
+		for (const auto &edge: batch) {
+			if (edge_cost[edge.idx()]) {
+				heap.push_back({*edge_cost[edge.idx()], (std::uint32_t) edge.idx(), edge_stamp[edge.idx()]});
+				std::push_heap(heap.begin(), heap.end());
+			}
+		}
+	};
+
+	for (const auto &edge: mesh.edges()) {
+		if (!is_constrained(edge)) batch.push_back(edge);
+	}
+	evaluate_batch();
+	for (const auto &edge: batch) {
+		visitor.OnCollected(make_profile(mesh.halfedge(edge)), edge_cost[edge.idx()]);
+	}
+
+	std::size_t initial_edge_count = mesh.number_of_edges();
+	std::size_t current_edge_count = initial_edge_count;
+
+	while (!heap.empty()) {
+		std::pop_heap(heap.begin(), heap.end());
+		Heap_entry entry = heap.back();
+		heap.pop_back();
+		Surface_mesh::Edge_index edge (entry.edge);
+		if (mesh.is_removed(edge) || entry.stamp != edge_stamp[entry.edge]) {
+			statistics->stale++;
+			continue;
+		}
+
+		auto profile = make_profile(mesh.halfedge(edge));
+		visitor.OnSelected(profile, edge_cost[entry.edge], initial_edge_count, current_edge_count);
+
+		if (stop(entry.cost, profile, initial_edge_count, current_edge_count)) {
+			visitor.OnStopConditionReached(profile);
+			break;
+		}
+
+		boost::optional<Point_3> p = edge_placement[entry.edge];
+		if (p && filter) p = filter(profile, p);
+		// Not collapsible until its neighbourhood changes
+		if (!p || !is_collapse_topologically_valid(mesh, profile) || (edge_is_constrained != nullptr && joins_constrained_vertices(mesh, profile, *edge_is_constrained)) || !is_collapse_geometrically_valid(profile, *p)) {
+			visitor.OnNonCollapsable(profile);
+			continue;
+		}
+
+		current_edge_count -= 1 + (profile.left_face_exists() ? 1 : 0) + (profile.right_face_exists() ? 1 : 0);
+		visitor.OnCollapsing(profile, p);
+		// The constrained edges of the removed faces are the ones kept
+		auto vertex = (edge_is_constrained != nullptr) ? CGAL::Euler::collapse_edge(edge, mesh, *edge_is_constrained) : CGAL::Euler::collapse_edge(edge, mesh);
+		mesh.point(vertex) = *p;
+		visitor.OnCollapsed(profile, vertex);
+		statistics->collapses++;
+
+		// Evaluate again the edges whose profile contains a modified face
+		batch.clear();
+		auto batch_edges_around = [&](Surface_mesh::Vertex_index v) {
+			for (const auto &h: mesh.halfedges_around_target(mesh.halfedge(v))) {
+				if (!is_constrained(mesh.edge(h))) batch.push_back(mesh.edge(h));
+			}
+		};
+		batch_edges_around(vertex);
+		for (const auto &v: mesh.vertices_around_target(mesh.halfedge(vertex))) batch_edges_around(v);
+		std::sort(batch.begin(), batch.end());
+		batch.erase(std::unique(batch.begin(), batch.end()), batch.end());
+		for (const auto &e: batch) edge_stamp[e.idx()]++;
+		evaluate_batch();
+	}
+
+	visitor.OnFinished(mesh);
+
+	return initial_edge_count - current_edge_count;
+}
+
+Collapse_setup::Collapse_setup(const LindstromTurk_param &params, const K::FT alpha, const K::FT beta, const K::FT gamma, const K::FT delta, const K::FT min_point_per_area, const Surface_mesh_info &mesh_info, Point_set &point_cloud, const Ablation_study ablation) : params(params), alpha(alpha), beta(beta), gamma(gamma), delta(delta), min_point_per_area(min_point_per_area), mesh_info(mesh_info), point_cloud(point_cloud), ablation(ablation) {}
+
+template <typename StopPredicate>
+static void run_edge_collapse(Surface_mesh &mesh, const StopPredicate &stop, const Custom_placement &placement, const Custom_cost &cost, My_visitor &visitor, const Round_filter &filter, const Surface_mesh::Property_map<Surface_mesh::Edge_index, bool> &constrained, bool heap_engine) {
+	if (heap_engine) {
+		heap_edge_collapse(mesh, stop, placement, cost, visitor, filter, &constrained);
+	} else if (filter) {
+		SMS::edge_collapse(mesh, stop, CGAL::parameters::get_cost(cost).filter(filter).get_placement(placement).visitor(visitor).edge_is_constrained_map(constrained));
+	} else {
+		SMS::edge_collapse(mesh, stop, CGAL::parameters::get_cost(cost).get_placement(placement).visitor(visitor).edge_is_constrained_map(constrained));
+	}
+}
+
+/*
+ * Values of the properties of type T of the whole mesh, for the elements
+ * of the merged mesh coming from one of its elements, set again once the
+ * whole mesh is rebuilt from the merged one.
+ */
+template <typename Index, typename T>
+struct Carried_properties {
+	std::vector<std::pair<Surface_mesh::Property_map<Index, T>, std::vector<T>>> properties;
+
+	void save(Surface_mesh &mesh, const std::vector<Index> &origins) {
+		for (const auto &name: mesh.properties<Index>()) {
+			// Kept up to date by Surface_mesh itself
+			if (name == "v:removed" || name == "e:removed" || name == "f:removed") continue;
+			Surface_mesh::Property_map<Index, T> map;
+			bool has_map;
+			boost::tie(map, has_map) = mesh.property_map<Index, T>(name);
+			if (!has_map) continue;
+			std::vector<T> values (origins.size());
+			for (std::size_t i = 0; i < origins.size(); i++) {
+				if (origins[i] != Index()) values[i] = map[origins[i]];
+			}
+			properties.emplace_back(map, std::move(values));
+		}
+	}
+
+	void restore(const std::vector<Index> &origins) {
+		for (auto &property: properties) {
+			for (std::size_t i = 0; i < origins.size(); i++) {
+				if (origins[i] != Index()) property.first[Index(i)] = property.second[i];
+			}
+		}
+	}
+};
+
+template <typename Index>
+struct Carried_scalar_properties {
+	Carried_properties<Index, bool> bools;
+	Carried_properties<Index, int> ints;
+	Carried_properties<Index, unsigned char> chars;
+	Carried_properties<Index, K::FT> floats;
+
+	void save(Surface_mesh &mesh, const std::vector<Index> &origins) {
+		bools.save(mesh, origins);
+		ints.save(mesh, origins);
+		chars.save(mesh, origins);
+		floats.save(mesh, origins);
+	}
+
+	void restore(const std::vector<Index> &origins) {
+		bools.restore(origins);
+		ints.restore(origins);
+		chars.restore(origins);
+		floats.restore(origins);
+	}
+};
+
+struct Collapse_chunk {
+	Surface_mesh mesh;
+	std::vector<Surface_mesh::Face_index> faces;
+	// Vertex of the whole mesh
+	Surface_mesh::Property_map<Surface_mesh::Vertex_index, Surface_mesh::Vertex_index> original;
+	// Face of the whole mesh, kept by the collapses
+	Surface_mesh::Property_map<Surface_mesh::Face_index, Surface_mesh::Face_index> original_face;
+	// Seam or constrained by the caller
+	Surface_mesh::Property_map<Surface_mesh::Edge_index, bool> locked;
+	// Constrained by the caller
+	Surface_mesh::Property_map<Surface_mesh::Edge_index, bool> constrained;
+	double time = 0;
+};
+
+int partitioned_edge_collapse(Surface_mesh &mesh, const Collapse_setup &setup, const Round_stop_predicate &stop, const Round_filter &filter, std::size_t chunks, const Surface_mesh::Property_map<Surface_mesh::Edge_index, bool> *edge_is_constrained, Partition_statistics *statistics) {
+	Partition_statistics local_statistics;
+	if (statistics == nullptr) statistics = &local_statistics;
+
+	const std::size_t initial_edge_count = mesh.number_of_edges();
+
+	// Labels, f:points, f:cost and border points of the whole mesh
+	{
+		My_visitor visitor (setup.params, setup.alpha, setup.beta, setup.gamma, setup.min_point_per_area, mesh, setup.mesh_info, setup.point_cloud, setup.ablation);
+		visitor.keep_setup();
+		visitor.OnStarted(mesh);
+		visitor.OnFinished(mesh);
+	}
+
+	Surface_mesh::Property_map<Surface_mesh::Face_index, std::list<Point_set::Index>> point_in_face;
+	bool has_point_in_face;
+	boost::tie(point_in_face, has_point_in_face) = mesh.property_map<Surface_mesh::Face_index, std::list<Point_set::Index>>("f:points");
+	assert(has_point_in_face);
+
+	Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> face_costs;
+	bool has_face_costs;
+	boost::tie(face_costs, has_face_costs) = mesh.property_map<Surface_mesh::Face_index, K::FT>("f:cost");
+	assert(has_face_costs);
+
+	Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> mesh_label;
+	bool has_mesh_label;
+	boost::tie(mesh_label, has_mesh_label) = mesh.property_map<Surface_mesh::Face_index, unsigned char>("f:label");
+
+	// Grid of nx * ny chunks over the face centroids
+	std::size_t nx = std::max<std::size_t>(1, std::floor(std::sqrt(chunks)));
+	std::size_t ny = std::max<std::size_t>(1, chunks / nx);
+	K::FT x_min = std::numeric_limits<K::FT>::max(), x_max = std::numeric_limits<K::FT>::lowest();
+	K::FT y_min = std::numeric_limits<K::FT>::max(), y_max = std::numeric_limits<K::FT>::lowest();
+	std::vector<Point_3> centroids (mesh.num_faces());
+	for (const auto &face: mesh.faces()) {
+		auto r = mesh.vertices_around_face(mesh.halfedge(face)).begin();
+		auto &c = centroids[face.idx()];
+		c = CGAL::centroid(mesh.point(*r++), mesh.point(*r++), mesh.point(*r++));
+		x_min = std::min(x_min, c.x());
+		x_max = std::max(x_max, c.x());
+		y_min = std::min(y_min, c.y());
+		y_max = std::max(y_max, c.y());
+	}
+	std::vector<Collapse_chunk> chunk_list (nx * ny);
+	std::vector<std::size_t> face_chunk (mesh.num_faces(), 0);
+	for (const auto &face: mesh.faces()) {
+		const auto &c = centroids[face.idx()];
+		std::size_t i = (x_max > x_min) ? std::min<std::size_t>(nx - 1, (c.x() - x_min) / (x_max - x_min) * nx) : 0;
+		std::size_t j = (y_max > y_min) ? std::min<std::size_t>(ny - 1, (c.y() - y_min) / (y_max - y_min) * ny) : 0;
+		face_chunk[face.idx()] = j * nx + i;
+		chunk_list[j * nx + i].faces.push_back(face);
+	}
+
+	// Vertices shared by faces of different chunks
+	std::vector<bool> seam (mesh.num_vertices(), false);
+	for (const auto &h: mesh.halfedges()) {
+		if (mesh.is_border(h) || mesh.is_border(mesh.opposite(h))) continue;
+		if (face_chunk[mesh.face(h).idx()] != face_chunk[mesh.face(mesh.opposite(h)).idx()]) {
+			seam[mesh.source(h).idx()] = true;
+			seam[mesh.target(h).idx()] = true;
+		}
+	}
+
+	// Copy each chunk to its own mesh
+	bool valid = true;
+	std::vector<Surface_mesh::Vertex_index> local (mesh.num_vertices(), Surface_mesh::null_vertex());
+	for (auto &chunk: chunk_list) {
+		bool created;
+		boost::tie(chunk.original, created) = chunk.mesh.add_property_map<Surface_mesh::Vertex_index, Surface_mesh::Vertex_index>("v:original", Surface_mesh::null_vertex());
+		assert(created);
+		boost::tie(chunk.original_face, created) = chunk.mesh.add_property_map<Surface_mesh::Face_index, Surface_mesh::Face_index>("f:original", Surface_mesh::null_face());
+		assert(created);
+		boost::tie(chunk.locked, created) = chunk.mesh.add_property_map<Surface_mesh::Edge_index, bool>("e:locked", false);
+		assert(created);
+		boost::tie(chunk.constrained, created) = chunk.mesh.add_property_map<Surface_mesh::Edge_index, bool>("e:constrained", false);
+		assert(created);
+		Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> chunk_face_costs;
+		boost::tie(chunk_face_costs, created) = chunk.mesh.add_property_map<Surface_mesh::Face_index, K::FT>("f:cost", 0);
+		Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> chunk_mesh_label;
+		if (has_mesh_label) boost::tie(chunk_mesh_label, created) = chunk.mesh.add_property_map<Surface_mesh::Face_index, unsigned char>("f:label", LABEL_UNKNOWN);
+
+		std::vector<Surface_mesh::Vertex_index> touched;
+		for (const auto &face: chunk.faces) {
+			std::array<Surface_mesh::Vertex_index, 3> vertices;
+			std::size_t k = 0;
+			for (const auto &v: mesh.vertices_around_face(mesh.halfedge(face))) {
+				if (local[v.idx()] == Surface_mesh::null_vertex()) {
+					local[v.idx()] = chunk.mesh.add_vertex(mesh.point(v));
+					chunk.original[local[v.idx()]] = v;
+					touched.push_back(v);
+				}
+				vertices[k++] = local[v.idx()];
+			}
+			auto chunk_face = chunk.mesh.add_face(vertices[0], vertices[1], vertices[2]);
+			if (chunk_face == Surface_mesh::null_face()) {
+				valid = false;
+				continue;
+			}
+			chunk.original_face[chunk_face] = face;
+			chunk_face_costs[chunk_face] = face_costs[face];
+			if (has_mesh_label) chunk_mesh_label[chunk_face] = mesh_label[face];
+		}
+		for (const auto &v: touched) local[v.idx()] = Surface_mesh::null_vertex();
+
+		for (const auto &edge: chunk.mesh.edges()) {
+			auto v0 = chunk.original[chunk.mesh.vertex(edge, 0)];
+			auto v1 = chunk.original[chunk.mesh.vertex(edge, 1)];
+			if (edge_is_constrained != nullptr) chunk.constrained[edge] = (*edge_is_constrained)[mesh.edge(mesh.halfedge(v0, v1))];
+			chunk.locked[edge] = chunk.constrained[edge] || seam[v0.idx()] || seam[v1.idx()];
+		}
+	}
+
+	if (!valid) {
+		std::cout << "A chunk is not a valid mesh, edge collapse of the whole mesh" << std::endl;
+		chunk_list.clear();
+		Surface_mesh::Property_map<Surface_mesh::Edge_index, bool> constrained;
+		bool created;
+		boost::tie(constrained, created) = mesh.add_property_map<Surface_mesh::Edge_index, bool>("e:constrained", false);
+		if (edge_is_constrained != nullptr) {
+			for (const auto &edge: mesh.edges()) constrained[edge] = (*edge_is_constrained)[edge];
+		}
+		Custom_placement placement (setup.params, mesh, setup.point_cloud, setup.ablation);
+		Custom_cost cost (setup.params, setup.alpha, setup.beta, setup.gamma, setup.delta, setup.min_point_per_area, mesh, setup.point_cloud);
+		My_visitor visitor (setup.params, setup.alpha, setup.beta, setup.gamma, setup.min_point_per_area, mesh, setup.mesh_info, setup.point_cloud, setup.ablation);
+		visitor.reuse_setup();
+		visitor.collect_in_parallel(placement, cost);
+		if (setup.compute_on_commit) visitor.compute_on_commit(cost);
+		run_edge_collapse(mesh, stop, placement, cost, visitor, filter, constrained, setup.heap_engine);
+		mesh.remove_property_map<Surface_mesh::Edge_index, bool>(constrained);
+		return initial_edge_count - mesh.number_of_edges();
+	}
+
+	// The points move to the chunks, the whole mesh is rebuilt from them
+	for (auto &chunk: chunk_list) {
+		Surface_mesh::Property_map<Surface_mesh::Face_index, std::list<Point_set::Index>> chunk_point_in_face;
+		bool created;
+		boost::tie(chunk_point_in_face, created) = chunk.mesh.add_property_map<Surface_mesh::Face_index, std::list<Point_set::Index>>("f:points", std::list<Point_set::Index>());
+		assert(created);
+		for (const auto &face: chunk.mesh.faces()) {
+			chunk_point_in_face[face] = std::move(point_in_face[chunk.original_face[face]]);
+		}
+	}
+
+	// Decimate the chunks concurrently
+	std::cout << "Edge collapse of " << chunk_list.size() << " chunks" << std::endl;
+	TimerUtils::Timer chunks_timer;
+	chunks_timer.start();
+	std::atomic<std::size_t> removed_edges (0);
+	ParallelUtils::for_each_index(chunk_list.size(), [&](std::size_t c) {
+		Collapse_chunk &chunk = chunk_list[c];
+		TimerUtils::Timer timer;
+		timer.start();
+
+		Custom_placement placement (setup.params, chunk.mesh, setup.point_cloud, setup.ablation);
+		Custom_cost cost (setup.params, setup.alpha, setup.beta, setup.gamma, setup.delta, setup.min_point_per_area, chunk.mesh, setup.point_cloud);
+		My_visitor visitor (setup.params, setup.alpha, setup.beta, setup.gamma, setup.min_point_per_area, chunk.mesh, setup.mesh_info, setup.point_cloud, setup.ablation);
+		visitor.reuse_setup(true, true);
+		if (setup.compute_on_commit) visitor.compute_on_commit(cost);
+
+		// Count based predicates see the edges removed over all chunks
+		std::size_t chunk_removed = 0;
+		auto chunk_stop = [&](const SMS::Edge_profile<Surface_mesh>::FT &current_cost, const SMS::Edge_profile<Surface_mesh> &profile, SMS::Edge_profile<Surface_mesh>::edges_size_type initial, SMS::Edge_profile<Surface_mesh>::edges_size_type current) {
+			std::size_t removed = initial - current;
+			std::size_t total_removed = removed_edges.fetch_add(removed - chunk_removed) + removed - chunk_removed;
+			chunk_removed = removed;
+			return stop(current_cost, profile, initial_edge_count, initial_edge_count - total_removed);
+		};
+		run_edge_collapse(chunk.mesh, chunk_stop, placement, cost, visitor, filter, chunk.locked, setup.heap_engine);
+
+		chunk.time = timer.getElapsedTime();
+	}, 1);
+	statistics->chunks_time = chunks_timer.getElapsedTime();
+
+	for (std::size_t c = 0; c < chunk_list.size(); c++) {
+		statistics->chunk_faces_before.push_back(chunk_list[c].faces.size());
+		statistics->chunk_faces_after.push_back(chunk_list[c].mesh.number_of_faces());
+		statistics->chunk_times.push_back(chunk_list[c].time);
+		std::cout << "Chunk " << c << ": " << chunk_list[c].faces.size() << " -> " << chunk_list[c].mesh.number_of_faces() << " faces in " << chunk_list[c].time << "s" << std::endl;
+	}
+	std::cout << "Chunks simplified in " << statistics->chunks_time << "s" << std::endl;
+
+	// Merge the chunks, the seam vertices did not move
+	Surface_mesh merged;
+	Surface_mesh::Property_map<Surface_mesh::Face_index, std::list<Point_set::Index>> merged_point_in_face;
+	Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> merged_face_costs;
+	Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> merged_mesh_label;
+	Surface_mesh::Property_map<Surface_mesh::Edge_index, bool> merged_constrained;
+	bool created;
+	boost::tie(merged_point_in_face, created) = merged.add_property_map<Surface_mesh::Face_index, std::list<Point_set::Index>>("f:points", std::list<Point_set::Index>());
+	boost::tie(merged_face_costs, created) = merged.add_property_map<Surface_mesh::Face_index, K::FT>("f:cost", 0);
+	if (has_mesh_label) boost::tie(merged_mesh_label, created) = merged.add_property_map<Surface_mesh::Face_index, unsigned char>("f:label", LABEL_UNKNOWN);
+	boost::tie(merged_constrained, created) = merged.add_property_map<Surface_mesh::Edge_index, bool>("e:constrained", false);
+
+	std::vector<Surface_mesh::Vertex_index> merged_seam (mesh.num_vertices(), Surface_mesh::null_vertex());
+	// Elements of the whole mesh the elements of the merged mesh come from
+	std::vector<Surface_mesh::Vertex_index> vertex_origins;
+	std::vector<Surface_mesh::Face_index> face_origins;
+	for (auto &chunk: chunk_list) {
+		Surface_mesh::Property_map<Surface_mesh::Face_index, std::list<Point_set::Index>> chunk_point_in_face = chunk.mesh.property_map<Surface_mesh::Face_index, std::list<Point_set::Index>>("f:points").first;
+		Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> chunk_face_costs = chunk.mesh.property_map<Surface_mesh::Face_index, K::FT>("f:cost").first;
+		Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> chunk_mesh_label;
+		if (has_mesh_label) chunk_mesh_label = chunk.mesh.property_map<Surface_mesh::Face_index, unsigned char>("f:label").first;
+
+		std::vector<Surface_mesh::Vertex_index> merged_vertex (chunk.mesh.num_vertices(), Surface_mesh::null_vertex());
+		for (const auto &v: chunk.mesh.vertices()) {
+			auto original = chunk.original[v];
+			if (original != Surface_mesh::null_vertex() && seam[original.idx()]) {
+				if (merged_seam[original.idx()] == Surface_mesh::null_vertex()) {
+					merged_seam[original.idx()] = merged.add_vertex(mesh.point(original));
+					vertex_origins.push_back(original);
+				}
+				merged_vertex[v.idx()] = merged_seam[original.idx()];
+			} else {
+				merged_vertex[v.idx()] = merged.add_vertex(chunk.mesh.point(v));
+				vertex_origins.push_back(original);
+			}
+		}
+		for (const auto &face: chunk.mesh.faces()) {
+			std::array<Surface_mesh::Vertex_index, 3> vertices;
+			std::size_t k = 0;
+			for (const auto &v: chunk.mesh.vertices_around_face(chunk.mesh.halfedge(face))) vertices[k++] = merged_vertex[v.idx()];
+			auto merged_face = merged.add_face(vertices[0], vertices[1], vertices[2]);
+			assert(merged_face != Surface_mesh::null_face());
+			face_origins.push_back(chunk.original_face[face]);
+			merged_point_in_face[merged_face] = std::move(chunk_point_in_face[face]);
+			merged_face_costs[merged_face] = chunk_face_costs[face];
+			if (has_mesh_label) merged_mesh_label[merged_face] = chunk_mesh_label[face];
+		}
+		if (edge_is_constrained != nullptr) {
+			for (const auto &edge: chunk.mesh.edges()) {
+				if (chunk.constrained[edge]) {
+					merged_constrained[merged.edge(merged.halfedge(merged_vertex[chunk.mesh.vertex(edge, 0).idx()], merged_vertex[chunk.mesh.vertex(edge, 1).idx()]))] = true;
+				}
+			}
+		}
+		chunk.mesh.clear();
+	}
+
+	/*
+	 * Rebuild the whole mesh from the merged one, element by element in the
+	 * same order so that they get the same indices, without removing its
+	 * property maps: the maps held by the caller stay valid. The properties
+	 * of type bool, int, unsigned char and K::FT are carried over from the
+	 * vertex, edge or face each element comes from, the others get their
+	 * default value.
+	 */
+	std::vector<Surface_mesh::Edge_index> edge_origins (merged.num_edges());
+	for (const auto &edge: merged.edges()) {
+		auto v0 = vertex_origins[merged.vertex(edge, 0).idx()];
+		auto v1 = vertex_origins[merged.vertex(edge, 1).idx()];
+		if (v0 == Surface_mesh::null_vertex() || v1 == Surface_mesh::null_vertex()) continue;
+		auto h = mesh.halfedge(v0, v1);
+		if (h != Surface_mesh::null_halfedge()) edge_origins[edge.idx()] = mesh.edge(h);
+	}
+	Carried_scalar_properties<Surface_mesh::Vertex_index> vertex_properties;
+	Carried_scalar_properties<Surface_mesh::Edge_index> edge_properties;
+	Carried_scalar_properties<Surface_mesh::Face_index> face_properties;
+	vertex_properties.save(mesh, vertex_origins);
+	edge_properties.save(mesh, edge_origins);
+	face_properties.save(mesh, face_origins);
+
+	// Computed again from f:points by the visitor of the seams
+	Surface_mesh::Property_map<Surface_mesh::Face_index, Label_histogram> face_histograms;
+	bool has_face_histograms;
+	boost::tie(face_histograms, has_face_histograms) = mesh.property_map<Surface_mesh::Face_index, Label_histogram>("f:histogram");
+	if (has_face_histograms) mesh.remove_property_map<Surface_mesh::Face_index, Label_histogram>(face_histograms);
+
+	mesh.clear_without_removing_property_maps();
+	for (const auto &v: merged.vertices()) mesh.add_vertex(merged.point(v));
+	for (const auto &face: merged.faces()) {
+		std::array<Surface_mesh::Vertex_index, 3> vertices;
+		std::size_t k = 0;
+		for (const auto &v: merged.vertices_around_face(merged.halfedge(face))) vertices[k++] = v;
+		mesh.add_face(vertices[0], vertices[1], vertices[2]);
+	}
+	assert(mesh.num_vertices() == merged.num_vertices() && mesh.num_edges() == merged.num_edges() && mesh.num_faces() == merged.num_faces());
+
+	vertex_properties.restore(vertex_origins);
+	edge_properties.restore(edge_origins);
+	face_properties.restore(face_origins);
+	for (const auto &face: mesh.faces()) {
+		point_in_face[face] = std::move(merged_point_in_face[face]);
+		face_costs[face] = merged_face_costs[face];
+		if (has_mesh_label) mesh_label[face] = merged_mesh_label[face];
+	}
+	Surface_mesh::Property_map<Surface_mesh::Edge_index, bool> constrained;
+	boost::tie(constrained, created) = mesh.add_property_map<Surface_mesh::Edge_index, bool>("e:constrained", false);
+	for (const auto &edge: mesh.edges()) constrained[edge] = merged_constrained[edge];
+	if (edge_is_constrained != nullptr) {
+		Surface_mesh::Property_map<Surface_mesh::Edge_index, bool> caller_constrained = *edge_is_constrained;
+		for (const auto &edge: mesh.edges()) caller_constrained[edge] = merged_constrained[edge];
+	}
+	merged.clear();
+
+	// Free the seams
+	TimerUtils::Timer seam_timer;
+	seam_timer.start();
+	{
+		Custom_placement placement (setup.params, mesh, setup.point_cloud, setup.ablation);
+		Custom_cost cost (setup.params, setup.alpha, setup.beta, setup.gamma, setup.delta, setup.min_point_per_area, mesh, setup.point_cloud);
+		My_visitor visitor (setup.params, setup.alpha, setup.beta, setup.gamma, setup.min_point_per_area, mesh, setup.mesh_info, setup.point_cloud, setup.ablation);
+		visitor.reuse_setup();
+		visitor.collect_in_parallel(placement, cost);
+		if (setup.compute_on_commit) visitor.compute_on_commit(cost);
+		auto seam_stop = [&](const SMS::Edge_profile<Surface_mesh>::FT &current_cost, const SMS::Edge_profile<Surface_mesh> &profile, SMS::Edge_profile<Surface_mesh>::edges_size_type, SMS::Edge_profile<Surface_mesh>::edges_size_type current) {
+			return stop(current_cost, profile, initial_edge_count, current);
+		};
+		run_edge_collapse(mesh, seam_stop, placement, cost, visitor, filter, constrained, setup.heap_engine);
+		mesh.remove_property_map<Surface_mesh::Edge_index, bool>(constrained);
+	}
+	statistics->seam_time = seam_timer.getElapsedTime();
+	std::cout << "Seams simplified in " << statistics->seam_time << "s" << std::endl;
+
+	return initial_edge_count - mesh.number_of_edges();
+}
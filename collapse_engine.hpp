@@ -0,0 +1,150 @@
+#ifndef COLLAPSE_ENGINE_H_
+#define COLLAPSE_ENGINE_H_
+
+#include "edge_collapse.hpp"
+
+#include <functional>
+
+typedef std::function<bool(const SMS::Edge_profile<Surface_mesh>::FT&, const SMS::Edge_profile<Surface_mesh>&, SMS::Edge_profile<Surface_mesh>::edges_size_type, SMS::Edge_profile<Surface_mesh>::edges_size_type)> Round_stop_predicate;
+typedef std::function<boost::optional<Point_3>(const SMS::Edge_profile<Surface_mesh>&, boost::optional<Point_3>)> Round_filter;
+
+struct Round_collapse_statistics {
+	std::size_t rounds = 0;
+	std::size_t collapses = 0;
+	std::size_t evaluations = 0;
+};
+
+/*
+ * Alternative to SMS::edge_collapse processing the mesh by rounds.
+ *
+ * Each round goes through the edges by increasing cost and selects the
+ * ones whose 1-ring (the two vertices and their neighbours) shares no
+ * vertex with the 1-ring of an edge already selected, so that the 2-rings
+ * they modify do not overlap, up to max_round_fraction of the remaining
+ * edges. The selected edges are collapsed together: OnCollapsing and
+ * OnCollapsed of the visitor run in parallel (they only touch the faces
+ * around the edge), the topological collapses themselves are sequential
+ * as Surface_mesh keeps shared free lists. The edges around the new
+ * vertices are then evaluated again in parallel.
+ *
+ * Differences with the strict priority order of SMS::edge_collapse:
+ * - an edge selected in a round can be more expensive than an edge whose
+ *   cost dropped because of another collapse of the same round;
+ * - an edge next to a cheaper selected edge waits for the next round even
+ *   if it is the cheapest remaining one.
+ * Both only reorder collapses inside a window of max_round_fraction of
+ * the edges: a smaller fraction gives results closer to SMS::edge_collapse
+ * and less parallelism. The stop predicate is checked for each selected
+ * edge with the edge count it would see in the sequential order.
+ */
+int round_edge_collapse(Surface_mesh &mesh, const Round_stop_predicate &stop, const Custom_placement &placement, const Custom_cost &cost, My_visitor &visitor, const Round_filter &filter = Round_filter(), float max_round_fraction = 0.05, Round_collapse_statistics *statistics = nullptr);
+
+struct Lazy_collapse_statistics {
+	std::size_t lower_bounds = 0;
+	std::size_t estimates = 0;
+	std::size_t evaluations = 0;
+	std::size_t collapses = 0;
+};
+
+/*
+ * Alternative to SMS::edge_collapse evaluating the placement and the cost
+ * of an edge only when it reaches the top of the queue.
+ *
+ * The edges are first queued by Custom_cost::lower_bound, computed in
+ * parallel. When the top of the queue is a lower bound, the edge is
+ * evaluated and queued again with its exact cost; when it is an exact
+ * cost, no other edge can be cheaper and it is collapsed. After a
+ * collapse, the edges whose profile contains a modified face get a new
+ * lower bound. The edges are collapsed in the order of the queue of
+ * SMS::edge_collapse as long as no two edges have the same cost, but the
+ * topological test only checks the link condition and the inner edges
+ * joining two borders: SMS::edge_collapse also refuses some collapses
+ * next to the borders, so the results can differ there. Most edges of a
+ * run stopped early are never evaluated.
+ *
+ * With sample_size > 0, an edge with more points than that is first placed
+ * and estimated with Custom_cost::estimate. It is queued again with the low
+ * end of the interval, and only evaluated when that reaches the top, if
+ * the interval is above the next entry of the queue and the stop predicate
+ * gives the same answer at both ends; it is evaluated right away otherwise.
+ * The collapses and the stop still depend on exact costs only, but an edge
+ * whose cost is below the low end of its interval is collapsed too late.
+ */
+int lazy_edge_collapse(Surface_mesh &mesh, const Round_stop_predicate &stop, const Custom_placement &placement, const Custom_cost &cost, My_visitor &visitor, const Round_filter &filter = Round_filter(), std::size_t sample_size = 0, Lazy_collapse_statistics *statistics = nullptr);
+
+struct Heap_collapse_statistics {
+	std::size_t evaluations = 0;
+	// Entries popped after their edge was evaluated again or removed
+	std::size_t stale = 0;
+	std::size_t collapses = 0;
+};
+
+/*
+ * Alternative to SMS::edge_collapse with the same policy: every edge is
+ * placed and evaluated at the start, the cheapest one is collapsed, and
+ * the edges whose profile contains a modified face (the edges around the
+ * new vertex and around its neighbours) are evaluated again.
+ *
+ * The queue is a flat binary heap (std::push_heap) of (cost, edge, stamp)
+ * entries. An edge evaluated again gets a new stamp and a new entry, and
+ * its old entries are dropped when they reach the top. The stamps,
+ * placements and costs are in arrays indexed by the edges, and the edges
+ * of a collapse are evaluated in one parallel batch, as the initial ones.
+ *
+ * As in SMS::edge_collapse, the constrained edges are not collapsed, nor
+ * the edges whose two vertices are on constrained edges, the filter is
+ * applied to the placement and the faces around the edge must not flip.
+ * The topological test is the reduced one of the other engines (the link
+ * condition and the inner edges joining two borders), and ties between
+ * costs go to the edge of lowest index: the collapses can differ from
+ * SMS::edge_collapse on ties and next to the borders.
+ */
+int heap_edge_collapse(Surface_mesh &mesh, const Round_stop_predicate &stop, const Custom_placement &placement, const Custom_cost &cost, My_visitor &visitor, const Round_filter &filter = Round_filter(), const Surface_mesh::Property_map<Surface_mesh::Edge_index, bool> *edge_is_constrained = nullptr, Heap_collapse_statistics *statistics = nullptr);
+
+// Everything needed to build the placement, cost and visitor of a mesh
+struct Collapse_setup {
+	const LindstromTurk_param &params;
+	const K::FT alpha, beta, gamma, delta;
+	const K::FT min_point_per_area;
+	const Surface_mesh_info &mesh_info;
+	Point_set &point_cloud;
+	const Ablation_study ablation;
+	// See Custom_cost::compute_on_commit
+	bool compute_on_commit = false;
+	// heap_edge_collapse instead of SMS::edge_collapse for each pass
+	bool heap_engine = false;
+
+	Collapse_setup(const LindstromTurk_param &params, const K::FT alpha, const K::FT beta, const K::FT gamma, const K::FT delta, const K::FT min_point_per_area, const Surface_mesh_info &mesh_info, Point_set &point_cloud, const Ablation_study ablation = Ablation_study());
+};
+
+struct Partition_statistics {
+	std::vector<std::size_t> chunk_faces_before;
+	std::vector<std::size_t> chunk_faces_after;
+	std::vector<double> chunk_times;
+	double chunks_time = 0;
+	double seam_time = 0;
+};
+
+/*
+ * Edge collapse of the mesh split into a grid of about `chunks` spatial
+ * chunks along X and Y.
+ *
+ * The labels, f:points and f:cost are set up once on the whole mesh, then
+ * each chunk is copied to its own Surface_mesh and decimated concurrently
+ * with its own Custom_placement, Custom_cost and My_visitor. The edges
+ * touching a vertex shared by several chunks are constrained, so the seams
+ * do not move and the chunks are merged back exactly. A last edge collapse
+ * over the merged mesh frees the seams.
+ *
+ * Count based stop predicates see the number of edges of the whole mesh.
+ * edge_is_constrained, if given, is honoured in every pass. The mesh is
+ * rebuilt in place from the merged chunks: its property maps stay valid,
+ * edge_is_constrained is set on the new edges, and the other properties of
+ * type bool, int, unsigned char and K::FT are carried over from the
+ * elements the new ones come from (the others are reset).
+ * Falls back to a single SMS::edge_collapse if a chunk is not a valid
+ * Surface_mesh. Each pass uses heap_edge_collapse with setup.heap_engine.
+ */
+int partitioned_edge_collapse(Surface_mesh &mesh, const Collapse_setup &setup, const Round_stop_predicate &stop, const Round_filter &filter, std::size_t chunks, const Surface_mesh::Property_map<Surface_mesh::Edge_index, bool> *edge_is_constrained = nullptr, Partition_statistics *statistics = nullptr);
+
+#endif  /* !COLLAPSE_ENGINE_H_ */
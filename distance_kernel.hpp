@@ -0,0 +1,414 @@
+#ifndef DISTANCE_KERNEL_H_
+#define DISTANCE_KERNEL_H_
+
+#include "header.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DISTANCE_KERNEL_AVX2
+#endif
+
+#ifdef CHECK_KERNELS
+#include <CGAL/squared_distance_3.h>
+#endif
+
+// Batch squared distances between points and a few triangles.
+//
+// The computation follows step by step the one of CGAL::squared_distance
+// (Point_3, Triangle_3) of CGAL 5.4 and 5.5 so that the results are
+// identical to it, as long as the compiler does not contract the operations
+// into FMA. Later versions of CGAL compute it differently and may differ in
+// the last bits: the distance_kernel test checks it against the installed
+// CGAL, and -DCHECK_KERNELS=ON compares every result with CGAL.
+namespace DistanceKernel {
+
+	struct Triangle {
+		float t0[3], t1[3], t2[3];
+		float normal[3];
+		bool has_normal;
+		// wcross(edge, normal) of the edges t0t1, t1t2 and t2t0
+		float left0[3], left1[3], left2[3];
+		// squared length of the edges t2t0, t1t2 and t0t1
+		float e20, e12, e01;
+		float squared_normal;
+
+		Triangle() = default;
+
+		Triangle(const K::Triangle_3 &triangle) {
+			for (int i = 0; i < 3; i++) {
+				t0[i] = triangle.vertex(0)[i];
+				t1[i] = triangle.vertex(1)[i];
+				t2[i] = triangle.vertex(2)[i];
+			}
+			float v01[3], v02[3], v12[3], v20[3];
+			for (int i = 0; i < 3; i++) {
+				v01[i] = t1[i] - t0[i];
+				v02[i] = t2[i] - t0[i];
+				v12[i] = t2[i] - t1[i];
+				v20[i] = t0[i] - t2[i];
+			}
+			cross(v01, v02, normal);
+			has_normal = normal[0] != 0 || normal[1] != 0 || normal[2] != 0;
+			cross(v01, normal, left0);
+			cross(v12, normal, left1);
+			cross(v20, normal, left2);
+			e20 = dot(v20, v20);
+			e12 = dot(v12, v12);
+			e01 = dot(v01, v01);
+			squared_normal = dot(normal, normal);
+		}
+
+		static void cross(const float u[3], const float v[3], float r[3]) {
+			r[0] = u[1]*v[2] - u[2]*v[1];
+			r[1] = u[2]*v[0] - u[0]*v[2];
+			r[2] = u[0]*v[1] - u[1]*v[0];
+		}
+
+		static float dot(const float u[3], const float v[3]) {
+			return u[0]*v[0] + u[1]*v[1] + u[2]*v[2];
+		}
+	};
+
+	// Points as structure of arrays
+	struct Point_batch {
+		std::vector<float> x, y, z;
+
+		void clear() {
+			x.clear();
+			y.clear();
+			z.clear();
+		}
+
+		template <class Point>
+		void push_back(const Point &p) {
+			x.push_back(CGAL::to_double(p.x()));
+			y.push_back(CGAL::to_double(p.y()));
+			z.push_back(CGAL::to_double(p.z()));
+		}
+
+		std::size_t size() const {
+			return x.size();
+		}
+	};
+
+	inline float segment_squared_distance(float px, float py, float pz, const float s[3], const float t[3], float e) {
+		float diff[3] = {px - s[0], py - s[1], pz - s[2]};
+		float segvec[3] = {t[0] - s[0], t[1] - s[1], t[2] - s[2]};
+		float d = Triangle::dot(diff, segvec);
+		if (d <= 0) return Triangle::dot(diff, diff);
+		if (d > e) {
+			float dt[3] = {px - t[0], py - t[1], pz - t[2]};
+			return dt[0]*dt[0] + dt[1]*dt[1] + dt[2]*dt[2];
+		}
+		float wcr[3];
+		Triangle::cross(segvec, diff, wcr);
+		return Triangle::dot(wcr, wcr) / e;
+	}
+
+	inline float squared_distance(const Triangle &t, float px, float py, float pz) {
+		float d0[3] = {px - t.t0[0], py - t.t0[1], pz - t.t0[2]};
+		if (t.has_normal) {
+			float d1[3] = {px - t.t1[0], py - t.t1[1], pz - t.t1[2]};
+			float d2[3] = {px - t.t2[0], py - t.t2[1], pz - t.t2[2]};
+			if (Triangle::dot(t.left0, d0) <= 0 && Triangle::dot(t.left1, d1) <= 0 && Triangle::dot(t.left2, d2) <= 0) {
+				float dot = Triangle::dot(t.normal, d0);
+				return dot*dot / t.squared_normal;
+			}
+		}
+		float d1 = segment_squared_distance(px, py, pz, t.t2, t.t0, t.e20);
+		float d2 = segment_squared_distance(px, py, pz, t.t1, t.t2, t.e12);
+		float d3 = segment_squared_distance(px, py, pz, t.t0, t.t1, t.e01);
+		return (std::min)((std::min)(d1, d2), d3);
+	}
+
+	inline void nearest_triangle_scalar(const Point_batch &points, std::size_t begin, const std::vector<Triangle> &triangles, std::uint32_t *argmin, float *min_d) {
+		for (std::size_t i = begin; i < points.size(); i++) {
+			float best = std::numeric_limits<float>::max();
+			std::uint32_t best_id = 0;
+			for (std::size_t j = 0; j < triangles.size(); j++) {
+				float d = squared_distance(triangles[j], points.x[i], points.y[i], points.z[i]);
+				if (d < best) {
+					best = d;
+					best_id = j;
+				}
+			}
+			argmin[i] = best_id;
+			min_d[i] = best;
+		}
+	}
+
+	inline void squared_distances_scalar(const Point_batch &points, std::size_t begin, const Triangle &triangle, float *d) {
+		for (std::size_t i = begin; i < points.size(); i++) {
+			d[i] = squared_distance(triangle, points.x[i], points.y[i], points.z[i]);
+		}
+	}
+
+#ifdef DISTANCE_KERNEL_AVX2
+	// Same operations as the scalar version, 8 points at a time
+	__attribute__((target("avx2"))) inline __m256 dot8(__m256 ux, __m256 uy, __m256 uz, __m256 vx, __m256 vy, __m256 vz) {
+		return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ux, vx), _mm256_mul_ps(uy, vy)), _mm256_mul_ps(uz, vz));
+	}
+
+	__attribute__((target("avx2"))) inline __m256 dot8(const float u[3], __m256 vx, __m256 vy, __m256 vz) {
+		return dot8(_mm256_set1_ps(u[0]), _mm256_set1_ps(u[1]), _mm256_set1_ps(u[2]), vx, vy, vz);
+	}
+
+	__attribute__((target("avx2"))) inline __m256 segment_squared_distance8(__m256 px, __m256 py, __m256 pz, const float s[3], const float t[3], float e) {
+		__m256 dx = _mm256_sub_ps(px, _mm256_set1_ps(s[0]));
+		__m256 dy = _mm256_sub_ps(py, _mm256_set1_ps(s[1]));
+		__m256 dz = _mm256_sub_ps(pz, _mm256_set1_ps(s[2]));
+		__m256 sx = _mm256_set1_ps(t[0] - s[0]);
+		__m256 sy = _mm256_set1_ps(t[1] - s[1]);
+		__m256 sz = _mm256_set1_ps(t[2] - s[2]);
+		__m256 ve = _mm256_set1_ps(e);
+		__m256 d = dot8(dx, dy, dz, sx, sy, sz);
+
+		__m256 to_source = dot8(dx, dy, dz, dx, dy, dz);
+
+		__m256 tx = _mm256_sub_ps(px, _mm256_set1_ps(t[0]));
+		__m256 ty = _mm256_sub_ps(py, _mm256_set1_ps(t[1]));
+		__m256 tz = _mm256_sub_ps(pz, _mm256_set1_ps(t[2]));
+		__m256 to_target = dot8(tx, ty, tz, tx, ty, tz);
+
+		__m256 wx = _mm256_sub_ps(_mm256_mul_ps(sy, dz), _mm256_mul_ps(sz, dy));
+		__m256 wy = _mm256_sub_ps(_mm256_mul_ps(sz, dx), _mm256_mul_ps(sx, dz));
+		__m256 wz = _mm256_sub_ps(_mm256_mul_ps(sx, dy), _mm256_mul_ps(sy, dx));
+		__m256 to_line = _mm256_div_ps(dot8(wx, wy, wz, wx, wy, wz), ve);
+
+		__m256 r = _mm256_blendv_ps(to_line, to_target, _mm256_cmp_ps(d, ve, _CMP_GT_OQ));
+		return _mm256_blendv_ps(r, to_source, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_LE_OQ));
+	}
+
+	__attribute__((target("avx2"))) inline __m256 squared_distance8(const Triangle &t, __m256 px, __m256 py, __m256 pz) {
+		__m256 d0x = _mm256_sub_ps(px, _mm256_set1_ps(t.t0[0]));
+		__m256 d0y = _mm256_sub_ps(py, _mm256_set1_ps(t.t0[1]));
+		__m256 d0z = _mm256_sub_ps(pz, _mm256_set1_ps(t.t0[2]));
+
+		__m256 d1 = segment_squared_distance8(px, py, pz, t.t2, t.t0, t.e20);
+		__m256 d2 = segment_squared_distance8(px, py, pz, t.t1, t.t2, t.e12);
+		__m256 d3 = segment_squared_distance8(px, py, pz, t.t0, t.t1, t.e01);
+		// std::min(a, b) is (b < a) ? b : a
+		__m256 d12 = _mm256_blendv_ps(d1, d2, _mm256_cmp_ps(d2, d1, _CMP_LT_OQ));
+		__m256 r = _mm256_blendv_ps(d12, d3, _mm256_cmp_ps(d3, d12, _CMP_LT_OQ));
+		if (!t.has_normal) return r;
+
+		__m256 zero = _mm256_setzero_ps();
+		__m256 inside = _mm256_cmp_ps(dot8(t.left0, d0x, d0y, d0z), zero, _CMP_LE_OQ);
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(dot8(t.left1, _mm256_sub_ps(px, _mm256_set1_ps(t.t1[0])), _mm256_sub_ps(py, _mm256_set1_ps(t.t1[1])), _mm256_sub_ps(pz, _mm256_set1_ps(t.t1[2]))), zero, _CMP_LE_OQ));
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(dot8(t.left2, _mm256_sub_ps(px, _mm256_set1_ps(t.t2[0])), _mm256_sub_ps(py, _mm256_set1_ps(t.t2[1])), _mm256_sub_ps(pz, _mm256_set1_ps(t.t2[2]))), zero, _CMP_LE_OQ));
+		__m256 dot = dot8(t.normal, d0x, d0y, d0z);
+		__m256 to_plane = _mm256_div_ps(_mm256_mul_ps(dot, dot), _mm256_set1_ps(t.squared_normal));
+		return _mm256_blendv_ps(r, to_plane, inside);
+	}
+
+	__attribute__((target("avx2"))) inline std::size_t nearest_triangle_avx2(const Point_batch &points, const std::vector<Triangle> &triangles, std::uint32_t *argmin, float *min_d) {
+		std::size_t i = 0;
+		for (; i + 8 <= points.size(); i += 8) {
+			__m256 px = _mm256_loadu_ps(points.x.data() + i);
+			__m256 py = _mm256_loadu_ps(points.y.data() + i);
+			__m256 pz = _mm256_loadu_ps(points.z.data() + i);
+			__m256 best = _mm256_set1_ps(std::numeric_limits<float>::max());
+			__m256i best_id = _mm256_setzero_si256();
+			for (std::size_t j = 0; j < triangles.size(); j++) {
+				__m256 d = squared_distance8(triangles[j], px, py, pz);
+				__m256 closer = _mm256_cmp_ps(d, best, _CMP_LT_OQ);
+				best = _mm256_blendv_ps(best, d, closer);
+				best_id = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(best_id), _mm256_castsi256_ps(_mm256_set1_epi32(j)), closer));
+			}
+			_mm256_storeu_ps(min_d + i, best);
+			_mm256_storeu_si256((__m256i *) (argmin + i), best_id);
+		}
+		return i;
+	}
+
+	__attribute__((target("avx2"))) inline std::size_t squared_distances_avx2(const Point_batch &points, const Triangle &triangle, float *d) {
+		std::size_t i = 0;
+		for (; i + 8 <= points.size(); i += 8) {
+			__m256 px = _mm256_loadu_ps(points.x.data() + i);
+			__m256 py = _mm256_loadu_ps(points.y.data() + i);
+			__m256 pz = _mm256_loadu_ps(points.z.data() + i);
+			_mm256_storeu_ps(d + i, squared_distance8(triangle, px, py, pz));
+		}
+		return i;
+	}
+
+	inline bool has_avx2() {
+		static const bool avx2 = __builtin_cpu_supports("avx2");
+		return avx2;
+	}
+#endif
+
+#ifdef CHECK_KERNELS
+	inline void check(const Point_batch &points, std::size_t i, const Triangle &triangle, float d) {
+		K::Point_3 p (points.x[i], points.y[i], points.z[i]);
+		K::Triangle_3 t (K::Point_3(triangle.t0[0], triangle.t0[1], triangle.t0[2]), K::Point_3(triangle.t1[0], triangle.t1[1], triangle.t1[2]), K::Point_3(triangle.t2[0], triangle.t2[1], triangle.t2[2]));
+		K::FT expected = CGAL::squared_distance(p, t);
+		if (expected != d && !(expected != expected && d != d)) {
+			std::cerr << "DistanceKernel mismatch: " << p << " / " << t << ": " << d << " instead of " << expected << std::endl;
+		}
+	}
+#endif
+
+	// For each point, the first of the closest triangles and its squared distance
+	inline void nearest_triangle(const Point_batch &points, const std::vector<Triangle> &triangles, std::uint32_t *argmin, float *min_d) {
+		std::size_t begin = 0;
+#ifdef DISTANCE_KERNEL_AVX2
+		if (has_avx2()) begin = nearest_triangle_avx2(points, triangles, argmin, min_d);
+#endif
+		nearest_triangle_scalar(points, begin, triangles, argmin, min_d);
+#ifdef CHECK_KERNELS
+		for (std::size_t i = 0; i < points.size(); i++) {
+			check(points, i, triangles[argmin[i]], min_d[i]);
+			for (std::size_t j = 0; j < triangles.size(); j++) {
+				float d = squared_distance(triangles[j], points.x[i], points.y[i], points.z[i]);
+				check(points, i, triangles[j], d);
+				if (d < min_d[i] || (d == min_d[i] && j < argmin[i])) {
+					std::cerr << "DistanceKernel mismatch: wrong closest triangle " << argmin[i] << " instead of " << j << std::endl;
+				}
+			}
+		}
+#endif
+	}
+
+	// Squared distance of each point to the triangle
+	inline void squared_distances(const Point_batch &points, const Triangle &triangle, float *d) {
+		std::size_t begin = 0;
+#ifdef DISTANCE_KERNEL_AVX2
+		if (has_avx2()) begin = squared_distances_avx2(points, triangle, d);
+#endif
+		squared_distances_scalar(points, begin, triangle, d);
+#ifdef CHECK_KERNELS
+		for (std::size_t i = 0; i < points.size(); i++) check(points, i, triangle, d[i]);
+#endif
+	}
+
+	// Buffers of nearest_triangle_xy
+	struct Fan_scratch {
+		// Per triangle, the three edges as (n_x, n_y, offset): n.p - offset is the distance to the edge in XY, positive inside
+		std::vector<double> edges;
+		Point_batch pending;
+		std::vector<std::uint32_t> pending_index;
+		std::vector<std::uint32_t> pending_argmin;
+		std::vector<float> pending_min_d;
+	};
+
+	// Relative margin between the distance to the triangle above a point and the bound on the other ones
+	const float FAN_MARGIN = 1e-3;
+
+	/*
+	 * Projection on XY of triangles (t0, t1, t2) sharing t2, in the order of
+	 * t0 around t2: true if they are all counterclockwise and turn once
+	 * around t2, so that their projections do not overlap.
+	 */
+	inline bool xy_fan(const std::vector<Triangle> &triangles, Fan_scratch &scratch) {
+		if (triangles.size() == 0) return false;
+		const float *apex = triangles[0].t2;
+		double turn = 0;
+		for (std::size_t j = 0; j < triangles.size(); j++) {
+			const Triangle &t = triangles[j];
+			if (t.t2[0] != apex[0] || t.t2[1] != apex[1] || t.t2[2] != apex[2]) return false;
+			double ax = (double) t.t0[0] - apex[0], ay = (double) t.t0[1] - apex[1];
+			double bx = (double) t.t1[0] - apex[0], by = (double) t.t1[1] - apex[1];
+			double cross = ax * by - ay * bx;
+			if (!(cross > 0)) return false;
+			turn += std::atan2(cross, ax * bx + ay * by);
+
+			// Gap to the next triangle, when the fan is open there
+			const Triangle &next = triangles[(j + 1) % triangles.size()];
+			double nx = (double) next.t0[0] - apex[0], ny = (double) next.t0[1] - apex[1];
+			double gap = std::atan2(bx * ny - by * nx, bx * nx + by * ny);
+			if (gap < 0) gap += 2 * M_PI;
+			turn += gap;
+		}
+		// A multiple of 2 pi, up to rounding
+		if (turn > 3 * M_PI) return false;
+
+		scratch.edges.resize(9 * triangles.size());
+		for (std::size_t j = 0; j < triangles.size(); j++) {
+			const float *vertices[3] = {triangles[j].t0, triangles[j].t1, triangles[j].t2};
+			for (int k = 0; k < 3; k++) {
+				const float *u = vertices[k];
+				const float *v = vertices[(k + 1) % 3];
+				double ex = (double) v[0] - u[0], ey = (double) v[1] - u[1];
+				double length = std::sqrt(ex * ex + ey * ey);
+				double *edge = &scratch.edges[9 * j + 3 * k];
+				edge[0] = -ey / length;
+				edge[1] = ex / length;
+				edge[2] = edge[0] * u[0] + edge[1] * u[1];
+			}
+		}
+		return true;
+	}
+
+	/*
+	 * nearest_triangle for triangles (t0, t1, t2) sharing t2, in the order
+	 * of t0 around t2, whose projections on XY do not overlap, as the faces
+	 * around the new vertex of a height field. The triangle above or below
+	 * a point is the nearest one if the point is closer to it than, in XY,
+	 * to the border of its projection: the other triangles are at least that
+	 * far. Only the points without such a triangle go through
+	 * nearest_triangle, so the results are the same, to the last bit.
+	 * Returns false, computing nothing, if the projections may overlap.
+	 */
+	inline bool nearest_triangle_xy(const Point_batch &points, const std::vector<Triangle> &triangles, Fan_scratch &scratch, std::uint32_t *argmin, float *min_d) {
+		if (!xy_fan(triangles, scratch)) return false;
+
+		scratch.pending.clear();
+		scratch.pending_index.clear();
+		for (std::size_t i = 0; i < points.size(); i++) {
+			double px = points.x[i], py = points.y[i];
+			double best_inside = 0;
+			std::size_t best_id = triangles.size();
+			for (std::size_t j = 0; j < triangles.size(); j++) {
+				const double *edge = &scratch.edges[9 * j];
+				double inside = std::min({edge[0] * px + edge[1] * py - edge[2], edge[3] * px + edge[4] * py - edge[5], edge[6] * px + edge[7] * py - edge[8]});
+				if (inside > best_inside) {
+					best_inside = inside;
+					best_id = j;
+				}
+			}
+			if (best_id < triangles.size()) {
+				float d = squared_distance(triangles[best_id], points.x[i], points.y[i], points.z[i]);
+				if (d < best_inside * best_inside * (1 - FAN_MARGIN)) {
+					argmin[i] = best_id;
+					min_d[i] = d;
+					continue;
+				}
+			}
+			scratch.pending.x.push_back(points.x[i]);
+			scratch.pending.y.push_back(points.y[i]);
+			scratch.pending.z.push_back(points.z[i]);
+			scratch.pending_index.push_back(i);
+		}
+
+		scratch.pending_argmin.resize(scratch.pending.size());
+		scratch.pending_min_d.resize(scratch.pending.size());
+		nearest_triangle(scratch.pending, triangles, scratch.pending_argmin.data(), scratch.pending_min_d.data());
+		for (std::size_t k = 0; k < scratch.pending_index.size(); k++) {
+			argmin[scratch.pending_index[k]] = scratch.pending_argmin[k];
+			min_d[scratch.pending_index[k]] = scratch.pending_min_d[k];
+		}
+
+#ifdef CHECK_KERNELS
+		std::vector<std::uint32_t> exact_argmin (points.size());
+		std::vector<float> exact_min_d (points.size());
+		nearest_triangle(points, triangles, exact_argmin.data(), exact_min_d.data());
+		for (std::size_t i = 0; i < points.size(); i++) {
+			if (exact_argmin[i] != argmin[i] || exact_min_d[i] != min_d[i]) {
+				std::cerr << "DistanceKernel mismatch: triangle " << argmin[i] << " in XY instead of " << exact_argmin[i] << std::endl;
+			}
+		}
+#endif
+
+		return true;
+	}
+
+}
+
+#endif  /* !DISTANCE_KERNEL_H_ */
@@ -1,17 +1,20 @@
 #include "edge_collapse.hpp"
+#include "border_points.hpp"
+#include "distance_kernel.hpp"
+#include "parallel.hpp"
+#include "point_location.hpp"
+#include "svm.hpp"
 
 #include <list>
+#include <array>
 #include <limits>
+#include <cstdint>
+#include <cstring>
 #include <algorithm>
 #include <filesystem>
 
 #include <CGAL/Point_set_3/IO.h>
 #include <CGAL/intersections.h>
-#include <CGAL/QP_models.h>
-#include <CGAL/QP_functions.h>
-#include <CGAL/Orthogonal_k_neighbor_search.h>
-#include <CGAL/Search_traits_3.h>
-#include <CGAL/Search_traits_adapter.h>
 #include <CGAL/Polygon_mesh_processing/locate.h>
 #include <CGAL/Polygon_mesh_processing/distance.h>
 #include <CGAL/boost/graph/Face_filtered_graph.h>
@@ -25,23 +28,8 @@
 #include <CGAL/Eigen_svd.h>
 #endif
 
-#ifdef CGAL_USE_GMP
-#include <CGAL/Gmpzf.h>
-typedef CGAL::Gmpzf ET;
-#else
-#include <CGAL/MP_Float.h>
-typedef CGAL::MP_Float ET;
-#endif
-
 typedef CGAL::Eigen_svd::Vector                             Eigen_vector;
 typedef CGAL::Eigen_svd::Matrix                             Eigen_matrix;
-typedef CGAL::Quadratic_program<ET>                         Program;
-typedef CGAL::Quadratic_program_solution<ET>                Solution;
-
-typedef CGAL::Search_traits_3<Point_set_kernel>             Traits_base;
-typedef CGAL::Search_traits_adapter<Point_set::Index, Point_set::Point_map, Traits_base> TreeTraits;
-typedef CGAL::Orthogonal_k_neighbor_search<TreeTraits>      Neighbor_search;
-typedef Neighbor_search::Tree                               Point_tree;
 
 namespace PMP = CGAL::Polygon_mesh_processing;
 typedef CGAL::AABB_face_graph_triangle_primitive<Surface_mesh> AABB_face_graph_primitive;
@@ -50,15 +38,17 @@ typedef CGAL::AABB_tree<AABB_face_graph_traits>                AABB_tree;
 
 void compute_stat(Surface_mesh &mesh, const Ablation_study &ablation, TimerUtils::Timer &timer, K::FT cost) {
 	AABB_tree mesh_tree;
-	PMP::build_AABB_tree(mesh, mesh_tree);
-	CGAL::Cartesian_converter<Point_set_kernel, K> type_converter;
+	PointLocation::build_tree(mesh, mesh_tree);
 
 	K::FT min_distance = std::numeric_limits<K::FT>::max();
 	K::FT max_distance = std::numeric_limits<K::FT>::min();
 	K::FT mean_distance = 0;
 
-	for (const auto &p: ablation.ground_truth_surface_mesh.points()) {
-		auto location = PMP::locate_with_AABB_tree(p, mesh_tree, mesh);
+	std::vector<K::Point_3> ground_truth_points (ablation.ground_truth_surface_mesh.points().begin(), ablation.ground_truth_surface_mesh.points().end());
+	auto locations = PointLocation::locate(ground_truth_points, mesh_tree, mesh);
+	for (std::size_t i = 0; i < ground_truth_points.size(); i++) {
+		const auto &p = ground_truth_points[i];
+		const auto &location = locations[i];
 		if (!std::isnan(location.second[0])) {
 			K::FT d = CGAL::sqrt(CGAL::squared_distance(p, PMP::construct_point(location, mesh)));
 			if (d < min_distance) min_distance = d;
@@ -68,7 +58,7 @@ void compute_stat(Surface_mesh &mesh, const Ablation_study &ablation, TimerUtils
 	}
 
 	AABB_tree ground_truth_surface_mesh_tree;
-	PMP::build_AABB_tree(ablation.ground_truth_surface_mesh, ground_truth_surface_mesh_tree);
+	PointLocation::build_tree(ablation.ground_truth_surface_mesh, ground_truth_surface_mesh_tree);
 
 	K::FT min_distance_r = std::numeric_limits<K::FT>::max();
 	K::FT max_distance_r = std::numeric_limits<K::FT>::min();
@@ -76,8 +66,10 @@ void compute_stat(Surface_mesh &mesh, const Ablation_study &ablation, TimerUtils
 
 	std::vector<K::Point_3> samples;
 	PMP::sample_triangle_mesh(mesh, std::back_inserter(samples), CGAL::parameters::random_seed(0));
-	for (const auto &p: samples) {
-		auto location = PMP::locate_with_AABB_tree(p, ground_truth_surface_mesh_tree, ablation.ground_truth_surface_mesh);
+	PointLocation::locate(samples, ground_truth_surface_mesh_tree, ablation.ground_truth_surface_mesh, locations);
+	for (std::size_t i = 0; i < samples.size(); i++) {
+		const auto &p = samples[i];
+		const auto &location = locations[i];
 		if (!std::isnan(location.second[0])) {
 			K::FT d = CGAL::sqrt(CGAL::squared_distance(p, PMP::construct_point(location, ablation.ground_truth_surface_mesh)));
 			if (d < min_distance_r) min_distance_r = d;
@@ -100,11 +92,7 @@ void compute_stat(Surface_mesh &mesh, const Ablation_study &ablation, TimerUtils
 		boost::tie(point_in_face, created_point_in_face) = mesh.add_property_map<Surface_mesh::Face_index, std::list<Point_set::Index>>("f:points", std::list<Point_set::Index>());
 
 		if(created_point_in_face) {
-			for (const auto &ph: ablation.ground_truth_point_cloud) {
-				auto p = type_converter(ablation.ground_truth_point_cloud.point(ph));
-				auto location = PMP::locate_with_AABB_tree(p, mesh_tree, mesh);
-				point_in_face[location.first].push_back(ph);
-			}
+			PointLocation::associate_points(mesh, mesh_tree, ablation.ground_truth_point_cloud, point_in_face);
 		}
 
 		add_label(mesh, ablation.ground_truth_point_cloud, 0);
@@ -115,10 +103,13 @@ void compute_stat(Surface_mesh &mesh, const Ablation_study &ablation, TimerUtils
 	std::size_t total_num_points = 0;
 
 	if (has_ground_truth_point_cloud_label) {
-		for (const auto &ph: ablation.ground_truth_point_cloud) {
-			auto p = type_converter(ablation.ground_truth_point_cloud.point(ph));
-			auto location = PMP::locate_with_AABB_tree(p, mesh_tree, mesh);
-			if (mesh_label[location.first] != ground_truth_point_cloud_label[ph]) num_wrong_points += 1;
+		CGAL::Cartesian_converter<Point_set_kernel, K> type_converter;
+		std::vector<Point_set::Index> indices (ablation.ground_truth_point_cloud.begin(), ablation.ground_truth_point_cloud.end());
+		std::vector<K::Point_3> points (indices.size());
+		for (std::size_t i = 0; i < indices.size(); i++) points[i] = type_converter(ablation.ground_truth_point_cloud.point(indices[i]));
+		PointLocation::locate(points, mesh_tree, mesh, locations);
+		for (std::size_t i = 0; i < indices.size(); i++) {
+			if (mesh_label[locations[i].first] != ground_truth_point_cloud_label[indices[i]]) num_wrong_points += 1;
 		}
 		total_num_points = ablation.ground_truth_point_cloud.size();
 	}
@@ -167,15 +158,115 @@ void compute_stat(Surface_mesh &mesh, const Ablation_study &ablation, TimerUtils
 }
 
 K::FT get_mean_point_per_area(Surface_mesh &mesh, const Point_set &point_cloud) {
+	Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> face_areas;
+	bool has_face_areas;
+	boost::tie(face_areas, has_face_areas) = mesh.property_map<Surface_mesh::Face_index, K::FT>("f:area");
+
 	K::FT total_area = 0;
 	for (const auto &face: mesh.faces()) {
-		auto r = mesh.vertices_around_face(mesh.halfedge(face)).begin();
-		total_area +=  CGAL::sqrt(K::Triangle_3(mesh.point(*r++), mesh.point(*r++), mesh.point(*r++)).squared_area());
+		total_area += face_area(mesh, has_face_areas ? &face_areas : nullptr, face);
 	}
 	if (total_area > 0) return point_cloud.size() / total_area;
 	return 0;
 }
 
+void update_face_geometry(const Surface_mesh &mesh, Surface_mesh::Property_map<Surface_mesh::Face_index, K::Vector_3> face_normals, Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> face_areas, Surface_mesh::Face_index face) {
+	auto r = mesh.vertices_around_face(mesh.halfedge(face)).begin();
+	const Point_3 &p0 = mesh.point(*r++);
+	const Point_3 &p1 = mesh.point(*r++);
+	const Point_3 &p2 = mesh.point(*r++);
+	face_normals[face] = CGAL::orthogonal_vector(p0, p1, p2);
+	// As CGAL::sqrt(K::Triangle_3(p0, p1, p2).squared_area())
+	face_areas[face] = CGAL::sqrt(face_normals[face].squared_length() / 4);
+}
+
+void compute_face_geometry(Surface_mesh &mesh) {
+	bool created;
+	Surface_mesh::Property_map<Surface_mesh::Face_index, K::Vector_3> face_normals;
+	boost::tie(face_normals, created) = mesh.add_property_map<Surface_mesh::Face_index, K::Vector_3>("f:normal", CGAL::NULL_VECTOR);
+	Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> face_areas;
+	boost::tie(face_areas, created) = mesh.add_property_map<Surface_mesh::Face_index, K::FT>("f:area", 0);
+
+	std::vector<Surface_mesh::Face_index> faces (mesh.faces().begin(), mesh.faces().end());
+	ParallelUtils::for_each_index(faces.size(), [&](std::size_t i) {
+		update_face_geometry(mesh, face_normals, face_areas, faces[i]);
+	}, 4096);
+}
+
+void remove_face_geometry(Surface_mesh &mesh) {
+	Surface_mesh::Property_map<Surface_mesh::Face_index, K::Vector_3> face_normals;
+	bool has_face_normals;
+	boost::tie(face_normals, has_face_normals) = mesh.property_map<Surface_mesh::Face_index, K::Vector_3>("f:normal");
+	if (has_face_normals) mesh.remove_property_map<Surface_mesh::Face_index, K::Vector_3>(face_normals);
+
+	Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> face_areas;
+	bool has_face_areas;
+	boost::tie(face_areas, has_face_areas) = mesh.property_map<Surface_mesh::Face_index, K::FT>("f:area");
+	if (has_face_areas) mesh.remove_property_map<Surface_mesh::Face_index, K::FT>(face_areas);
+}
+
+K::FT face_area(const Surface_mesh &mesh, const Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> *face_areas, Surface_mesh::Face_index face) {
+	if (face_areas != nullptr) return (*face_areas)[face];
+	auto r = mesh.vertices_around_face(mesh.halfedge(face)).begin();
+	return CGAL::sqrt(K::Triangle_3(mesh.point(*r++), mesh.point(*r++), mesh.point(*r++)).squared_area());
+}
+
+void Label_histogram::add(unsigned char label) {
+	auto it = std::lower_bound(counts.begin(), counts.end(), std::make_pair(label, 0u));
+	if (it != counts.end() && it->first == label) {
+		it->second++;
+	} else {
+		counts.emplace(it, label, 1);
+	}
+}
+
+unsigned char Label_histogram::argmax() const {
+	auto best = counts.begin();
+	for (auto it = counts.begin(); it != counts.end(); ++it) {
+		if (it->second > best->second) best = it;
+	}
+	return (best != counts.end()) ? best->first : 0;
+}
+
+unsigned int Label_histogram::max() const {
+	unsigned int best = 0;
+	for (const auto &count: counts) best = std::max(best, count.second);
+	return best;
+}
+
+Label_histogram label_histogram(const std::list<Point_set::Index> &points, const Point_set::Property_map<unsigned char> &label) {
+	unsigned int face_label[LABELS.size()] = {0};
+	for (const auto &point: points) face_label[label[point]]++;
+	Label_histogram histogram;
+	for (std::size_t l = 0; l < LABELS.size(); l++) {
+		if (face_label[l] > 0) histogram.counts.emplace_back(l, face_label[l]);
+	}
+	return histogram;
+}
+
+Surface_mesh::Property_map<Surface_mesh::Face_index, Label_histogram> compute_face_histograms(Surface_mesh &mesh, const Point_set &point_cloud) {
+	Point_set::Property_map<unsigned char> point_cloud_label;
+	bool has_point_cloud_label;
+	boost::tie(point_cloud_label, has_point_cloud_label) = point_cloud.property_map<unsigned char>("p:label");
+	assert(has_point_cloud_label);
+
+	Surface_mesh::Property_map<Surface_mesh::Face_index, std::list<Point_set::Index>> point_in_face;
+	bool has_point_in_face;
+	boost::tie(point_in_face, has_point_in_face) = mesh.property_map<Surface_mesh::Face_index, std::list<Point_set::Index>>("f:points");
+	assert(has_point_in_face);
+
+	Surface_mesh::Property_map<Surface_mesh::Face_index, Label_histogram> face_histograms;
+	bool created_face_histograms;
+	boost::tie(face_histograms, created_face_histograms) = mesh.add_property_map<Surface_mesh::Face_index, Label_histogram>("f:histogram");
+
+	std::vector<Surface_mesh::Face_index> faces (mesh.faces().begin(), mesh.faces().end());
+	ParallelUtils::for_each_index(faces.size(), [&](std::size_t i) {
+		face_histograms[faces[i]] = label_histogram(point_in_face[faces[i]], point_cloud_label);
+	}, 1024);
+
+	return face_histograms;
+}
+
 void add_label(Surface_mesh &mesh, const Point_set &point_cloud, const K::FT min_point_per_area) {
 	//Update mesh label
 	Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> mesh_label;
@@ -193,191 +284,106 @@ void add_label(Surface_mesh &mesh, const Point_set &point_cloud, const K::FT min
 	boost::tie(point_in_face, has_point_in_face) = mesh.property_map<Surface_mesh::Face_index, std::list<Point_set::Index>>("f:points");
 	assert(has_point_in_face);
 
-	std::set<Surface_mesh::Face_index> faces_with_no_label;
-	for (const auto &face: mesh.faces()) {
+	Surface_mesh::Property_map<Surface_mesh::Face_index, Label_histogram> face_histograms;
+	bool has_face_histograms;
+	boost::tie(face_histograms, has_face_histograms) = mesh.property_map<Surface_mesh::Face_index, Label_histogram>("f:histogram");
+
+	Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> face_areas;
+	bool has_face_areas;
+	boost::tie(face_areas, has_face_areas) = mesh.property_map<Surface_mesh::Face_index, K::FT>("f:area");
+
+	// Label of the faces from their points, in parallel
+	std::vector<Surface_mesh::Face_index> faces (mesh.faces().begin(), mesh.faces().end());
+	std::vector<unsigned char> no_label (mesh.num_faces(), 0);
+	ParallelUtils::for_each_index(faces.size(), [&](std::size_t i) {
+		auto face = faces[i];
 		K::FT min_point = 0;
 		if (min_point_per_area > 0) {
-			auto r = mesh.vertices_around_face(mesh.halfedge(face)).begin();
-			K::FT face_area = CGAL::sqrt(K::Triangle_3(mesh.point(*r++), mesh.point(*r++), mesh.point(*r++)).squared_area());
-			min_point = min_point_per_area * face_area;
+			min_point = min_point_per_area * face_area(mesh, has_face_areas ? &face_areas : nullptr, face);
 		}
 		if (point_in_face[face].size() > 0) {
 
 			if (point_in_face[face].size() > min_point) {
 
-				int face_label[LABELS.size()] = {0};
-
-				for (const auto &point: point_in_face[face]) {
-					face_label[point_cloud_label[point]]++;
+				if (has_face_histograms) {
+					mesh_label[face] = face_histograms[face].argmax();
+				} else {
+					mesh_label[face] = label_histogram(point_in_face[face], point_cloud_label).argmax();
 				}
 
-				auto argmax = std::max_element(face_label, face_label+LABELS.size());
-				mesh_label[face] = argmax - face_label;
-
 			} else { // We don't have information about this face.
 				mesh_label[face] = LABEL_UNKNOWN;
 			}
 		} else {
 			if (min_point <= 1) { // It's probable that there is no point
-				faces_with_no_label.insert(face);
+				no_label[face] = 1;
 			} else { // We don't have information about this face.
 				mesh_label[face] = LABEL_UNKNOWN;
 			}
 		}
-	}
-	while(faces_with_no_label.size() > 0) {
-		std::list<Surface_mesh::Face_index> face_to_be_removed;
-		for (const auto &face: faces_with_no_label) {
+	}, 1024);
+
+	/*
+	 * The faces with no point take the majority label of their labelled
+	 * neighbours, weighted by the length of the common edge, layer by layer
+	 * from the labelled faces: a face is only evaluated again when one of
+	 * its neighbours got a label in the previous layer, and it only sees the
+	 * labels of the previous layers. The faces never reached are unknown.
+	 */
+	std::vector<Surface_mesh::Face_index> layer;
+	for (const auto &face: faces) {
+		if (no_label[face]) layer.push_back(face);
+	}
+	std::vector<int> new_label;
+	std::vector<std::size_t> queued (mesh.num_faces(), 0);
+	for (std::size_t depth = 1; layer.size() > 0; depth++) {
+		new_label.assign(layer.size(), -1);
+		ParallelUtils::for_each_index(layer.size(), [&](std::size_t i) {
+			auto face = layer[i];
 			K::FT face_label[LABELS.size()] = {0};
 			bool no_neighbor = true;
 			for (const auto &he: mesh.halfedges_around_face(mesh.halfedge(face))) {
 				if (!mesh.is_border(Surface_mesh::Edge_index(he))) {
 					no_neighbor = false;
-					if (faces_with_no_label.count(mesh.face(mesh.opposite(he))) == 0) {
+					if (!no_label[mesh.face(mesh.opposite(he))]) {
 						face_label[mesh_label[mesh.face(mesh.opposite(he))]] += CGAL::sqrt(CGAL::squared_distance(mesh.point(mesh.source(he)), mesh.point(mesh.target(he))));
 					}
 				}
 			}
 			if (no_neighbor) {
-				mesh_label[face] = LABEL_UNKNOWN;
-				face_to_be_removed.push_back(face);
+				new_label[i] = LABEL_UNKNOWN;
 			} else {
 				auto argmax = std::max_element(face_label, face_label+LABELS.size());
-				if (*argmax > 0) {
-					mesh_label[face] = argmax - face_label;
-					face_to_be_removed.push_back(face);
-				}
-			}
-		}
-		for (const auto &face: face_to_be_removed) {
-			faces_with_no_label.erase(face);
-		}
-		if (face_to_be_removed.size() == 0) {
-			for (const auto &face_id: faces_with_no_label) {
-				mesh_label[face_id] = LABEL_UNKNOWN;
-			}
-			break;
-		} else {
-			face_to_be_removed.clear();
-		}
-	}
-}
-
-std::pair<K::Vector_3, K::FT> compute_SVM(std::vector<Point_set::Index> points_for_svm, std::vector<int> y, const Point_set &point_cloud, float * quality = nullptr) {
-
-// TimerUtils::Timer timer;
-// timer.start();
-
-	assert(points_for_svm.size() == y.size());
-
-	CGAL::Cartesian_converter<Point_set_kernel,K> type_converter;
-
-	Point_set_kernel::FT c = 10000;
-
-	Program qp (CGAL::EQUAL, true, 0, true, c);
-
-	for (std::size_t i = points_for_svm.size() - 1; i < points_for_svm.size(); i--) {
-		auto vr = Point_set_kernel::Vector_3(CGAL::ORIGIN, point_cloud.point(points_for_svm[i])) * y[i];
-		qp.set_d(i, i, CGAL::scalar_product(vr,vr));
-		for (std::size_t j = 0; j < i; j++) {
-			qp.set_d(i, j, CGAL::scalar_product(vr, Point_set_kernel::Vector_3(CGAL::ORIGIN, point_cloud.point(points_for_svm[j])) * y[j]));
-		}
-		qp.set_c(i, -1);
-		qp.set_a(i, 0,  y[i]);
-	}
-	Solution s = CGAL::solve_quadratic_program(qp, ET());
-	//std::cerr << "s: " << s << "\n";
-	if (!s.solves_quadratic_program(qp)) std::cerr << "ALERT !!!!!!!!!!!!!!!!!!!\n";
-	assert (s.solves_quadratic_program(qp));
-
-// timer.pause();
-// auto inter = timer.getElapsedTime();
-// timer.resume();
-
-	Point_set_kernel::Vector_3 w(CGAL::NULL_VECTOR);
-	auto value = s.variable_values_begin();
-	for (std::size_t i = 0; i < points_for_svm.size(); i++) {
-		w += y[i] * CGAL::to_double(*(value++)) * Point_set_kernel::Vector_3(CGAL::ORIGIN,point_cloud.point(points_for_svm[i]));
-	}
-
-	Point_set_kernel::FT b = 0;
-	int count = 0;
-	Point_set_kernel::FT min_positive = std::numeric_limits<Point_set_kernel::FT>::max();
-	Point_set_kernel::FT max_negative = std::numeric_limits<Point_set_kernel::FT>::lowest();
-	for (std::size_t i = 0; i < points_for_svm.size(); i++) {
-		Point_set_kernel::FT v = CGAL::scalar_product(w, Point_set_kernel::Vector_3(CGAL::ORIGIN,point_cloud.point(points_for_svm[i])));
-		if (y[i] > 0 && v < min_positive) min_positive = v;
-		if (y[i] < 0 && v > max_negative) max_negative = v;
-	}
-	if (max_negative < min_positive) {
-		b += - (max_negative + min_positive) / 2;
-		count = 1;
-	}
-	if (count == 0) {
-		value = s.variable_values_begin();
-		for (std::size_t i = 0; i < points_for_svm.size(); i++) {
-			double v = CGAL::to_double(*(value++));
-			if (v > 0 && v < c) {
-				b += y[i] - CGAL::scalar_product(w, Point_set_kernel::Vector_3(CGAL::ORIGIN,point_cloud.point(points_for_svm[i])));
-				count++;
+				if (*argmax > 0) new_label[i] = argmax - face_label;
 			}
-		}
-	}
-	if (count == 0) {
-		value = s.variable_values_begin();
-		for (std::size_t i = 0; i < points_for_svm.size(); i++) {
-			if (CGAL::to_double(*(value++)) > 0) {
-				b += y[i] - CGAL::scalar_product(w, Point_set_kernel::Vector_3(CGAL::ORIGIN,point_cloud.point(points_for_svm[i])));
-				count++;
+		}, 256);
+
+		std::vector<Surface_mesh::Face_index> next_layer;
+		for (std::size_t i = 0; i < layer.size(); i++) {
+			if (new_label[i] < 0) continue;
+			mesh_label[layer[i]] = new_label[i];
+			no_label[layer[i]] = 0;
+		}
+		for (std::size_t i = 0; i < layer.size(); i++) {
+			if (new_label[i] < 0) continue;
+			for (const auto &he: mesh.halfedges_around_face(mesh.halfedge(layer[i]))) {
+				if (mesh.is_border(Surface_mesh::Edge_index(he))) continue;
+				auto neighbor = mesh.face(mesh.opposite(he));
+				if (no_label[neighbor] && queued[neighbor] != depth) {
+					queued[neighbor] = depth;
+					next_layer.push_back(neighbor);
+				}
 			}
 		}
+		layer.swap(next_layer);
 	}
-	if (count == 0) {
-		for (std::size_t i = 0; i < points_for_svm.size(); i++) {
-			b += y[i] - CGAL::scalar_product(w, Point_set_kernel::Vector_3(CGAL::ORIGIN,point_cloud.point(points_for_svm[i])));
-			count++;
-		}
+	for (const auto &face: faces) {
+		if (no_label[face]) mesh_label[face] = LABEL_UNKNOWN;
 	}
-	assert(count > 0);
-	b /= count;
-
-	if (quality != nullptr) {
-		*quality = 0;
-		value = s.variable_values_begin();
-		for (std::size_t i = 0; i < points_for_svm.size(); i++) {
-			if (CGAL::to_double(*(value++)) > 0) {
-				Point_set_kernel::FT v = CGAL::scalar_product(w, Point_set_kernel::Vector_3(CGAL::ORIGIN,point_cloud.point(points_for_svm[i])));
-				if (y[i] > 0 && v < -b) *quality += 1;
-				if (y[i] < 0 && v > -b) *quality += 1;
-			}
-		}
-		*quality = 1 - *quality/points_for_svm.size();
-	}
-
-	// if (*quality < 0.8) {
-	// 	std::cerr << "q: " << *quality << "\n";
-	// 	// timer.pause();
-	// 	// std::cerr << "t1: " << inter << "\n";
-	// 	// std::cerr << "t: " << timer.getElapsedTime() << "\n";
-	// 	std::cerr << "w: " << w << "\n";
-	// 	std::cerr << "b: " << b << "\n";
-
-	// 	for (std::size_t i = 0; i < points_for_svm.size(); i++) {
-	// 		std::cerr << "y" << i << ":\t" << y[i] << "\t";
-	// 		std::cerr << "p: " << Point_set_kernel::Vector_3(CGAL::ORIGIN, point_cloud.point(points_for_svm[i])) << "   \t";
-	// 		std::cerr << "s: " << CGAL::to_double(*(s.variable_values_begin() + i)) << "\t";
-	// 		std::cerr << "w.p: " << CGAL::scalar_product(w, Point_set_kernel::Vector_3(CGAL::ORIGIN,point_cloud.point(points_for_svm[i]))) << "  \t";
-	// 		std::cerr << "y(w.p + b): " << y[i]*(CGAL::scalar_product(w, Point_set_kernel::Vector_3(CGAL::ORIGIN,point_cloud.point(points_for_svm[i]))) + b) << "\n";
-	// 		if (y[i]*(CGAL::scalar_product(w, Point_set_kernel::Vector_3(CGAL::ORIGIN,point_cloud.point(points_for_svm[i]))) + b) < 0) {
-	// 			std::cerr << "Error\n";
-	// 		}
-	// 	}
-	// }
-
-	return std::pair<K::Vector_3, K::FT>(type_converter(w), -type_converter(b));
 }
 
-std::vector<Surface_mesh::Face_index> subdivide_face(Surface_mesh& mesh, Surface_mesh::Face_index face, int max_label, const Point_set &point_cloud) {
+// Plane separating the points of face with max_label from the others
+K::Plane_3 subdivision_plane(const Surface_mesh& mesh, Surface_mesh::Face_index face, int max_label, const Point_set &point_cloud) {
 	Point_set::Property_map<unsigned char> label;
 	bool has_label;
 	boost::tie(label, has_label) = point_cloud.property_map<unsigned char>("p:label");
@@ -403,8 +409,10 @@ std::vector<Surface_mesh::Face_index> subdivide_face(Surface_mesh& mesh, Surface
 	}
 
 	auto plan = compute_SVM(points_for_svm, y, point_cloud);
-	K::Plane_3 cut(CGAL::ORIGIN + plan.second/plan.first.squared_length()*plan.first, plan.first);
+	return K::Plane_3(CGAL::ORIGIN + plan.second/plan.first.squared_length()*plan.first, plan.first);
+}
 
+std::vector<Surface_mesh::Face_index> subdivide_face(Surface_mesh& mesh, Surface_mesh::Face_index face, const K::Plane_3 &cut) {
 	auto h0 = mesh.halfedge(face);
 	auto h1 = mesh.next(h0);
 	auto h2 = mesh.next(h1);
@@ -506,11 +514,181 @@ std::vector<Surface_mesh::Face_index> subdivide_face(Surface_mesh& mesh, Surface
 	return new_faces;
 }
 
-std::list<std::pair <K::Vector_3, K::FT>> volume_preservation_and_optimisation (const SMS::Edge_profile<Surface_mesh>& profile) {
+void Collapse_properties::prepare(const Surface_mesh &mesh, const Point_set &point_cloud) {
+	boost::tie(face_costs, has_face_costs) = mesh.property_map<Surface_mesh::Face_index, K::FT>("f:cost");
+	boost::tie(point_in_face, has_point_in_face) = mesh.property_map<Surface_mesh::Face_index, std::list<Point_set::Index>>("f:points");
+	boost::tie(mesh_label, has_mesh_label) = mesh.property_map<Surface_mesh::Face_index, unsigned char>("f:label");
+	boost::tie(point_cloud_label, has_point_cloud_label) = point_cloud.property_map<unsigned char>("p:label");
+	boost::tie(isborder, has_isborder) = point_cloud.property_map<bool>("p:isborder");
+	boost::tie(face_histograms, has_face_histograms) = mesh.property_map<Surface_mesh::Face_index, Label_histogram>("f:histogram");
+	boost::tie(vertex_quadrics, has_vertex_quadrics) = mesh.property_map<Surface_mesh::Vertex_index, Vertex_quadric>("v:quadric");
+	boost::tie(face_normals, has_face_normals) = mesh.property_map<Surface_mesh::Face_index, K::Vector_3>("f:normal");
+	ready = true;
+}
+
+#ifdef COUNT_ALLOCATIONS
+std::atomic<std::size_t> Evaluation_statistics::evaluations {0};
+std::atomic<std::size_t> Evaluation_statistics::allocations {0};
+std::atomic<std::size_t> Evaluation_statistics::allocating_evaluations {0};
+thread_local bool Evaluation_statistics::in_evaluation = false;
+thread_local std::size_t Evaluation_statistics::thread_allocations = 0;
+
+struct Evaluation_scope {
+	bool previous;
+	std::size_t allocations;
+
+	Evaluation_scope() : previous(Evaluation_statistics::in_evaluation), allocations(Evaluation_statistics::thread_allocations) {
+		Evaluation_statistics::in_evaluation = true;
+	}
+
+	~Evaluation_scope() {
+		Evaluation_statistics::in_evaluation = previous;
+		std::size_t count = Evaluation_statistics::thread_allocations - allocations;
+		if (count > 0) {
+			Evaluation_statistics::allocations.fetch_add(count, std::memory_order_relaxed);
+			Evaluation_statistics::allocating_evaluations.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+};
+#endif
+
+// Cache of Label_simple_optimization::energy, cleared in constant time
+// by bumping the generation.
+class Energy_cache {
+	struct Entry {
+		K::Point_3 point;
+		K::FT energy;
+		unsigned int generation = 0;
+	};
+	std::vector<Entry> entries = std::vector<Entry>(1024);
+	std::size_t size = 0;
+	unsigned int generation = 1;
+
+	static std::size_t hash(const K::Point_3 &p) {
+		// + 0 so that -0 and 0 share a bucket, as they compare equal
+		std::uint32_t h[3];
+		K::FT c[3] = {p.x() + K::FT(0), p.y() + K::FT(0), p.z() + K::FT(0)};
+		std::memcpy(h, c, sizeof(h));
+		std::size_t r = h[0];
+		r = r * 0x9E3779B1u ^ h[1];
+		r = r * 0x9E3779B1u ^ h[2];
+		return r ^ (r >> 15);
+	}
+
+	void grow() {
+		std::vector<Entry> old;
+		old.swap(entries);
+		entries.resize(2 * old.size());
+		size = 0;
+		for (const auto &e: old) {
+			if (e.generation == generation) insert(e.point, e.energy);
+		}
+	}
+
+	public:
+		void clear() {
+			size = 0;
+			if (++generation == 0) {
+				for (auto &e: entries) e.generation = 0;
+				generation = 1;
+			}
+		}
+
+		const K::FT *find(const K::Point_3 &p) const {
+			std::size_t mask = entries.size() - 1;
+			for (std::size_t i = hash(p) & mask; entries[i].generation == generation; i = (i + 1) & mask) {
+				if (entries[i].point == p) return &entries[i].energy;
+			}
+			return nullptr;
+		}
+
+		void insert(const K::Point_3 &p, K::FT e) {
+			if (2 * (size + 1) > entries.size()) grow();
+			std::size_t mask = entries.size() - 1;
+			std::size_t i = hash(p) & mask;
+			while (entries[i].generation == generation && entries[i].point != p) i = (i + 1) & mask;
+			if (entries[i].generation != generation) size++;
+			entries[i].point = p;
+			entries[i].energy = e;
+			entries[i].generation = generation;
+		}
+};
+
+// Buffers of Label_simple_optimization::compute_energy
+struct Energy_buffers {
+	std::vector<K::FT> Dpt;
+	std::vector<K::FT> FDpt;
+	std::vector<K::FT> sums;
+};
+
+struct Border_face {
+	K::Point_3 source, target;
+	K::Point_3 source_in_plane, target_in_plane;
+	K::Vector_3 normal;
+};
+
+// Per-thread buffers reused from one edge evaluation to the next, so that
+// Custom_cost and Custom_placement stop allocating once they are warm.
+struct Collapse_scratch {
+	// Custom_cost
+	std::vector<Point_set::Index> points;
+	std::vector<K::Triangle_3> new_faces;
+	std::vector<Surface_mesh::Halfedge_index> new_faces_border_halfedge;
+	std::vector<K::Vector_3> new_face_normals;
+	std::vector<K::FT> new_face_cost;
+	std::vector<unsigned char> new_face_label;
+	DistanceKernel::Point_batch point_batch;
+	std::vector<DistanceKernel::Triangle> triangle_batch;
+	std::vector<std::uint32_t> closest_face;
+	std::vector<float> distances;
+	DistanceKernel::Fan_scratch fan;
+	std::vector<std::size_t> face_offset;
+	std::vector<unsigned char> face_with_no_label;
+	std::vector<std::size_t> face_to_be_removed;
+
+	// Custom_cost::estimate
+	std::vector<Point_set::Index> sample;
+	std::vector<std::size_t> sample_stratum;
+	// Number of points and of sampled points of each stratum
+	std::vector<std::pair<std::size_t, std::size_t>> strata;
+	std::vector<K::FT> label_weights;
+	std::vector<double> stratum_sums;
+
+	// Custom_placement
+	std::vector<std::pair <K::Vector_3, K::FT>> volume;
+	std::vector<std::pair <K::Vector_3, K::Vector_3>> boundary;
+	std::vector<K::Vector_3> shape;
+	std::vector<std::pair <K::Vector_3, K::FT>> label;
+	std::vector<K::Vector_3> semantic_border;
+	std::vector<std::array<double, 4>> rows;
+
+	// label_preservation and best_position
+	std::vector<Point_set::Index> points_in_faces;
+	std::vector<Point_set::Index> points_for_svm;
+	std::vector<int> y;
+	DistanceKernel::Point_batch cloud_point_in_plane;
+	std::vector<unsigned char> cloud_point_label;
+	std::vector<Border_face> faces_border;
+	Energy_buffers energy_buffers;
+	std::vector<K::Point_3> results;
+	Energy_cache known_energy;
+	std::vector<std::pair<int, int>> grid_wave;
+	std::vector<std::pair<int, int>> grid_next_wave;
+	std::vector<K::Point_3> grid_positions;
+	std::vector<K::FT> grid_energies;
+	std::vector<std::size_t> grid_pending;
+};
+
+static Collapse_scratch &collapse_scratch() {
+	static thread_local Collapse_scratch scratch;
+	return scratch;
+}
+
+void volume_preservation_and_optimisation (const SMS::Edge_profile<Surface_mesh>& profile, std::vector<std::pair <K::Vector_3, K::FT>> &result) {
 
-	std::list<std::pair <K::Vector_3, K::FT>> result;
+	result.clear();
 
-	SMS::Edge_profile<Surface_mesh>::Triangle_vector triangles = profile.triangles();
+	const SMS::Edge_profile<Surface_mesh>::Triangle_vector &triangles = profile.triangles();
 	for (const auto &triangle: triangles) {
 		Point_3 p0 = get(profile.vertex_point_map(),triangle.v0);
 		Point_3 p1 = get(profile.vertex_point_map(),triangle.v1);
@@ -529,13 +707,11 @@ std::list<std::pair <K::Vector_3, K::FT>> volume_preservation_and_optimisation (
 			result.push_back(std::make_pair(n, det));
 		}
 	}
-
-	return result;
 }
 
-std::list<std::pair <K::Vector_3, K::Vector_3>> boundary_preservation_and_optimisation (const SMS::Edge_profile<Surface_mesh>& profile) {
+void boundary_preservation_and_optimisation (const SMS::Edge_profile<Surface_mesh>& profile, std::vector<std::pair <K::Vector_3, K::Vector_3>> &result) {
 
-	std::list<std::pair <K::Vector_3, K::Vector_3>> result;
+	result.clear();
 
 	for (const auto &edge: profile.border_edges()) {
 		Point_3 p0 = get(profile.vertex_point_map(), profile.surface_mesh().source(edge));
@@ -551,34 +727,33 @@ std::list<std::pair <K::Vector_3, K::Vector_3>> boundary_preservation_and_optimi
 
 		result.push_back(std::make_pair(e1, e2));
 	}
-
-	return result;
 }
 
-std::list<K::Vector_3> triangle_shape_optimization (const SMS::Edge_profile<Surface_mesh>& profile) {
+void triangle_shape_optimization (const SMS::Edge_profile<Surface_mesh>& profile, std::vector<K::Vector_3> &result) {
 
-	std::list<K::Vector_3> result;
+	result.clear();
 
 	for (const auto &v: profile.link()) {
 		result.push_back(K::Vector_3(K::Point_3(CGAL::ORIGIN), get(profile.vertex_point_map(), v)));
 	}
 
-	return result;
-
 }
 
 class Label_simple_optimization {
-	const std::map<Point_set::Index, K::Point_3> &cloud_point_in_plane;
-	const std::set<Point_set::Index> &points_in_faces;
-	const std::map<Surface_mesh::Vertex_index, K::Point_3> &point_in_plane;
-	const std::vector<Surface_mesh::Halfedge_index> &faces_border_halfedge;
-	const Surface_mesh &mesh;
-	const Point_set::Property_map<unsigned char> label;
-	std::map<K::Point_3, K::FT> known_energy;
-	std::set<std::pair<int,int>> grid_search_visit;
+	const DistanceKernel::Point_batch &cloud_point_in_plane;
+	const std::vector<unsigned char> &cloud_point_label;
+	const std::vector<Border_face> &faces_border;
+	Energy_buffers &buffers;
+	Energy_cache &known_energy;
+	Collapse_scratch &scratch;
+
+	// Number of point-triangle distances from which a batch of energies is computed in parallel
+	static constexpr std::size_t PARALLEL_ENERGY_WORK = 1 << 16;
 
 	public:
-		Label_simple_optimization(const std::map<Point_set::Index, K::Point_3> &cloud_point_in_plane, const std::set<Point_set::Index> &points_in_faces, const std::map<Surface_mesh::Vertex_index, K::Point_3> &point_in_plane, const std::vector<Surface_mesh::Halfedge_index> &faces_border_halfedge, const Surface_mesh &mesh, const Point_set::Property_map<unsigned char> label) : cloud_point_in_plane(cloud_point_in_plane), points_in_faces(points_in_faces), point_in_plane(point_in_plane), faces_border_halfedge(faces_border_halfedge), mesh(mesh), label(label) {}
+		Label_simple_optimization(const DistanceKernel::Point_batch &cloud_point_in_plane, const std::vector<unsigned char> &cloud_point_label, const std::vector<Border_face> &faces_border, Collapse_scratch &scratch) : cloud_point_in_plane(cloud_point_in_plane), cloud_point_label(cloud_point_label), faces_border(faces_border), buffers(scratch.energy_buffers), known_energy(scratch.known_energy), scratch(scratch) {
+			known_energy.clear();
+		}
 
 		/*K::FT energy(K::Point_3 middle) {
 			if (auto search = known_energy.find(middle); search != known_energy.end()) {
@@ -654,80 +829,97 @@ class Label_simple_optimization {
 			}
 		}*/
 
-		K::FT energy(K::Point_3 middle) {
-			if (auto search = known_energy.find(middle); search != known_energy.end()) {
-				// std::cerr << "es: " << middle << " " << search->second << "\n";
-				return search->second;
-			} else {
-
-				// std::cerr << "SIZE: " << faces_border_halfedge.size() << "\n";
-
-				for (std::size_t j = 0; j < faces_border_halfedge.size(); j++) {
-					
-					// K::Triangle_3 t_a (mesh.point(mesh.source(faces_border_halfedge[j])), mesh.point(mesh.target(faces_border_halfedge[j])), middle);
-					// K::Triangle_3 t_b (mesh.point(mesh.source(faces_border_halfedge[j])), mesh.point(mesh.target(faces_border_halfedge[j])), mesh.point(mesh.target(mesh.next(faces_border_halfedge[j]))));
-					// std::cerr << "t_a: " << t_a << " : " << CGAL::orthogonal_vector (mesh.point(mesh.source(faces_border_halfedge[j])), mesh.point(mesh.target(faces_border_halfedge[j])), middle) << "\n";
-					// std::cerr << "t_b: " << t_b << " : " << CGAL::orthogonal_vector (mesh.point(mesh.source(faces_border_halfedge[j])), mesh.point(mesh.target(faces_border_halfedge[j])), mesh.point(mesh.target(mesh.next(faces_border_halfedge[j])))) << "\n";
-
-					if (CGAL::scalar_product(CGAL::orthogonal_vector (middle, mesh.point(mesh.source(faces_border_halfedge[j])), mesh.point(mesh.target(faces_border_halfedge[j]))), CGAL::orthogonal_vector (mesh.point(mesh.source(faces_border_halfedge[j])), mesh.point(mesh.target(faces_border_halfedge[j])), mesh.point(mesh.target(mesh.next(faces_border_halfedge[j]))))) < 0) {
-
-						known_energy[middle] = std::numeric_limits<K::FT>::max();
-						return std::numeric_limits<K::FT>::max();
-					}
+		// Energy of middle without the cache, only reading the optimisation
+		K::FT compute_energy(const K::Point_3 &middle, Energy_buffers &energy_buffers) const {
+			for (const auto &face: faces_border) {
+				if (CGAL::scalar_product(CGAL::orthogonal_vector (middle, face.source, face.target), face.normal) < 0) {
+					return std::numeric_limits<K::FT>::max();
 				}
+			}
 
-				CGAL::Eigen_matrix< K::FT, Eigen::Dynamic, Eigen::Dynamic > Dpt(points_in_faces.size(), faces_border_halfedge.size());
-				for (std::size_t j = 0; j < faces_border_halfedge.size(); j++) {
-					K::Triangle_3 triangle (middle, point_in_plane.at(mesh.source(faces_border_halfedge[j])), point_in_plane.at(mesh.target(faces_border_halfedge[j])));
-					std::size_t i = 0;
-					for (const auto &v: points_in_faces) {
-						auto d = CGAL::sqrt(CGAL::squared_distance(triangle, cloud_point_in_plane.at(v)));
-						Dpt.set(i++,j, d);
+			auto &Dpt = energy_buffers.Dpt;
+			auto &FDpt = energy_buffers.FDpt;
+			auto &sums = energy_buffers.sums;
+
+			// FDpt[i*m+j]: influence of the face j on the point i
+			std::size_t n = cloud_point_in_plane.size();
+			std::size_t m = faces_border.size();
+			FDpt.resize(n*m);
+			Dpt.resize(n);
+			sums.assign(n, 0);
+
+			K::FT tho = 0.01;
+			K::FT alpha = 0.2;
+			for (std::size_t j = 0; j < m; j++) {
+				DistanceKernel::Triangle triangle (K::Triangle_3(middle, faces_border[j].source_in_plane, faces_border[j].target_in_plane));
+				DistanceKernel::squared_distances(cloud_point_in_plane, triangle, Dpt.data());
+				for (std::size_t i = 0; i < n; i++) {
+					auto d = CGAL::sqrt(Dpt[i]);
+					K::FT f = 0;
+					if (d < tho / 10) {
+						f = d * (alpha - 1) * K::FT(10) / tho + K::FT(1);
+					} else if (d < tho) {
+						f = alpha * K::FT(10/9) * (K::FT(1) - d / tho);
 					}
+					FDpt[i*m+j] = f;
+					sums[i] += f;
 				}
+			}
 
-				// std::cerr << "Dpt\n" << Dpt << "\n";
-				
-				K::FT tho = 0.01;
-				K::FT alpha = 0.2;
-				auto FDpt = (Dpt.array() < tho).select((Dpt.array() < tho/10).select(Dpt.array() * (alpha - 1) * K::FT(10) / tho + K::FT(1), alpha * K::FT(10/9) * (K::FT(1) - Dpt.array() / tho)), K::FT(0));
-
-				// std::cerr << "FDpt\n" << FDpt << "\n";
-
-				auto sums = FDpt.rowwise().sum();
-				auto Apt = FDpt.colwise() / (sums + (sums == 0).cast<K::FT>());
+			for (auto &sum: sums) {
+				if (sum == 0) sum = 1;
+			}
 
-				// std::cerr << "Apt\n" << Apt << "\n";
-				
-				std::map<unsigned char, std::size_t> classes;
-				for (const auto &v: points_in_faces) {
-					if(classes.count(label[v]) == 0) {
-						classes[label[v]] = classes.size();
-					}
+			// Pct: sum of the normalised influences of the points of each class, minus the dominant class
+			K::FT e = 0;
+			for (std::size_t j = 0; j < m; j++) {
+				K::FT Pct[LABELS.size()] = {0};
+				for (std::size_t i = 0; i < n; i++) {
+					Pct[cloud_point_label[i]] += FDpt[i*m+j] / sums[i];
 				}
-				Eigen::SparseMatrix<K::FT> Ipc(points_in_faces.size(), classes.size());
-				Ipc.reserve(points_in_faces.size());
-				std::size_t i = 0;
-				for (const auto &v: points_in_faces) {
-					Ipc.insert(i++, classes[label[v]]) = 1;
+				K::FT Mct = 0;
+				for (std::size_t c = 0; c < LABELS.size(); c++) {
+					e += Pct[c];
+					if (Pct[c] > Mct) Mct = Pct[c];
 				}
+				e -= Mct;
+			}
 
-				// std::cerr << "Ipc\n" << Ipc << "\n";
-
-				auto Pct = Ipc.transpose() * Apt.matrix();
-
-				// std::cerr << "Pct\n" << Pct << "\n";
-
-				auto Mct = Pct.array().colwise().maxCoeff();
-
-				auto e = Pct.sum() - Mct.sum();
-
-				known_energy[middle] = e;
+			return e;
+		}
 
-				// std::cerr << "e: " << middle << " " << e << "\n";
+		K::FT energy(K::Point_3 middle) {
+			if (auto search = known_energy.find(middle); search != nullptr) {
+				return *search;
+			}
+			K::FT e = compute_energy(middle, buffers);
+			known_energy.insert(middle, e);
+			return e;
+		}
+
+		// Energies of several positions, computed in parallel if they are worth it
+		void energies(const std::vector<K::Point_3> &positions, std::vector<K::FT> &values) {
+			values.resize(positions.size());
+			auto &pending = scratch.grid_pending;
+			pending.clear();
+			for (std::size_t k = 0; k < positions.size(); k++) {
+				if (auto search = known_energy.find(positions[k]); search != nullptr) {
+					values[k] = *search;
+				} else {
+					pending.push_back(k);
+				}
+			}
 
-				return e;
+			if (pending.size() > 1 && pending.size() * cloud_point_in_plane.size() * faces_border.size() >= PARALLEL_ENERGY_WORK) {
+				ParallelUtils::for_each_index(pending.size(), [&](std::size_t k) {
+					static thread_local Energy_buffers worker_buffers;
+					values[pending[k]] = compute_energy(positions[pending[k]], worker_buffers);
+				}, 1);
+			} else {
+				for (auto k: pending) values[k] = compute_energy(positions[k], buffers);
 			}
+
+			for (auto k: pending) known_energy.insert(positions[k], values[k]);
 		}
 
 		std::pair<K::Point_3, K::FT> linear_search(K::Point_3 middle, K::Vector_3 vec1) {
@@ -758,69 +950,95 @@ class Label_simple_optimization {
 			return std::make_pair(middle + pos * vec1, CGAL::abs(pas));
 		}
 
-		void grid_search(std::vector<K::Point_3> &results, K::FT *r_energy, K::Vector_3 &vec1, K::Vector_3 &vec2, int pos1, int pos2) {
-			// std::cerr << "g\t" << pos1 << "\t" << pos2 << "\n";
-			// for (const auto &r: grid_search_visit) {
-			// 	std::cerr << "\t\t" << r.first << "\t" << r.second << "\n";
-			// }
-			if (grid_search_visit.count(std::make_pair(pos1, pos2)) == 0) {
-				grid_search_visit.insert(std::make_pair(pos1, pos2));
-				auto e = energy(results[0] + pos1*vec1 + pos2*vec2);
-				if (e < *r_energy) {
-					results[1] = results[0] + pos1*vec1 + pos2*vec2;
-					*r_energy = e;
+		// Flood fill from results[0] over the grid of steps vec1 and vec2,
+		// through the positions of finite energy, up to 10 steps along each
+		// axis. The positions at the same distance from results[0] are
+		// evaluated together; the first one with the lowest energy goes in
+		// results[1].
+		void grid_search(std::vector<K::Point_3> &results, K::FT *r_energy, const K::Vector_3 &vec1, const K::Vector_3 &vec2) {
+			std::array<bool, 21*21> visited {};
+			auto &wave = scratch.grid_wave;
+			auto &next_wave = scratch.grid_next_wave;
+			auto &positions = scratch.grid_positions;
+			auto &values = scratch.grid_energies;
+
+			wave.assign(1, std::make_pair(0, 0));
+			visited[10 * 21 + 10] = true;
+			while (!wave.empty()) {
+				positions.clear();
+				for (const auto &pos: wave) {
+					positions.push_back(results[0] + pos.first*vec1 + pos.second*vec2);
 				}
-				// std::cerr << "e: " << e << "\n";
-				if (e < std::numeric_limits<K::FT>::max() && abs(pos1) < 10 && abs(pos2) < 10) {
-					grid_search(results, r_energy, vec1, vec2, pos1 + 1, pos2);
-					grid_search(results, r_energy, vec1, vec2, pos1 - 1, pos2);
-					grid_search(results, r_energy, vec1, vec2, pos1, pos2 + 1);
-					grid_search(results, r_energy, vec1, vec2, pos1, pos2 - 1);
+				energies(positions, values);
+
+				next_wave.clear();
+				for (std::size_t k = 0; k < wave.size(); k++) {
+					int pos1 = wave[k].first, pos2 = wave[k].second;
+					if (values[k] < *r_energy) {
+						results[1] = positions[k];
+						*r_energy = values[k];
+					}
+					if (values[k] < std::numeric_limits<K::FT>::max() && abs(pos1) < 10 && abs(pos2) < 10) {
+						for (const auto &next: {std::make_pair(pos1 + 1, pos2), std::make_pair(pos1 - 1, pos2), std::make_pair(pos1, pos2 + 1), std::make_pair(pos1, pos2 - 1)}) {
+							if (!visited[(next.first + 10) * 21 + next.second + 10]) {
+								visited[(next.first + 10) * 21 + next.second + 10] = true;
+								next_wave.push_back(next);
+							}
+						}
+					}
 				}
+				wave.swap(next_wave);
 			}
 		}
 };
 
 
-std::pair<K::Point_3, std::pair<K::Vector_3, K::Vector_3>> best_position(const SMS::Edge_profile<Surface_mesh>& profile, const Point_set &point_cloud, const std::set<Point_set::Index> &points_in_faces) {
+std::pair<K::Point_3, std::pair<K::Vector_3, K::Vector_3>> best_position(const SMS::Edge_profile<Surface_mesh>& profile, const Point_set &point_cloud, const std::vector<Point_set::Index> &points_in_faces, const Point_set::Property_map<unsigned char> &label, const Collapse_properties &properties, Collapse_scratch &scratch) {
 
-	Point_set::Property_map<unsigned char> label;
-	bool has_label;
-	boost::tie(label, has_label) = point_cloud.property_map<unsigned char>("p:label");
-	assert(has_label);
+	// Normal of the face of h, from f:normal if it is there
+	auto face_normal = [&](Surface_mesh::Halfedge_index h) {
+		const Surface_mesh &mesh = profile.surface_mesh();
+		if (properties.has_face_normals) return properties.face_normals[mesh.face(h)];
+		return CGAL::orthogonal_vector(mesh.point(mesh.source(h)), mesh.point(mesh.target(h)), mesh.point(mesh.target(mesh.next(h))));
+	};
 
 	K::Vector_3 ortho_plane (CGAL::NULL_VECTOR);
 	if (profile.left_face_exists()) {
-		ortho_plane += CGAL::orthogonal_vector(profile.surface_mesh().point(profile.v0()), profile.surface_mesh().point(profile.v1()), profile.surface_mesh().point(profile.vL()));
+		ortho_plane += face_normal(profile.v0_v1());
 	}
 	if (profile.right_face_exists()) {
-		ortho_plane += CGAL::orthogonal_vector(profile.surface_mesh().point(profile.v1()), profile.surface_mesh().point(profile.v0()), profile.surface_mesh().point(profile.vR()));
+		ortho_plane += face_normal(profile.v1_v0());
 	}
 	K::Plane_3 plane(profile.surface_mesh().point(profile.v0()), ortho_plane);
 
 	CGAL::Cartesian_converter<Point_set_kernel, K> type_converter;
-	std::map<Point_set::Index, K::Point_3> cloud_point_in_plane;
+	scratch.cloud_point_in_plane.clear();
+	scratch.cloud_point_label.clear();
 	for (const auto &v: points_in_faces) {
-		cloud_point_in_plane[v] = plane.projection(type_converter(point_cloud.point(v)));
-	}
-
-	std::map<Surface_mesh::Vertex_index, K::Point_3> point_in_plane;
-	for (const auto &v: profile.link()) {
-		point_in_plane[v] = plane.projection(profile.surface_mesh().point(v));
+		scratch.cloud_point_in_plane.push_back(plane.projection(type_converter(point_cloud.point(v))));
+		scratch.cloud_point_label.push_back(label[v]);
 	}
 
-	std::vector<Surface_mesh::Halfedge_index> faces_border_halfedge;
+	const Surface_mesh &mesh = profile.surface_mesh();
+	scratch.faces_border.clear();
 	for (std::size_t face_id = 0; face_id < profile.link().size(); face_id++) {
-		auto he = profile.surface_mesh().halfedge(profile.link()[face_id], profile.link()[(face_id + 1) % profile.link().size()]);
-		if (he != Surface_mesh::null_halfedge() && !profile.surface_mesh().is_border(he)) {
-			faces_border_halfedge.push_back(he);
+		auto he = mesh.halfedge(profile.link()[face_id], profile.link()[(face_id + 1) % profile.link().size()]);
+		if (he != Surface_mesh::null_halfedge() && !mesh.is_border(he)) {
+			Border_face face;
+			face.source = mesh.point(mesh.source(he));
+			face.target = mesh.point(mesh.target(he));
+			face.source_in_plane = plane.projection(face.source);
+			face.target_in_plane = plane.projection(face.target);
+			face.normal = face_normal(he);
+			scratch.faces_border.push_back(face);
 		}
 	}
 
-	Label_simple_optimization optim(cloud_point_in_plane, points_in_faces, point_in_plane, faces_border_halfedge, profile.surface_mesh(), label);
+	Label_simple_optimization optim(scratch.cloud_point_in_plane, scratch.cloud_point_label, scratch.faces_border, scratch);
 
-	std::vector<K::Point_3> results;
-	results.reserve(2);
+	std::vector<K::Point_3> &results = scratch.results;
+	results.clear();
+	results.reserve(20);
 	K::Vector_3 vec1 (profile.surface_mesh().point(profile.v0()), profile.surface_mesh().point(profile.v1()));
 	vec1 /= 2;
 	K::FT pas = CGAL::sqrt(vec1.squared_length());
@@ -844,14 +1062,7 @@ std::pair<K::Point_3, std::pair<K::Vector_3, K::Vector_3>> best_position(const S
 
 	K::FT r_energy = std::numeric_limits<K::FT>::max();
 	// std::cerr << "-----------------------------\n";
-	optim.grid_search(results, &r_energy, vec1, vec2, 0, 0);
-	/*if (optim.grid_search_visit.size() < 10) {
-		optim.grid_search_visit.clear();
-		vec1 /= 2;
-		vec2 /= 2;
-		pas /= 2;
-		optim.grid_search(results, &r_energy, vec1, vec2, 0, 0);
-	}*/
+	optim.grid_search(results, &r_energy, vec1, vec2);
 
 	if (optim.energy(r.first) <= optim.energy(results[1])) {
 		results[1] = r.first;
@@ -1019,46 +1230,49 @@ std::pair<K::Point_3, std::pair<K::Vector_3, K::Vector_3>> best_position(const S
 
 }
 
-std::list<std::pair <K::Vector_3, K::FT>> label_preservation (const SMS::Edge_profile<Surface_mesh>& profile, const Point_set &point_cloud, const Ablation_study &ablation) {
+void label_preservation (const SMS::Edge_profile<Surface_mesh>& profile, const Point_set &point_cloud, const Ablation_study &ablation, const Collapse_properties &properties, Collapse_scratch &scratch) {
 
 TimerUtils::Timer timer;
 timer.start();
 
-	std::list<std::pair <K::Vector_3, K::FT>> result;
+	auto &result = scratch.label;
+	result.clear();
 
-	Point_set::Property_map<unsigned char> label;
-	bool has_label;
-	boost::tie(label, has_label) = point_cloud.property_map<unsigned char>("p:label");
-	assert(has_label);
+	assert(properties.has_point_cloud_label);
+	const auto &label = properties.point_cloud_label;
 
-	Point_set::Property_map<bool> isborder;
-	if (ablation.border_point) {
-		bool has_isborder;
-		boost::tie(isborder, has_isborder) = point_cloud.property_map<bool>("p:isborder");
-		assert(has_isborder);
-	}
+	assert(!ablation.border_point || properties.has_isborder);
+	const auto &isborder = properties.isborder;
 
-	Surface_mesh::Property_map<Surface_mesh::Face_index, std::list<Point_set::Index>> point_in_face;
-	bool has_point_in_face;
-	boost::tie(point_in_face, has_point_in_face) = profile.surface_mesh().property_map<Surface_mesh::Face_index, std::list<Point_set::Index>>("f:points");
-	assert(has_point_in_face);
+	assert(properties.has_point_in_face);
+	const auto &point_in_face = properties.point_in_face;
 
-	std::set<Point_set::Index> points_in_faces;
+	// Sorted and without duplicates, as the set it replaces
+	auto &points_in_faces = scratch.points_in_faces;
+	auto sort_points_in_faces = [&points_in_faces]() {
+		std::sort(points_in_faces.begin(), points_in_faces.end());
+		points_in_faces.erase(std::unique(points_in_faces.begin(), points_in_faces.end()), points_in_faces.end());
+	};
+
+	points_in_faces.clear();
 	int count_collapse_label[LABELS.size()] = {0};
 	for (const auto &face: profile.triangles()) {
 		auto fh = profile.surface_mesh().face(profile.surface_mesh().halfedge(face.v0, face.v1));
 		if (point_in_face[fh].size() > 0) {
-			int count_face_label[LABELS.size()] = {0};
 			for (const auto &ph: point_in_face[fh]) {
 				if (!ablation.border_point || isborder[ph]) {
-					points_in_faces.insert(ph);
+					points_in_faces.push_back(ph);
 				}
-				count_face_label[label[ph]]++;
 			}
-			auto argmax = std::max_element(count_face_label, count_face_label+LABELS.size()); // face label
-			count_collapse_label[argmax - count_face_label]++;
+			// face label
+			if (properties.has_face_histograms) {
+				count_collapse_label[properties.face_histograms[fh].argmax()]++;
+			} else {
+				count_collapse_label[label_histogram(point_in_face[fh], label).argmax()]++;
+			}
 		}
 	}
+	sort_points_in_faces();
 
 	int count_diff_label = 0;
 	for (std::size_t i = 0; i < LABELS.size(); i++) {
@@ -1069,7 +1283,7 @@ timer.start();
 	CGAL::Cartesian_converter<Point_set_kernel,K> type_converter;
 
 	if (count_diff_label < 2) {
-		return result;
+		return;
 	} else if (count_diff_label == 2) {
 
 		unsigned char label1, label2;
@@ -1085,10 +1299,10 @@ timer.start();
 			}
 		}
 
-		std::vector<int> y;
-		std::vector<Point_set::Index> points_for_svm;
-		y.reserve(points_in_faces.size());
-		points_for_svm.reserve(points_in_faces.size());
+		auto &y = scratch.y;
+		auto &points_for_svm = scratch.points_for_svm;
+		y.clear();
+		points_for_svm.clear();
 		bool has_label1 = false, has_label2 = false; 
 		for (const auto &point: points_in_faces) {
 			if (label[point] == label1) {
@@ -1108,13 +1322,12 @@ timer.start();
 			for (const auto &face: profile.triangles()) {
 				auto fh = profile.surface_mesh().face(profile.surface_mesh().halfedge(face.v0, face.v1));
 				if (point_in_face[fh].size() > 0) {
-					points_in_faces.insert(point_in_face[fh].begin(), point_in_face[fh].end());
+					points_in_faces.insert(points_in_faces.end(), point_in_face[fh].begin(), point_in_face[fh].end());
 				}
 			}
+			sort_points_in_faces();
 			y.clear();
 			points_for_svm.clear();
-			y.reserve(points_in_faces.size());
-			points_for_svm.reserve(points_in_faces.size());
 			for (const auto &point: points_in_faces) {
 				if (label[point] == label1) {
 					points_for_svm.push_back(point);
@@ -1183,10 +1396,10 @@ timer.start();
 		for (std::size_t i_label = 0; i_label < LABELS.size(); i_label++) {
 			if (count_collapse_label[i_label] > 0) {
 
-				std::vector<int> y;
-				std::vector<Point_set::Index> points_for_svm;
-				y.reserve(points_in_faces.size());
-				points_for_svm.reserve(points_in_faces.size());
+				auto &y = scratch.y;
+				auto &points_for_svm = scratch.points_for_svm;
+				y.clear();
+				points_for_svm.clear();
 				bool has_i_label = false, has_other_label = false;
 				for (const auto &point: points_in_faces) {
 					if (label[point] == i_label) {
@@ -1216,11 +1429,12 @@ timer.start();
 		for (const auto &face: profile.triangles()) {
 			auto fh = profile.surface_mesh().face(profile.surface_mesh().halfedge(face.v0, face.v1));
 			if (point_in_face[fh].size() > 0) {
-				points_in_faces.insert(point_in_face[fh].begin(), point_in_face[fh].end());
+				points_in_faces.insert(points_in_faces.end(), point_in_face[fh].begin(), point_in_face[fh].end());
 			}
 		}
+		sort_points_in_faces();
 
-		auto p = best_position(profile, point_cloud, points_in_faces);
+		auto p = best_position(profile, point_cloud, points_in_faces, label, properties, scratch);
 		if (p.first != CGAL::ORIGIN) {
 			p.second.first /= CGAL::sqrt(p.second.first.squared_length());
 			p.second.second /= CGAL::sqrt(p.second.second.squared_length());
@@ -1252,28 +1466,18 @@ timer.start();
 
 timer.pause();
 // std::cerr << "timer.getElapsedTime: " << timer.getElapsedTime() << "\n";
-	return result;
 
 }
 
-std::list<K::Vector_3> semantic_border_optimization (const SMS::Edge_profile<Surface_mesh>& profile, const Point_set &point_cloud) {
+void semantic_border_optimization (const SMS::Edge_profile<Surface_mesh>& profile, const Collapse_properties &properties, std::vector<K::Vector_3> &result) {
 
-	std::list<K::Vector_3> result;
+	result.clear();
 
-	Point_set::Property_map<unsigned char> point_cloud_label;
-	bool has_point_cloud_label;
-	boost::tie(point_cloud_label, has_point_cloud_label) = point_cloud.property_map<unsigned char>("p:label");
-	assert(has_point_cloud_label);
-
-	Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> mesh_label;
-	bool has_mesh_label;
-	boost::tie(mesh_label, has_mesh_label) = profile.surface_mesh().property_map<Surface_mesh::Face_index, unsigned char>("f:label");
-	assert(has_mesh_label);
+	assert(properties.has_mesh_label);
+	const auto &mesh_label = properties.mesh_label;
 
-	Surface_mesh::Property_map<Surface_mesh::Face_index, std::list<Point_set::Index>> point_in_face;
-	bool has_point_in_face;
-	boost::tie(point_in_face, has_point_in_face) = profile.surface_mesh().property_map<Surface_mesh::Face_index, std::list<Point_set::Index>>("f:points");
-	assert(has_point_in_face);
+	assert(properties.has_point_in_face);
+	const auto &point_in_face = properties.point_in_face;
 
 	for (const auto &h: profile.surface_mesh().halfedges_around_target(profile.v1_v0())) {
 		if (h != profile.v1_v0() && h != profile.vL_v0() && !profile.surface_mesh().is_border(Surface_mesh::Edge_index(h))) {
@@ -1299,8 +1503,45 @@ std::list<K::Vector_3> semantic_border_optimization (const SMS::Edge_profile<Sur
 		}
 	}*/
 
-	return result;
+}
+
+K::FT compute_energy(const Surface_mesh &mesh, const Point_set &point_cloud, const K::FT alpha, const K::FT beta, const K::FT gamma) {
+	AABB_tree mesh_tree;
+	PointLocation::build_tree(mesh, mesh_tree);
+	CGAL::Cartesian_converter<Point_set_kernel, K> type_converter;
+
+	Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> mesh_label;
+	bool has_mesh_label;
+	boost::tie(mesh_label, has_mesh_label) = mesh.property_map<Surface_mesh::Face_index, unsigned char>("f:label");
+
+	Point_set::Property_map<unsigned char> point_cloud_label;
+	bool has_point_cloud_label;
+	boost::tie(point_cloud_label, has_point_cloud_label) = point_cloud.property_map<unsigned char>("p:label");
 
+	std::vector<Point_set::Index> indices (point_cloud.begin(), point_cloud.end());
+	std::vector<K::Point_3> points (indices.size());
+	for (std::size_t i = 0; i < indices.size(); i++) points[i] = type_converter(point_cloud.point(indices[i]));
+	auto locations = PointLocation::locate(points, mesh_tree, mesh);
+
+	K::FT energy = 0;
+	for (std::size_t i = 0; i < indices.size(); i++) {
+		const auto &location = locations[i];
+		energy += alpha * CGAL::squared_distance(points[i], PMP::construct_point(location, mesh));
+		if (has_mesh_label && has_point_cloud_label && mesh_label[location.first] != point_cloud_label[indices[i]]) energy += beta;
+	}
+
+	if (has_mesh_label) {
+		for (const auto &edge: mesh.edges()) {
+			if (!mesh.is_border(edge)) {
+				auto h = mesh.halfedge(edge);
+				if (mesh_label[mesh.face(h)] != mesh_label[mesh.face(mesh.opposite(h))]) {
+					energy += gamma * CGAL::sqrt(CGAL::squared_distance(mesh.point(mesh.source(h)), mesh.point(mesh.target(h))));
+				}
+			}
+		}
+	}
+
+	return energy;
 }
 
 LindstromTurk_param::LindstromTurk_param(
@@ -1326,31 +1567,30 @@ Ablation_study::Ablation_study(
 	bool step_mesh) :
 	subdivide(subdivide), direct_search(direct_search), border_point(border_point), step_mesh(step_mesh) {}
 
+// Every combination of the rows is instantiated, indexed by its Placement_term mask
+template <std::size_t... Terms>
+Custom_placement::Evaluation Custom_placement::evaluation_for(unsigned terms, std::index_sequence<Terms...>) {
+	static const Evaluation evaluations[] = {&Custom_placement::place<Terms>...};
+	return evaluations[terms];
+}
+
 Custom_placement::Custom_placement (const LindstromTurk_param &params, Surface_mesh &mesh, const Point_set &point_cloud, const Ablation_study ablation) : params(params), point_cloud(point_cloud), ablation(ablation) {
 	bool created_collapse_datas;
 	boost::tie(collapse_datas, created_collapse_datas) = mesh.add_property_map<Surface_mesh::Edge_index, CollapseData>("e:c_datas");
-}
 
+	unsigned terms = 0;
+	if (params.triangle_shape_optimization > 0) terms |= PLACEMENT_SHAPE;
+	if (params.label_preservation > 0) terms |= PLACEMENT_LABEL;
+	if (params.semantic_border_optimization > 0) terms |= PLACEMENT_SEMANTIC_BORDER;
+	evaluation = evaluation_for(terms, std::make_index_sequence<PLACEMENT_TERMS + 1>());
+}
 
-boost::optional<SMS::Edge_profile<Surface_mesh>::Point> Custom_placement::operator()(const SMS::Edge_profile<Surface_mesh>& profile) const {
-	typedef boost::optional<SMS::Edge_profile<Surface_mesh>::Point> result_type;
-
-	std::list<std::pair <K::Vector_3, K::FT>> r1;
-	if (params.volume_preservation > 0 || params.volume_optimisation > 0) r1 = volume_preservation_and_optimisation(profile);
-	std::list<std::pair <K::Vector_3, K::Vector_3>> r2;
-	if (params.boundary_preservation > 0 || params.boundary_optimization > 0) r2 = boundary_preservation_and_optimisation(profile);
-	std::list<K::Vector_3> r3;
-	if (params.triangle_shape_optimization > 0) r3 = triangle_shape_optimization(profile);
-	std::list<std::pair <K::Vector_3, K::FT>> r4;
-	if (params.label_preservation > 0) r4 = label_preservation(profile, point_cloud, ablation);
-	std::list<K::Vector_3> r5;
-	if (params.semantic_border_optimization > 0 && r4.size() < 3) r5 = semantic_border_optimization(profile, point_cloud);
-
-	Eigen_vector B(((params.volume_preservation > 0) ? 1 : 0) + ((params.volume_optimisation > 0) ? r1.size() : 0) + ((params.boundary_preservation > 0 && r2.size() > 0) ? 3 : 0) + ((params.boundary_optimization > 0) ? 3*r2.size() : 0) + ((params.triangle_shape_optimization > 0) ? 3*r3.size() : 0) + ((params.label_preservation > 0) ? r4.size() : 0) + ((params.semantic_border_optimization > 0) ? 3*r5.size() : 0));
-	Eigen_matrix A(((params.volume_preservation > 0) ? 1 : 0) + ((params.volume_optimisation > 0) ? r1.size() : 0) + ((params.boundary_preservation > 0 && r2.size() > 0) ? 3 : 0) + ((params.boundary_optimization > 0) ? 3*r2.size() : 0) + ((params.triangle_shape_optimization > 0) ? 3*r3.size() : 0) + ((params.label_preservation > 0) ? r4.size() : 0) + ((params.semantic_border_optimization > 0) ? 3*r5.size() : 0), 3);
-
-	std::size_t i = 0;
+void Custom_placement::prepare(const Surface_mesh &mesh) const {
+	properties.prepare(mesh, point_cloud);
+}
 
+// Rows of the volume and boundary terms, as (A_i0, A_i1, A_i2, B_i)
+static void add_volume_and_boundary_rows(const LindstromTurk_param &params, const std::vector<std::pair <K::Vector_3, K::FT>> &r1, const std::vector<std::pair <K::Vector_3, K::Vector_3>> &r2, std::vector<std::array<double, 4>> &rows) {
 	// Volume preservation
 	if (params.volume_preservation > 0) {
 		K::Vector_3 n (CGAL::NULL_VECTOR);
@@ -1359,19 +1599,13 @@ boost::optional<SMS::Edge_profile<Surface_mesh>::Point> Custom_placement::operat
 			n += vpo.first;
 			det += vpo.second;
 		}
-		A.set(i, 0, n.x()/3*params.volume_preservation);
-		A.set(i, 1, n.y()/3*params.volume_preservation);
-		A.set(i, 2, n.z()/3*params.volume_preservation);
-		B.set(i++, det/3*params.volume_preservation);
+		rows.push_back({n.x()/3*params.volume_preservation, n.y()/3*params.volume_preservation, n.z()/3*params.volume_preservation, det/3*params.volume_preservation});
 	}
 
 	// Volume optimisation
 	if (params.volume_optimisation > 0) {
 		for (const auto &vpo: r1) {
-			A.set(i, 0, vpo.first.x()/3*params.volume_optimisation);
-			A.set(i, 1, vpo.first.y()/3*params.volume_optimisation);
-			A.set(i, 2, vpo.first.z()/3*params.volume_optimisation);
-			B.set(i++, vpo.second/3*params.volume_optimisation);
+			rows.push_back({vpo.first.x()/3*params.volume_optimisation, vpo.first.y()/3*params.volume_optimisation, vpo.first.z()/3*params.volume_optimisation, vpo.second/3*params.volume_optimisation});
 		}
 	}
 
@@ -1383,89 +1617,295 @@ boost::optional<SMS::Edge_profile<Surface_mesh>::Point> Custom_placement::operat
 			e1 += vpo.first;
 			e2 += vpo.second;
 		}
-		A.set(i, 0, 0);
-		A.set(i, 1, -e1.z()/2*params.boundary_preservation);
-		A.set(i, 2, e1.y()/2*params.boundary_preservation);
-		B.set(i++, e2.x()/2*params.boundary_preservation);
-		A.set(i, 0, e1.z()/2*params.boundary_preservation);
-		A.set(i, 1, 0);
-		A.set(i, 2, -e1.x()/2*params.boundary_preservation);
-		B.set(i++, e2.y()/2*params.boundary_preservation);
-		A.set(i, 0, -e1.y()/2*params.boundary_preservation);
-		A.set(i, 1, e1.x()/2*params.boundary_preservation);
-		A.set(i, 2, 0);
-		B.set(i++, e2.z()/2*params.boundary_preservation);
+		rows.push_back({0, -e1.z()/2*params.boundary_preservation, e1.y()/2*params.boundary_preservation, e2.x()/2*params.boundary_preservation});
+		rows.push_back({e1.z()/2*params.boundary_preservation, 0, -e1.x()/2*params.boundary_preservation, e2.y()/2*params.boundary_preservation});
+		rows.push_back({-e1.y()/2*params.boundary_preservation, e1.x()/2*params.boundary_preservation, 0, e2.z()/2*params.boundary_preservation});
 	}
 
 	// Boundary optimisation
 	if (params.boundary_optimization > 0) {
 		for (const auto &vpo: r2) {
-			A.set(i, 0, 0);
-			A.set(i, 1, -vpo.first.z()/2*params.boundary_optimization);
-			A.set(i, 2, vpo.first.y()/2*params.boundary_optimization);
-			B.set(i++, vpo.second.x()/2*params.boundary_optimization);
-			A.set(i, 0, vpo.first.z()/2*params.boundary_optimization);
-			A.set(i, 1, 0);
-			A.set(i, 2, -vpo.first.x()/2*params.boundary_optimization);
-			B.set(i++, vpo.second.y()/2*params.boundary_optimization);
-			A.set(i, 0, -vpo.first.y()/2*params.boundary_optimization);
-			A.set(i, 1, vpo.first.x()/2*params.boundary_optimization);
-			A.set(i, 2, 0);
-			B.set(i++, vpo.second.z()/2*params.boundary_optimization);
+			rows.push_back({0, -vpo.first.z()/2*params.boundary_optimization, vpo.first.y()/2*params.boundary_optimization, vpo.second.x()/2*params.boundary_optimization});
+			rows.push_back({vpo.first.z()/2*params.boundary_optimization, 0, -vpo.first.x()/2*params.boundary_optimization, vpo.second.y()/2*params.boundary_optimization});
+			rows.push_back({-vpo.first.y()/2*params.boundary_optimization, vpo.first.x()/2*params.boundary_optimization, 0, vpo.second.z()/2*params.boundary_optimization});
 		}
 	}
+}
+
+// Normal equations of the system AX=B of Custom_placement, written in a
+// frame centred on origin to keep the precision of B^T B
+struct Placement_system {
+	Eigen::Vector3d origin;
+	Eigen::Matrix3d AtA = Eigen::Matrix3d::Zero();
+	Eigen::Vector3d AtB = Eigen::Vector3d::Zero();
+	double BtB = 0;
+
+	explicit Placement_system(const Point_3 &origin) : origin(origin.x(), origin.y(), origin.z()) {}
+
+	// Row a.(X - origin) = b
+	void add_local_row(const Eigen::Vector3d &a, double b) {
+		AtA += a * a.transpose();
+		AtB += a * b;
+		BtB += b * b;
+	}
+
+	// Row (a0, a1, a2).X = b
+	void add_row(double a0, double a1, double a2, double b) {
+		Eigen::Vector3d a (a0, a1, a2);
+		add_local_row(a, b - a.dot(origin));
+	}
+
+	// Optimisation rows of q, written relative to from, times sign
+	void add_quadric(const Vertex_quadric &q, const Eigen::Vector3d &from, double sign) {
+		Eigen::Matrix3d Q;
+		Q << q.AtA[0], q.AtA[1], q.AtA[2],
+		     q.AtA[1], q.AtA[3], q.AtA[4],
+		     q.AtA[2], q.AtA[4], q.AtA[5];
+		Eigen::Vector3d q_AtB (q.AtB[0], q.AtB[1], q.AtB[2]);
+		// a.(X - origin) = b - a.(origin - from)
+		Eigen::Vector3d d = origin - from;
+		Eigen::Vector3d Qd = Q * d;
+		AtA += sign * Q;
+		AtB += sign * (q_AtB - Qd);
+		BtB += sign * (q.BtB - 2 * d.dot(q_AtB) + d.dot(Qd));
+	}
+
+	// Solves AX=B in the least squares sense, returns the squared residual
+	double solve(Eigen::Vector3d &X) const {
+		Eigen::JacobiSVD<Eigen::Matrix3d> svd (AtA, Eigen::ComputeFullU | Eigen::ComputeFullV);
+		Eigen::Vector3d local = svd.solve(AtB);
+		X = local + origin;
+		return std::max(0., local.dot(AtA * local) - 2 * local.dot(AtB) + BtB);
+	}
+};
+
+static Eigen::Vector3d to_eigen(const Point_3 &p) {
+	return Eigen::Vector3d(p.x(), p.y(), p.z());
+}
+
+static void add_to_quadric(Vertex_quadric &q, const Eigen::Vector3d &a, double b) {
+	q.AtA[0] += a[0] * a[0];
+	q.AtA[1] += a[0] * a[1];
+	q.AtA[2] += a[0] * a[2];
+	q.AtA[3] += a[1] * a[1];
+	q.AtA[4] += a[1] * a[2];
+	q.AtA[5] += a[2] * a[2];
+	for (int i = 0; i < 3; i++) q.AtB[i] += a[i] * b;
+	q.BtB += b * b;
+}
+
+// Volume terms of the face (p0, p1, p2) relative to origin, as in volume_preservation_and_optimisation
+static void add_face_terms(const LindstromTurk_param &params, const Point_3 &p0, const Point_3 &p1, const Point_3 &p2, const Eigen::Vector3d &origin, Vertex_quadric &q) {
+	if (CGAL::collinear(p0, p1, p2)) return;
+	K::Vector_3 normal = CGAL::normal(p0, p1, p2) / 2;
+	Eigen::Vector3d n (normal.x(), normal.y(), normal.z());
+	double det = n.dot(to_eigen(p0) - origin);
+
+	if (params.volume_preservation > 0) {
+		for (int i = 0; i < 3; i++) q.normal[i] += n[i];
+		q.det += det;
+	}
+	if (params.volume_optimisation > 0) add_to_quadric(q, n / 3 * params.volume_optimisation, det / 3 * params.volume_optimisation);
+}
+
+// Boundary terms of the border edge (p0, p1) relative to origin, as in boundary_preservation_and_optimisation
+static void add_border_terms(const LindstromTurk_param &params, const Point_3 &p0, const Point_3 &p1, const Eigen::Vector3d &origin, Vertex_quadric &q) {
+	Eigen::Vector3d e1 = to_eigen(p1) - to_eigen(p0);
+	Eigen::Vector3d e2 = (to_eigen(p1) - origin).cross(to_eigen(p0) - origin);
+
+	if (params.boundary_preservation > 0) {
+		for (int i = 0; i < 3; i++) {
+			q.e1[i] += e1[i];
+			q.e2[i] += e2[i];
+		}
+	}
+	if (params.boundary_optimization > 0) {
+		double w = params.boundary_optimization / 2;
+		add_to_quadric(q, Eigen::Vector3d(0, -e1.z(), e1.y()) * w, e2.x() * w);
+		add_to_quadric(q, Eigen::Vector3d(e1.z(), 0, -e1.x()) * w, e2.y() * w);
+		add_to_quadric(q, Eigen::Vector3d(-e1.y(), e1.x(), 0) * w, e2.z() * w);
+	}
+	q.border_edges++;
+}
+
+static void add_face_terms(const LindstromTurk_param &params, const Surface_mesh &mesh, Surface_mesh::Face_index face, const Eigen::Vector3d &origin, Vertex_quadric &q) {
+	auto h = mesh.halfedge(face);
+	add_face_terms(params, mesh.point(mesh.source(h)), mesh.point(mesh.target(h)), mesh.point(mesh.target(mesh.next(h))), origin, q);
+}
+
+// The border halfedge of a border edge
+static void add_border_terms(const LindstromTurk_param &params, const Surface_mesh &mesh, Surface_mesh::Halfedge_index h, const Eigen::Vector3d &origin, Vertex_quadric &q) {
+	if (!mesh.is_border(h)) h = mesh.opposite(h);
+	add_border_terms(params, mesh.point(mesh.source(h)), mesh.point(mesh.target(h)), origin, q);
+}
+
+static bool has_volume_or_boundary_terms(const LindstromTurk_param &params) {
+	return params.volume_preservation > 0 || params.volume_optimisation > 0 || params.boundary_preservation > 0 || params.boundary_optimization > 0;
+}
+
+// Volume and boundary terms of the faces and border edges around v
+static Vertex_quadric vertex_quadric(const LindstromTurk_param &params, const Surface_mesh &mesh, Surface_mesh::Vertex_index v) {
+	Vertex_quadric q;
+	Eigen::Vector3d origin = to_eigen(mesh.point(v));
+	for (const auto &h: mesh.halfedges_around_target(mesh.halfedge(v))) {
+		if (params.volume_preservation > 0 || params.volume_optimisation > 0) {
+			if (!mesh.is_border(h)) add_face_terms(params, mesh, mesh.face(h), origin, q);
+		}
+		if (params.boundary_preservation > 0 || params.boundary_optimization > 0) {
+			if (mesh.is_border(mesh.edge(h))) add_border_terms(params, mesh, h, origin, q);
+		}
+	}
+	return q;
+}
+
+/*
+ * Adds the volume and boundary rows of the profile to system, from the
+ * quadrics of its two vertices. Returns false, adding nothing, if the
+ * border edges of the profile are not the ones around its vertices.
+ */
+static bool add_volume_and_boundary_quadrics(const LindstromTurk_param &params, const SMS::Edge_profile<Surface_mesh>& profile, const Surface_mesh::Property_map<Surface_mesh::Vertex_index, Vertex_quadric> &vertex_quadrics, Placement_system &system) {
+	const Surface_mesh &mesh = profile.surface_mesh();
+	const Vertex_quadric &q0 = vertex_quadrics[profile.v0()];
+	const Vertex_quadric &q1 = vertex_quadrics[profile.v1()];
+	Eigen::Vector3d p0 = to_eigen(profile.p0());
+	Eigen::Vector3d p1 = to_eigen(profile.p1());
+
+	// Faces and border edge counted by both vertices, relative to origin
+	Vertex_quadric shared;
+	auto edge = mesh.edge(profile.v0_v1());
+	if (params.volume_preservation > 0 || params.volume_optimisation > 0) {
+		if (profile.left_face_exists()) add_face_terms(params, mesh, mesh.face(profile.v0_v1()), system.origin, shared);
+		if (profile.right_face_exists()) add_face_terms(params, mesh, mesh.face(profile.v1_v0()), system.origin, shared);
+	}
+	if ((params.boundary_preservation > 0 || params.boundary_optimization > 0) && mesh.is_border(edge)) {
+		add_border_terms(params, mesh, profile.v0_v1(), system.origin, shared);
+	}
+	std::size_t border_edges = q0.border_edges + q1.border_edges - shared.border_edges;
+	if ((params.boundary_preservation > 0 || params.boundary_optimization > 0) && border_edges != profile.border_edges().size()) return false;
+
+	system.add_quadric(q0, p0, 1);
+	system.add_quadric(q1, p1, 1);
+	system.add_quadric(shared, system.origin, -1);
+
+	Eigen::Vector3d d0 = system.origin - p0;
+	Eigen::Vector3d d1 = system.origin - p1;
+
+	// Volume preservation
+	if (params.volume_preservation > 0) {
+		Eigen::Vector3d n0 (q0.normal[0], q0.normal[1], q0.normal[2]);
+		Eigen::Vector3d n1 (q1.normal[0], q1.normal[1], q1.normal[2]);
+		Eigen::Vector3d ns (shared.normal[0], shared.normal[1], shared.normal[2]);
+		Eigen::Vector3d n = n0 + n1 - ns;
+		double det = (q0.det - n0.dot(d0)) + (q1.det - n1.dot(d1)) - shared.det;
+		system.add_local_row(n / 3 * params.volume_preservation, det / 3 * params.volume_preservation);
+	}
+
+	// Boundary preservation
+	if (params.boundary_preservation > 0 && border_edges > 0) {
+		Eigen::Vector3d e1_0 (q0.e1[0], q0.e1[1], q0.e1[2]);
+		Eigen::Vector3d e1_1 (q1.e1[0], q1.e1[1], q1.e1[2]);
+		Eigen::Vector3d e1 = e1_0 + e1_1 - Eigen::Vector3d(shared.e1[0], shared.e1[1], shared.e1[2]);
+		// (a - d) x (b - d) = a x b - (a - b) x d
+		Eigen::Vector3d e2 = (Eigen::Vector3d(q0.e2[0], q0.e2[1], q0.e2[2]) - e1_0.cross(d0)) + (Eigen::Vector3d(q1.e2[0], q1.e2[1], q1.e2[2]) - e1_1.cross(d1)) - Eigen::Vector3d(shared.e2[0], shared.e2[1], shared.e2[2]);
+		double w = params.boundary_preservation / 2;
+		system.add_local_row(Eigen::Vector3d(0, -e1.z(), e1.y()) * w, e2.x() * w);
+		system.add_local_row(Eigen::Vector3d(e1.z(), 0, -e1.x()) * w, e2.y() * w);
+		system.add_local_row(Eigen::Vector3d(-e1.y(), e1.x(), 0) * w, e2.z() * w);
+	}
+
+	return true;
+}
+
+// Adds the volume and boundary rows of the profile to system, from the quadrics if they are up to date
+static void add_volume_and_boundary_terms(const LindstromTurk_param &params, const SMS::Edge_profile<Surface_mesh>& profile, const Collapse_properties &properties, Collapse_scratch &scratch, Placement_system &system) {
+	if (!has_volume_or_boundary_terms(params)) return;
+	if (properties.has_vertex_quadrics && add_volume_and_boundary_quadrics(params, profile, properties.vertex_quadrics, system)) return;
+
+	auto &r1 = scratch.volume;
+	r1.clear();
+	if (params.volume_preservation > 0 || params.volume_optimisation > 0) volume_preservation_and_optimisation(profile, r1);
+	auto &r2 = scratch.boundary;
+	r2.clear();
+	if (params.boundary_preservation > 0 || params.boundary_optimization > 0) boundary_preservation_and_optimisation(profile, r2);
+	auto &rows = scratch.rows;
+	rows.clear();
+	add_volume_and_boundary_rows(params, r1, r2, rows);
+	for (const auto &row: rows) system.add_row(row[0], row[1], row[2], row[3]);
+}
+
+// Quadrics of v and its neighbours, whose faces changed when v was created
+static void update_vertex_quadrics(const LindstromTurk_param &params, const Surface_mesh &mesh, Surface_mesh::Property_map<Surface_mesh::Vertex_index, Vertex_quadric> &vertex_quadrics, Surface_mesh::Vertex_index v) {
+	vertex_quadrics[v] = vertex_quadric(params, mesh, v);
+	for (const auto &u: mesh.vertices_around_target(mesh.halfedge(v))) vertex_quadrics[u] = vertex_quadric(params, mesh, u);
+}
+
+boost::optional<SMS::Edge_profile<Surface_mesh>::Point> Custom_placement::operator()(const SMS::Edge_profile<Surface_mesh>& profile) const {
+#ifdef COUNT_ALLOCATIONS
+	Evaluation_scope evaluation_scope;
+#endif
+
+	{
+		const CollapseData &collapse_data = collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())];
+		if (collapse_data.precomputed && collapse_data.precomputed_halfedge == profile.v0_v1()) return collapse_data.precomputed_placement;
+	}
+
+	if (!properties.ready) prepare(profile.surface_mesh());
+	return (this->*evaluation)(profile);
+}
+
+template <unsigned Terms>
+boost::optional<SMS::Edge_profile<Surface_mesh>::Point> Custom_placement::place(const SMS::Edge_profile<Surface_mesh>& profile) const {
+	typedef boost::optional<SMS::Edge_profile<Surface_mesh>::Point> result_type;
+
+	Collapse_scratch &scratch = collapse_scratch();
+
+	auto &r3 = scratch.shape;
+	r3.clear();
+	if constexpr ((Terms & PLACEMENT_SHAPE) != 0) triangle_shape_optimization(profile, r3);
+	auto &r4 = scratch.label;
+	r4.clear();
+	if constexpr ((Terms & PLACEMENT_LABEL) != 0) label_preservation(profile, point_cloud, ablation, properties, scratch);
+	auto &r5 = scratch.semantic_border;
+	r5.clear();
+	if constexpr ((Terms & PLACEMENT_SEMANTIC_BORDER) != 0) {
+		if (r4.size() < 3) semantic_border_optimization(profile, properties, r5);
+	}
+
+	// Normal equations of the over-determined system AX=B
+	Placement_system system (profile.p0());
+	auto add_row = [&system](double a0, double a1, double a2, double b) {
+		system.add_row(a0, a1, a2, b);
+	};
+
+	add_volume_and_boundary_terms(params, profile, properties, scratch, system);
 
 	// Triange shape optimisation
-	if (params.triangle_shape_optimization > 0) {
+	if constexpr ((Terms & PLACEMENT_SHAPE) != 0) {
 		for (const auto &vpo: r3) {
-			A.set(i, 0, params.triangle_shape_optimization);
-			A.set(i, 1, 0);
-			A.set(i, 2, 0);
-			B.set(i++, vpo.x()*params.triangle_shape_optimization);
-			A.set(i, 0, 0);
-			A.set(i, 1, params.triangle_shape_optimization);
-			A.set(i, 2, 0);
-			B.set(i++, vpo.y()*params.triangle_shape_optimization);
-			A.set(i, 0, 0);
-			A.set(i, 1, 0);
-			A.set(i, 2, params.triangle_shape_optimization);
-			B.set(i++, vpo.z()*params.triangle_shape_optimization);
+			add_row(params.triangle_shape_optimization, 0, 0, vpo.x()*params.triangle_shape_optimization);
+			add_row(0, params.triangle_shape_optimization, 0, vpo.y()*params.triangle_shape_optimization);
+			add_row(0, 0, params.triangle_shape_optimization, vpo.z()*params.triangle_shape_optimization);
 		}
 	}
 
 	// Label preservation
-	if (params.label_preservation > 0) {
+	if constexpr ((Terms & PLACEMENT_LABEL) != 0) {
 		for (const auto &vpo: r4) {
-			A.set(i, 0, vpo.first.x()*params.label_preservation);
-			A.set(i, 1, vpo.first.y()*params.label_preservation);
-			A.set(i, 2, vpo.first.z()*params.label_preservation);
-			B.set(i++, vpo.second*params.label_preservation);
+			add_row(vpo.first.x()*params.label_preservation, vpo.first.y()*params.label_preservation, vpo.first.z()*params.label_preservation, vpo.second*params.label_preservation);
 		}
 	}
 
 	// Semantic border optimization
-	if (params.semantic_border_optimization > 0 && r4.size() < 3) {
+	if constexpr ((Terms & PLACEMENT_SEMANTIC_BORDER) != 0) {
 		for (const auto &vpo: r5) {
-			A.set(i, 0, params.semantic_border_optimization);
-			A.set(i, 1, 0);
-			A.set(i, 2, 0);
-			B.set(i++, vpo.x()*params.semantic_border_optimization);
-			A.set(i, 0, 0);
-			A.set(i, 1, params.semantic_border_optimization);
-			A.set(i, 2, 0);
-			B.set(i++, vpo.y()*params.semantic_border_optimization);
-			A.set(i, 0, 0);
-			A.set(i, 1, 0);
-			A.set(i, 2, params.semantic_border_optimization);
-			B.set(i++, vpo.z()*params.semantic_border_optimization);
+			add_row(params.semantic_border_optimization, 0, 0, vpo.x()*params.semantic_border_optimization);
+			add_row(0, params.semantic_border_optimization, 0, vpo.y()*params.semantic_border_optimization);
+			add_row(0, 0, params.semantic_border_optimization, vpo.z()*params.semantic_border_optimization);
 		}
 	}
 
-	// Solve AX=B
-	auto C = B;
-	CGAL::Eigen_svd::solve(A, B);
-
-	auto R = A*B - C;
+	Eigen::Vector3d X;
+	double squared_residual = system.solve(X);
 
 // if (profile.v0().idx() == 6984 && profile.v1().idx() == 7620) { // save cost detail
 // 	std::ofstream outfile;
@@ -1477,33 +1917,123 @@ boost::optional<SMS::Edge_profile<Surface_mesh>::Point> Custom_placement::operat
 // 		outfile << "edge " << profile.v1().idx() << " -> " << profile.v0().idx() << ":\n";
 // 	}
 // 	outfile << "1 - " << r1.size() << " - 3 - " << (3*r2.size()) << " - " << (3*r3.size()) << " - " << r4.size() << " - " << (3*r5.size()) << "\n";
-// 	outfile << "A:\n" << A << "\n";
-// 	outfile << "B:\n" << C << "\n";
-// 	outfile << "R:\n" << R << "\n";
+// 	for (const auto &row: rows) outfile << row[0] << " " << row[1] << " " << row[2] << " = " << row[3] << "\n";
+// 	outfile << "R: " << squared_residual << "\n";
 // }
 
 	// Save cost
-	Point_3 placement(B.vector()[0], B.vector()[1], B.vector()[2]);
-	collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())].placement_cost = (R.transpose()*R)(0,0);
+	Point_3 placement(X[0], X[1], X[2]);
+	collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())].placement_cost = squared_residual;
 
 	return result_type(placement);
 }
 
+// Every combination of the terms is instantiated, indexed by its Cost_term mask
+template <std::size_t... Terms>
+Custom_cost::Evaluation Custom_cost::evaluation_for(unsigned terms, std::index_sequence<Terms...>) {
+	static const Evaluation evaluations[] = {&Custom_cost::evaluate<Terms>...};
+	return evaluations[terms];
+}
+
 Custom_cost::Custom_cost (const LindstromTurk_param &params, const K::FT alpha, const K::FT beta, const K::FT gamma, const K::FT delta, const K::FT min_point_per_area, Surface_mesh &mesh, const Point_set &point_cloud, char *next_mesh) : params(params), alpha(alpha), beta(beta), gamma(gamma), delta(delta), min_point_per_area(min_point_per_area), point_cloud(point_cloud), next_mesh(next_mesh) {
 	bool created_collapse_datas;
 	boost::tie(collapse_datas, created_collapse_datas) = mesh.add_property_map<Surface_mesh::Edge_index, CollapseData>("e:c_datas");
+
+	unsigned terms = 0;
+	if (alpha > 0) terms |= COST_DISTANCE;
+	if (beta > 0) terms |= COST_SEMANTIC;
+	if (gamma > 0) terms |= COST_SEMANTIC_BORDER;
+	if (params.semantic_border_optimization > 0) terms |= COST_BORDER_OPTIMIZATION;
+	evaluation = evaluation_for(terms, std::make_index_sequence<COST_TERMS + 1>());
+}
+
+void Custom_cost::prepare(const Surface_mesh &mesh) const {
+	properties.prepare(mesh, point_cloud);
+}
+
+// Faces around the new vertex C after the collapse, with the halfedge of
+// their outer edge and their normal (CGAL::orthogonal_vector). False if
+// there is none or if two adjacent ones make an angle above 135°, the cost
+// of the edge is none then.
+static bool build_new_faces(const SMS::Edge_profile<Surface_mesh>& profile, const Point_3 &C, std::vector<K::Triangle_3> &new_faces, std::vector<Surface_mesh::Halfedge_index> &new_faces_border_halfedge, std::vector<K::Vector_3> &new_face_normals) {
+	new_faces.clear();
+	new_faces_border_halfedge.clear();
+	new_face_normals.clear();
+	for (std::size_t face_id = 0; face_id < profile.link().size(); face_id++) {
+		auto he = profile.surface_mesh().halfedge(profile.link()[face_id], profile.link()[(face_id + 1) % profile.link().size()]);
+		if (he != Surface_mesh::null_halfedge() && !profile.surface_mesh().is_border(he)) {
+			Point_3 A = get(profile.vertex_point_map(), profile.link()[face_id]);
+			Point_3 B = get(profile.vertex_point_map(), profile.link()[(face_id + 1) % profile.link().size()]);
+			new_faces.push_back(K::Triangle_3(A, B, C));
+			new_faces_border_halfedge.push_back(he);
+			new_face_normals.push_back(CGAL::orthogonal_vector(A, B, C));
+		}
+	}
+
+	if (new_faces.size() == 0) return false;
+
+	//Check for angle between faces lower than 135°
+	for (std::size_t face_id = 0; face_id < new_faces.size(); face_id++) {
+		if (new_faces[face_id].vertex(1) == new_faces[(face_id + 1) % new_faces.size()].vertex(0)) {
+			if (CGAL::approximate_angle(new_face_normals[face_id], new_face_normals[(face_id + 1) % new_faces.size()]) > 135) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Area of a new face from its normal, as CGAL::sqrt(new_faces[face_id].squared_area())
+static K::FT new_face_area(const K::Vector_3 &normal) {
+	return CGAL::sqrt(normal.squared_length() / 4);
 }
 
 boost::optional<SMS::Edge_profile<Surface_mesh>::FT> Custom_cost::operator()(const SMS::Edge_profile<Surface_mesh>& profile, const boost::optional<SMS::Edge_profile<Surface_mesh>::Point>& placement) const {
+	{
+		CollapseData &collapse_data = collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())];
+		if (collapse_data.precomputed) {
+			collapse_data.precomputed = false;
+			if (collapse_data.precomputed_halfedge == profile.v0_v1()) return collapse_data.precomputed_cost;
+		}
+	}
+
+#ifdef COUNT_ALLOCATIONS
+	Evaluation_scope evaluation_scope;
+	Evaluation_statistics::evaluations.fetch_add(1, std::memory_order_relaxed);
+#endif
+
+	if (!properties.ready) prepare(profile.surface_mesh());
+	auto cost = (this->*evaluation)(profile, placement);
+	if (on_commit) collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())].release();
+	return cost;
+}
+
+void Custom_cost::compute_on_commit() {
+	on_commit = true;
+}
+
+void Custom_cost::commit(const SMS::Edge_profile<Surface_mesh>& profile, const boost::optional<SMS::Edge_profile<Surface_mesh>::Point>& placement) const {
+	if (!properties.ready) prepare(profile.surface_mesh());
+	(this->*evaluation)(profile, placement);
+}
+
+template <unsigned Terms>
+boost::optional<SMS::Edge_profile<Surface_mesh>::FT> Custom_cost::evaluate(const SMS::Edge_profile<Surface_mesh>& profile, const boost::optional<SMS::Edge_profile<Surface_mesh>::Point>& placement) const {
 	typedef boost::optional<SMS::Edge_profile<Surface_mesh>::FT> result_type;
 	CGAL::Cartesian_converter<Point_set_kernel,K> type_converter;
 
-	Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> face_costs;
-	bool has_face_costs;
-	boost::tie(face_costs, has_face_costs) = profile.surface_mesh().property_map<Surface_mesh::Face_index, K::FT>("f:cost");
-	assert(has_face_costs);
+	// The new faces are labelled
+	constexpr bool labelled = (Terms & (COST_SEMANTIC | COST_SEMANTIC_BORDER | COST_BORDER_OPTIMIZATION)) != 0;
+
+	Collapse_scratch &scratch = collapse_scratch();
 
-	collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())].elements.clear();
+	assert(properties.has_face_costs);
+	const auto &face_costs = properties.face_costs;
+
+	CollapseData &collapse_data = collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())];
+	collapse_data.elements.clear();
+	collapse_data.elements_placement = boost::none;
+	collapse_data.points.clear();
 
 	if (placement) {
 
@@ -1511,123 +2041,129 @@ boost::optional<SMS::Edge_profile<Surface_mesh>::FT> Custom_cost::operator()(con
 		int count_semantic_error = 0;
 		K::FT semantic_border_length = 0;
 		K::FT old_cost = 0;
-		if (alpha > 0 || beta > 0 || gamma > 0 || params.semantic_border_optimization > 0) {
+		if constexpr ((Terms & COST_DISTANCE) != 0 || labelled) {
 
-			Surface_mesh::Property_map<Surface_mesh::Face_index, std::list<Point_set::Index>> point_in_face;
-			bool has_point_in_face;
-			boost::tie(point_in_face, has_point_in_face) = profile.surface_mesh().property_map<Surface_mesh::Face_index, std::list<Point_set::Index>>("f:points");
-			assert(has_point_in_face);
+			assert(properties.has_point_in_face);
+			const auto &point_in_face = properties.point_in_face;
 
-			std::set<Point_set::Index> points_to_be_change;
+			// Sorted and without duplicates, as the set it replaces
+			auto &points_to_be_change = scratch.points;
+			points_to_be_change.clear();
 			for (const auto &face: profile.triangles()) {
 				auto fh = profile.surface_mesh().face(profile.surface_mesh().halfedge(face.v0, face.v1));
-				points_to_be_change.insert(point_in_face[fh].begin(), point_in_face[fh].end());
+				points_to_be_change.insert(points_to_be_change.end(), point_in_face[fh].begin(), point_in_face[fh].end());
 				old_cost += face_costs[fh];
 // std::cerr << "\tface " << fh << " cost\t" << face_costs[fh] << "\n";
 			}
+			std::sort(points_to_be_change.begin(), points_to_be_change.end());
+			points_to_be_change.erase(std::unique(points_to_be_change.begin(), points_to_be_change.end()), points_to_be_change.end());
 
-			std::vector<K::Triangle_3> new_faces;
-			std::vector<Surface_mesh::Halfedge_index> new_faces_border_halfedge;
+			auto &new_faces = scratch.new_faces;
+			auto &new_faces_border_halfedge = scratch.new_faces_border_halfedge;
 			Point_3 C = *placement;
-			for (std::size_t face_id = 0; face_id < profile.link().size(); face_id++) {
-				auto he = profile.surface_mesh().halfedge(profile.link()[face_id], profile.link()[(face_id + 1) % profile.link().size()]);
-				if (he != Surface_mesh::null_halfedge() && !profile.surface_mesh().is_border(he)) {
-					Point_3 A = get(profile.vertex_point_map(), profile.link()[face_id]);
-					Point_3 B = get(profile.vertex_point_map(), profile.link()[(face_id + 1) % profile.link().size()]);
-					new_faces.push_back(K::Triangle_3(A, B, C));
-					new_faces_border_halfedge.push_back(he);
-				}
-			}
+			auto &new_face_normals = scratch.new_face_normals;
+			if (!build_new_faces(profile, C, new_faces, new_faces_border_halfedge, new_face_normals)) return result_type();
 
-			if (new_faces.size() == 0) return result_type();
+			auto &new_face_cost = scratch.new_face_cost;
+			new_face_cost.assign(new_faces.size(), 0);
 
-			//Check for angle between faces lower than 135°
-			for (std::size_t face_id = 0; face_id < new_faces.size(); face_id++) {
-				if (new_faces[face_id].vertex(1) == new_faces[(face_id + 1) % new_faces.size()].vertex(0)) {
-					if (CGAL::approximate_angle(CGAL::orthogonal_vector(new_faces[face_id].vertex(0), new_faces[face_id].vertex(1), new_faces[face_id].vertex(2)), CGAL::orthogonal_vector(new_faces[(face_id + 1) % new_faces.size()].vertex(0), new_faces[(face_id + 1) % new_faces.size()].vertex(1), new_faces[(face_id + 1) % new_faces.size()].vertex(2))) > 135) {
-						return result_type();
-					}
-				}
+			// geometric error
+			auto &point_batch = scratch.point_batch;
+			point_batch.clear();
+			for (const auto &ph: points_to_be_change) point_batch.push_back(type_converter(point_cloud.point(ph)));
+			auto &triangle_batch = scratch.triangle_batch;
+			triangle_batch.assign(new_faces.begin(), new_faces.end());
+			auto &closest_faces = scratch.closest_face;
+			auto &min_ds = scratch.distances;
+			closest_faces.resize(points_to_be_change.size());
+			min_ds.resize(points_to_be_change.size());
+			if (!DistanceKernel::nearest_triangle_xy(point_batch, triangle_batch, scratch.fan, closest_faces.data(), min_ds.data())) {
+				DistanceKernel::nearest_triangle(point_batch, triangle_batch, closest_faces.data(), min_ds.data());
 			}
 
-			std::vector<K::FT> new_face_cost (new_faces.size(), 0);
-
-			// geometric error
-			std::vector<std::list<Point_set::Index>> points_in_new_face (new_faces.size());
-//std::cerr << "points_in_new_face.size: " << points_in_new_face.size() << "\n";
-			for (const auto &ph: points_to_be_change) {
-				auto point = type_converter(point_cloud.point(ph));
-				K::FT min_d = std::numeric_limits<K::FT>::max();
-				std::size_t closest_face = 0;
-				for(std::size_t face_id = 0; face_id < new_faces.size(); face_id++) {
-					auto d = CGAL::squared_distance(point, new_faces[face_id]);
-					if (d < min_d) {
-						min_d = d;
-						closest_face = face_id;
-					}
-				}
-				points_in_new_face[closest_face].push_back(ph);
-				if (alpha > 0) {
+			auto &face_offset = scratch.face_offset;
+			face_offset.assign(new_faces.size() + 1, 0);
+			for (std::size_t i = 0; i < points_to_be_change.size(); i++) {
+				K::FT min_d = min_ds[i];
+				std::size_t closest_face = closest_faces[i];
+				face_offset[closest_face + 1]++;
+				if constexpr ((Terms & COST_DISTANCE) != 0) {
 					squared_distance += min_d;
 					new_face_cost[closest_face] += alpha * min_d;
 				}
 			}
 
+			// points of the new face face_id are collapse_data.points[face_offset[face_id], face_offset[face_id+1])
+			for (std::size_t face_id = 0; face_id < new_faces.size(); face_id++) {
+				face_offset[face_id + 1] += face_offset[face_id];
+			}
+			collapse_data.points.resize(points_to_be_change.size());
+			for (std::size_t i = 0; i < points_to_be_change.size(); i++) {
+				collapse_data.points[face_offset[closest_faces[i]]++] = points_to_be_change[i];
+			}
+			for (std::size_t face_id = new_faces.size(); face_id > 0; face_id--) {
+				face_offset[face_id] = face_offset[face_id - 1];
+			}
+			face_offset[0] = 0;
+			auto points_in_new_face_size = [&face_offset](std::size_t face_id) {
+				return face_offset[face_id + 1] - face_offset[face_id];
+			};
+
 			// semantic error
-			if (beta > 0 || gamma > 0 || params.semantic_border_optimization > 0) {
-				Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> mesh_label;
-				bool has_mesh_label;
-				boost::tie(mesh_label, has_mesh_label) = profile.surface_mesh().property_map<Surface_mesh::Face_index, unsigned char>("f:label");
-				assert(has_mesh_label);
+			if constexpr (labelled) {
+				assert(properties.has_mesh_label);
+				const auto &mesh_label = properties.mesh_label;
 
-				Point_set::Property_map<unsigned char> point_cloud_label;
-				bool has_label;
-				boost::tie(point_cloud_label, has_label) = point_cloud.property_map<unsigned char>("p:label");
-				assert(has_label);
+				assert(properties.has_point_cloud_label);
+				const auto &point_cloud_label = properties.point_cloud_label;
 
-				std::vector<unsigned char> new_face_label(new_faces.size(), LABEL_UNKNOWN);
+				auto &new_face_label = scratch.new_face_label;
+				new_face_label.assign(new_faces.size(), LABEL_UNKNOWN);
 
 				// label new face and semantic error
-				std::set<std::size_t> faces_with_no_label;
+				auto &faces_with_no_label = scratch.face_with_no_label;
+				faces_with_no_label.assign(new_faces.size(), false);
+				std::size_t count_faces_with_no_label = 0;
 				for(std::size_t face_id = 0; face_id < new_faces.size(); face_id++) {
 					K::FT min_point = 0;
 					if (min_point_per_area > 0) {
-						min_point = min_point_per_area * CGAL::sqrt(new_faces[face_id].squared_area());
+						min_point = min_point_per_area * new_face_area(new_face_normals[face_id]);
 					}
-					if (points_in_new_face[face_id].size() > 0) {
+					if (points_in_new_face_size(face_id) > 0) {
 
-						if (points_in_new_face[face_id].size() > min_point) {
+						if (points_in_new_face_size(face_id) > min_point) {
 
 							int face_label[LABELS.size()] = {0};
 
-							for (const auto &point: points_in_new_face[face_id]) {
-								face_label[point_cloud_label[point]]++;
+							for (std::size_t i = face_offset[face_id]; i < face_offset[face_id + 1]; i++) {
+								face_label[point_cloud_label[collapse_data.points[i]]]++;
 							}
 
 							auto argmax = std::max_element(face_label, face_label+LABELS.size());
-							count_semantic_error += points_in_new_face[face_id].size() - *argmax;
-							new_face_cost[face_id] += beta * (points_in_new_face[face_id].size() - *argmax);
-// if (profile.v0_v1().idx() == 1710) std::cerr << "face_id: " << face_id << " (" << profile.surface_mesh().face(new_faces_border_halfedge[face_id]) << ") (beta1 x nb_error): " << beta * (points_in_new_face[face_id].size() - *argmax) << "\n";
+							count_semantic_error += points_in_new_face_size(face_id) - *argmax;
+							new_face_cost[face_id] += beta * (points_in_new_face_size(face_id) - *argmax);
 							new_face_label[face_id] = argmax - face_label;
 
 						} else { // We don't have information about this face.
 							new_face_label[face_id] = LABEL_UNKNOWN;
-							count_semantic_error += points_in_new_face[face_id].size();
-							new_face_cost[face_id] += beta * points_in_new_face[face_id].size();
-// if (profile.v0_v1().idx() == 1710) std::cerr << "face_id: " << face_id << " (" << profile.surface_mesh().face(new_faces_border_halfedge[face_id]) << ") (beta2 x nb_error): " << beta * points_in_new_face[face_id].size() << "\n";
+							count_semantic_error += points_in_new_face_size(face_id);
+							new_face_cost[face_id] += beta * points_in_new_face_size(face_id);
 						}
 					} else {
 						if (min_point <= 1) { // It's probable that there is no point
-							faces_with_no_label.insert(face_id);
+							faces_with_no_label[face_id] = true;
+							count_faces_with_no_label++;
 						} else { // We don't have information about this face.
 							new_face_label[face_id] = LABEL_UNKNOWN;
 						}
 					}
 				}
-				while(faces_with_no_label.size() > 0) {
-					std::list<std::size_t> face_to_be_removed;
+				auto &face_to_be_removed = scratch.face_to_be_removed;
+				while(count_faces_with_no_label > 0) {
+					face_to_be_removed.clear();
 
-					for (const auto &face_id: faces_with_no_label) {
+					for (std::size_t face_id = 0; face_id < new_faces.size(); face_id++) {
+						if (!faces_with_no_label[face_id]) continue;
 						K::FT face_label[LABELS.size()] = {0};
 						bool no_neighbor = true;
 						// Outside face
@@ -1638,13 +2174,13 @@ boost::optional<SMS::Edge_profile<Surface_mesh>::FT> Custom_cost::operator()(con
 						}
 						if (profile.surface_mesh().target(new_faces_border_halfedge[(face_id - 1 + new_faces_border_halfedge.size()) % new_faces_border_halfedge.size()]) == profile.surface_mesh().source(new_faces_border_halfedge[face_id])) {
 							no_neighbor = false;
-							if(faces_with_no_label.count((face_id - 1 + new_faces.size()) % new_faces.size()) == 0) {
+							if(!faces_with_no_label[(face_id - 1 + new_faces.size()) % new_faces.size()]) {
 								face_label[new_face_label[(face_id - 1 + new_faces.size()) % new_faces.size()]] += CGAL::sqrt(CGAL::squared_distance(new_faces[face_id].vertex(0), C));
 							}
 						}
 						if (profile.surface_mesh().source(new_faces_border_halfedge[(face_id + 1) % new_faces_border_halfedge.size()]) == profile.surface_mesh().target(new_faces_border_halfedge[face_id])) {
 							no_neighbor = false;
-							if(faces_with_no_label.count((face_id + 1) % new_faces.size()) == 0) {
+							if(!faces_with_no_label[(face_id + 1) % new_faces.size()]) {
 								face_label[new_face_label[(face_id + 1) % new_faces.size()]] += CGAL::sqrt(CGAL::squared_distance(new_faces[face_id].vertex(1), C));
 							}
 						}
@@ -1660,20 +2196,19 @@ boost::optional<SMS::Edge_profile<Surface_mesh>::FT> Custom_cost::operator()(con
 						}
 					}
 					for (const auto &face_id: face_to_be_removed) {
-						faces_with_no_label.erase(face_id);
+						faces_with_no_label[face_id] = false;
+						count_faces_with_no_label--;
 					}
 					if (face_to_be_removed.size() == 0) {
-						for (const auto &face_id: faces_with_no_label) {
-							new_face_label[face_id] = LABEL_UNKNOWN;
+						for (std::size_t face_id = 0; face_id < new_faces.size(); face_id++) {
+							if (faces_with_no_label[face_id]) new_face_label[face_id] = LABEL_UNKNOWN;
 						}
 						break;
-					} else {
-						face_to_be_removed.clear();
 					}
 				}
 
 				// semantic border length error
-				if (gamma > 0) {
+				if constexpr ((Terms & COST_SEMANTIC_BORDER) != 0) {
 					for (const auto &h: profile.surface_mesh().halfedges_around_target(profile.v1_v0())) {
 						if (!profile.surface_mesh().is_border(Surface_mesh::Edge_index(h))) {
 							if (mesh_label[profile.surface_mesh().face(h)] != mesh_label[profile.surface_mesh().face(profile.surface_mesh().opposite(h))]) {
@@ -1713,15 +2248,15 @@ boost::optional<SMS::Edge_profile<Surface_mesh>::FT> Custom_cost::operator()(con
 					}
 				}
 
-				collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())].elements.reserve(new_faces.size());
 				for(std::size_t face_id = 0; face_id < new_faces.size(); face_id++) {
 					CollapseDataElement r;
 					r.halfedge = new_faces_border_halfedge[face_id];
 					r.label = new_face_label[face_id];
 					r.cost = new_face_cost[face_id];
-					r.points.reserve(points_in_new_face[face_id].size());
-					for (const auto &ph: points_in_new_face[face_id]) r.points.push_back(ph);
-					collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())].elements.push_back(r);
+					r.normal = new_face_normals[face_id];
+					r.points_begin = face_offset[face_id];
+					r.points_end = face_offset[face_id + 1];
+					collapse_data.elements.push_back(r);
 				}
 
 				if (next_mesh != nullptr) {
@@ -1771,24 +2306,25 @@ boost::optional<SMS::Edge_profile<Surface_mesh>::FT> Custom_cost::operator()(con
 					mesh_ofile.close();
 				}
 			} else {
-				collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())].elements.reserve(new_faces.size());
 				for(std::size_t face_id = 0; face_id < new_faces.size(); face_id++) {
 					CollapseDataElement r;
 					r.halfedge = new_faces_border_halfedge[face_id];
 					r.cost = new_face_cost[face_id];
-					r.points.reserve(points_in_new_face[face_id].size());
-					for (const auto &ph: points_in_new_face[face_id]) r.points.push_back(ph);
-					collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())].elements.push_back(r);
+					r.normal = new_face_normals[face_id];
+					r.points_begin = face_offset[face_id];
+					r.points_end = face_offset[face_id + 1];
+					collapse_data.elements.push_back(r);
 				}
 			}
+			collapse_data.elements_placement = C;
 		}
 
 		// std::cerr << "\tcost_explain detail " << profile.v0_v1() << "\t" << old_cost << "\t" << squared_distance << "\t" << count_semantic_error << "\n";
 		// std::cerr << "\tcost_explain total " << profile.v0_v1() << "\t" << (- old_cost + alpha * squared_distance + beta * count_semantic_error) << "\t" << (gamma * semantic_border_length) << "\t" << (delta * collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())].placement_cost) << "\n";
 
-		K::FT final_cost = - old_cost + alpha * squared_distance + beta * count_semantic_error + gamma * semantic_border_length + delta * collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())].placement_cost;
+		K::FT final_cost = - old_cost + alpha * squared_distance + beta * count_semantic_error + gamma * semantic_border_length + delta * collapse_data.placement_cost;
 
-		collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())].cost = final_cost;
+		collapse_data.cost = final_cost;
 
 		return result_type(final_cost);
 	}
@@ -1796,6 +2332,308 @@ boost::optional<SMS::Edge_profile<Surface_mesh>::FT> Custom_cost::operator()(con
 	return result_type();
 }
 
+// Relative margin of lower_bound, above the rounding errors of the float sums of the cost
+const K::FT LOWER_BOUND_MARGIN = 1e-4;
+
+// Length of the semantic borders around the edge that its collapse can remove
+static K::FT removable_semantic_border_length(const SMS::Edge_profile<Surface_mesh>& profile, const Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> &mesh_label) {
+	const Surface_mesh &mesh = profile.surface_mesh();
+	auto is_semantic_border = [&](Surface_mesh::Halfedge_index h) {
+		return !mesh.is_border(Surface_mesh::Edge_index(h)) && mesh_label[mesh.face(h)] != mesh_label[mesh.face(mesh.opposite(h))];
+	};
+	auto length = [&](Surface_mesh::Halfedge_index h) {
+		return CGAL::sqrt(CGAL::squared_distance(get(profile.vertex_point_map(), mesh.source(h)), get(profile.vertex_point_map(), mesh.target(h))));
+	};
+	K::FT border_length = 0;
+	for (const auto &h: mesh.halfedges_around_target(profile.v1_v0())) {
+		if (is_semantic_border(h)) border_length += length(h);
+	}
+	for (const auto &h: mesh.halfedges_around_target(profile.v0_v1())) {
+		if (h != profile.v0_v1() && is_semantic_border(h)) border_length += length(h);
+	}
+	for (std::size_t i = 0; i < profile.link().size(); i++) {
+		auto h = mesh.halfedge(profile.link()[i], profile.link()[(i + 1) % profile.link().size()]);
+		if (h != Surface_mesh::null_halfedge() && !mesh.is_border(h) && !mesh.is_border(mesh.opposite(h)) && is_semantic_border(h)) border_length += length(h);
+	}
+	return border_length;
+}
+
+K::FT Custom_cost::lower_bound(const SMS::Edge_profile<Surface_mesh>& profile) const {
+	if (!properties.ready) prepare(profile.surface_mesh());
+	Collapse_scratch &scratch = collapse_scratch();
+	const Surface_mesh &mesh = profile.surface_mesh();
+
+	K::FT old_cost = 0;
+	K::FT border_length = 0;
+	if (alpha > 0 || beta > 0 || gamma > 0 || params.semantic_border_optimization > 0) {
+		assert(properties.has_face_costs);
+		const auto &face_costs = properties.face_costs;
+		for (const auto &face: profile.triangles()) {
+			old_cost += face_costs[mesh.face(mesh.halfedge(face.v0, face.v1))];
+		}
+
+		// At best, every semantic border around the edge disappears
+		if (gamma > 0) {
+			assert(properties.has_mesh_label);
+			border_length = removable_semantic_border_length(profile, properties.mesh_label);
+		}
+	}
+
+	// The residual of the whole system of Custom_placement is at least the one of its volume and boundary rows
+	double placement_cost = 0;
+	if (delta > 0 && has_volume_or_boundary_terms(params)) {
+		Placement_system system (profile.p0());
+		add_volume_and_boundary_terms(params, profile, properties, scratch, system);
+		Eigen::Vector3d X;
+		placement_cost = system.solve(X);
+	}
+
+	K::FT bound = - old_cost - gamma * border_length + delta * placement_cost;
+	return bound - LOWER_BOUND_MARGIN * (old_cost + gamma * border_length + delta * placement_cost);
+}
+
+// Standard deviations on each side of the sampled estimate of Custom_cost::estimate
+const double ESTIMATE_DEVIATIONS = 3;
+
+boost::optional<Cost_estimate> Custom_cost::estimate(const SMS::Edge_profile<Surface_mesh>& profile, const boost::optional<SMS::Edge_profile<Surface_mesh>::Point>& placement, std::size_t sample_size) const {
+	if (!placement || !(alpha > 0 || beta > 0 || gamma > 0 || params.semantic_border_optimization > 0)) return boost::none;
+	if (!properties.ready) prepare(profile.surface_mesh());
+	Collapse_scratch &scratch = collapse_scratch();
+	const Surface_mesh &mesh = profile.surface_mesh();
+
+	assert(properties.has_face_costs);
+	const auto &face_costs = properties.face_costs;
+	assert(properties.has_point_in_face);
+	const auto &point_in_face = properties.point_in_face;
+
+	K::FT old_cost = 0;
+	std::size_t point_count = 0;
+	for (const auto &face: profile.triangles()) {
+		auto fh = mesh.face(mesh.halfedge(face.v0, face.v1));
+		old_cost += face_costs[fh];
+		point_count += point_in_face[fh].size();
+	}
+	if (point_count <= sample_size) return boost::none;
+
+	auto &new_faces = scratch.new_faces;
+	auto &new_faces_border_halfedge = scratch.new_faces_border_halfedge;
+	Point_3 C = *placement;
+	auto &new_face_normals = scratch.new_face_normals;
+	if (!build_new_faces(profile, C, new_faces, new_faces_border_halfedge, new_face_normals)) return boost::none;
+
+	// Systematic sample of the points of each old face, the strata, in proportion to their number of points
+	auto &sample = scratch.sample;
+	auto &sample_stratum = scratch.sample_stratum;
+	auto &strata = scratch.strata;
+	sample.clear();
+	sample_stratum.clear();
+	strata.clear();
+	for (const auto &face: profile.triangles()) {
+		const auto &points = point_in_face[mesh.face(mesh.halfedge(face.v0, face.v1))];
+		if (points.size() == 0) continue;
+		std::size_t n = std::min(points.size(), std::max<std::size_t>(2, std::llround((double) sample_size * points.size() / point_count)));
+		double stride = (double) points.size() / n;
+		std::size_t position = 0;
+		auto it = points.begin();
+		for (std::size_t k = 0; k < n; k++) {
+			std::size_t next = (std::size_t) ((k + 0.5) * stride);
+			std::advance(it, next - position);
+			position = next;
+			sample.push_back(*it);
+			sample_stratum.push_back(strata.size());
+		}
+		strata.push_back(std::make_pair(points.size(), n));
+	}
+
+	CGAL::Cartesian_converter<Point_set_kernel,K> type_converter;
+	auto &point_batch = scratch.point_batch;
+	point_batch.clear();
+	for (const auto &ph: sample) point_batch.push_back(type_converter(point_cloud.point(ph)));
+	auto &triangle_batch = scratch.triangle_batch;
+	triangle_batch.assign(new_faces.begin(), new_faces.end());
+	auto &closest_faces = scratch.closest_face;
+	auto &min_ds = scratch.distances;
+	closest_faces.resize(sample.size());
+	min_ds.resize(sample.size());
+	if (!DistanceKernel::nearest_triangle_xy(point_batch, triangle_batch, scratch.fan, closest_faces.data(), min_ds.data())) {
+		DistanceKernel::nearest_triangle(point_batch, triangle_batch, closest_faces.data(), min_ds.data());
+	}
+
+	// Label of each new face from the weighted sample, and its estimated number of points
+	auto &new_face_label = scratch.new_face_label;
+	auto &new_face_points = scratch.new_face_cost;
+	auto &label_weights = scratch.label_weights;
+	bool semantic = beta > 0;
+	if (semantic) {
+		assert(properties.has_point_cloud_label);
+		const auto &point_cloud_label = properties.point_cloud_label;
+		new_face_points.assign(new_faces.size(), 0);
+		label_weights.assign(new_faces.size() * LABELS.size(), 0);
+		for (std::size_t i = 0; i < sample.size(); i++) {
+			K::FT weight = (K::FT) strata[sample_stratum[i]].first / strata[sample_stratum[i]].second;
+			new_face_points[closest_faces[i]] += weight;
+			label_weights[closest_faces[i] * LABELS.size() + point_cloud_label[sample[i]]] += weight;
+		}
+		new_face_label.assign(new_faces.size(), LABEL_UNKNOWN);
+		for (std::size_t face_id = 0; face_id < new_faces.size(); face_id++) {
+			K::FT min_point = 0;
+			if (min_point_per_area > 0) {
+				min_point = min_point_per_area * new_face_area(new_face_normals[face_id]);
+			}
+			// Every point is a semantic error on a face with too few points
+			if (new_face_points[face_id] > min_point) {
+				auto weights = label_weights.begin() + face_id * LABELS.size();
+				new_face_label[face_id] = std::max_element(weights, weights + LABELS.size()) - weights;
+			}
+		}
+	}
+
+	// Stratified estimate of the sum of alpha * distance + beta * semantic error over the points
+	auto &sums = scratch.stratum_sums;
+	sums.assign(2 * strata.size(), 0);
+	for (std::size_t i = 0; i < sample.size(); i++) {
+		double y = alpha * min_ds[i];
+		if (semantic && new_face_label[closest_faces[i]] != properties.point_cloud_label[sample[i]]) y += beta;
+		sums[2 * sample_stratum[i]] += y;
+		sums[2 * sample_stratum[i] + 1] += y * y;
+	}
+	double total = 0;
+	double variance = 0;
+	for (std::size_t h = 0; h < strata.size(); h++) {
+		double N = strata[h].first;
+		double n = strata[h].second;
+		double mean = sums[2 * h] / n;
+		total += N * mean;
+		// A stratum sampled entirely is exact
+		if (n < N) variance += N * N * (1 - n / N) * std::max(0., (sums[2 * h + 1] - n * mean * mean) / (n - 1)) / n;
+	}
+	double deviation = ESTIMATE_DEVIATIONS * std::sqrt(variance);
+
+	// The semantic border term is only bounded: every border around the edge can disappear, every new edge can become one
+	K::FT removable_border = 0;
+	K::FT new_border = 0;
+	if (gamma > 0) {
+		assert(properties.has_mesh_label);
+		removable_border = removable_semantic_border_length(profile, properties.mesh_label);
+		for (const auto &t: new_faces) {
+			new_border += CGAL::sqrt(CGAL::squared_distance(t.vertex(0), t.vertex(1))) + CGAL::sqrt(CGAL::squared_distance(t.vertex(0), C));
+		}
+	}
+
+	K::FT placement_cost = delta * collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())].placement_cost;
+	Cost_estimate result;
+	result.low = - old_cost + (total - deviation) - gamma * removable_border + placement_cost;
+	result.high = - old_cost + (total + deviation) + gamma * new_border + placement_cost;
+	return result;
+}
+
+void precompute_collapse_datas(Surface_mesh &mesh, const Custom_placement &placement, const Custom_cost &cost) {
+	Surface_mesh::Property_map<Surface_mesh::Edge_index, CollapseData> collapse_datas;
+	bool has_collapse_datas;
+	boost::tie(collapse_datas, has_collapse_datas) = mesh.property_map<Surface_mesh::Edge_index, CollapseData>("e:c_datas");
+	assert(has_collapse_datas);
+
+	// The lazy lookup of the first evaluation is not thread safe
+	placement.prepare(mesh);
+	cost.prepare(mesh);
+
+	// Same halfedge per edge and same border flag as the collection of SMS::edge_collapse
+	std::vector<Surface_mesh::Halfedge_index> halfedges;
+	halfedges.reserve(mesh.number_of_edges());
+	for (const auto &edge: mesh.edges()) halfedges.push_back(mesh.halfedge(edge));
+	bool has_border = false;
+	for (const auto &h: mesh.halfedges()) {
+		if (mesh.is_border(h)) {
+			has_border = true;
+			break;
+		}
+	}
+
+	const Surface_mesh &const_mesh = mesh;
+	auto vpm = get(CGAL::vertex_point, const_mesh);
+	K traits;
+
+	// Each evaluation only writes the collapse data of its own edge
+	ParallelUtils::for_each_index(halfedges.size(), [&](std::size_t i) {
+		CollapseData &collapse_data = collapse_datas[Surface_mesh::Edge_index(halfedges[i])];
+		collapse_data.precomputed = false;
+
+		SMS::Edge_profile<Surface_mesh> profile (halfedges[i], const_mesh, traits, vpm, has_border);
+		auto p = placement(profile);
+		auto c = cost(profile, p);
+
+		collapse_data.precomputed_halfedge = halfedges[i];
+		collapse_data.precomputed_placement = p;
+		collapse_data.precomputed_cost = c;
+		collapse_data.precomputed = true;
+	});
+}
+
+void CollapseData::release() {
+	std::vector<CollapseDataElement>().swap(elements);
+	std::vector<Point_set::Index>().swap(points);
+	elements_placement = boost::none;
+}
+
+void discard_precomputed_collapse_datas(Surface_mesh &mesh) {
+	Surface_mesh::Property_map<Surface_mesh::Edge_index, CollapseData> collapse_datas;
+	bool has_collapse_datas;
+	boost::tie(collapse_datas, has_collapse_datas) = mesh.property_map<Surface_mesh::Edge_index, CollapseData>("e:c_datas");
+	if (!has_collapse_datas) return;
+
+	for (const auto &edge: mesh.edges()) {
+		collapse_datas[edge].precomputed = false;
+	}
+}
+
+bool is_normal_change_bounded(const SMS::Edge_profile<Surface_mesh>& profile, const Point_3 &placement) {
+	const Surface_mesh &mesh = profile.surface_mesh();
+
+	// Looked up on each call, the filter is shared by the threads of the parallel engines
+	Surface_mesh::Property_map<Surface_mesh::Face_index, K::Vector_3> face_normals;
+	bool has_face_normals;
+	boost::tie(face_normals, has_face_normals) = mesh.property_map<Surface_mesh::Face_index, K::Vector_3>("f:normal");
+
+	if (has_face_normals) {
+		Surface_mesh::Property_map<Surface_mesh::Edge_index, CollapseData> collapse_datas;
+		bool has_collapse_datas;
+		boost::tie(collapse_datas, has_collapse_datas) = mesh.property_map<Surface_mesh::Edge_index, CollapseData>("e:c_datas");
+		if (has_collapse_datas) {
+			const CollapseData &collapse_data = collapse_datas[Surface_mesh::Edge_index(profile.v0_v1())];
+			bool cached = collapse_data.elements_placement && *collapse_data.elements_placement == placement && collapse_data.elements.size() > 0;
+			for (const auto &element: collapse_data.elements) {
+				if (!cached) break;
+				if (mesh.is_removed(element.halfedge) || mesh.is_border(element.halfedge)) cached = false;
+			}
+			if (cached) {
+				for (const auto &element: collapse_data.elements) {
+					if (!(face_normals[mesh.face(element.halfedge)] * element.normal > 0)) return false;
+				}
+				return true;
+			}
+		}
+	}
+
+	for (const auto &v: {profile.v0(), profile.v1()}) {
+		auto other = (v == profile.v0()) ? profile.v1() : profile.v0();
+		for (const auto &h: mesh.halfedges_around_target(mesh.halfedge(v))) {
+			if (mesh.is_border(h)) continue;
+			auto a = mesh.source(h);
+			auto b = mesh.target(mesh.next(h));
+			if (a == other || b == other) continue;
+			K::Vector_3 old_normal = has_face_normals ? face_normals[mesh.face(h)] : CGAL::orthogonal_vector(mesh.point(a), mesh.point(v), mesh.point(b));
+			K::Vector_3 new_normal = CGAL::orthogonal_vector(mesh.point(a), placement, mesh.point(b));
+			if (!(old_normal * new_normal > 0)) return false;
+		}
+	}
+	return true;
+}
+
+boost::optional<SMS::Edge_profile<Surface_mesh>::Point> Normal_change_filter::operator()(const SMS::Edge_profile<Surface_mesh>& profile, boost::optional<SMS::Edge_profile<Surface_mesh>::Point> placement) const {
+	if (placement && is_normal_change_bounded(profile, *placement)) return placement;
+	return boost::none;
+}
+
 Cost_stop_predicate::Cost_stop_predicate(const float cost) : cost(cost) {}
 
 bool Cost_stop_predicate::operator()(const SMS::Edge_profile<Surface_mesh>::FT & current_cost, const SMS::Edge_profile<Surface_mesh> &, const SMS::Edge_profile<Surface_mesh>::edges_size_type, const SMS::Edge_profile<Surface_mesh>::edges_size_type) const {
@@ -1807,11 +2645,39 @@ My_visitor::My_visitor(const LindstromTurk_param &params, const K::FT alpha, con
 	boost::tie(collapse_datas, created_collapse_datas) = mesh.add_property_map<Surface_mesh::Edge_index, CollapseData>("e:c_datas");
 }
 
+void My_visitor::collect_in_parallel(const Custom_placement &placement, const Custom_cost &cost) {
+	initial_placement = &placement;
+	initial_cost = &cost;
+}
+
+void My_visitor::compute_on_commit(Custom_cost &cost) {
+	cost.compute_on_commit();
+	commit_cost = &cost;
+}
+
+void My_visitor::reuse_setup(bool keep_properties, bool quiet) {
+	setup = false;
+	remove_properties = !keep_properties;
+	this->quiet = quiet;
+}
+
+void My_visitor::keep_setup() {
+	remove_properties = false;
+}
+
 void My_visitor::OnStarted (Surface_mesh&) {
 
-	std::cout << "Starting edge_collapse" << std::endl;
+	if (!quiet) std::cout << "Starting edge_collapse" << std::endl;
 	total_timer.start();
 
+	// Normals and areas of the faces, kept up to date with the collapses
+	compute_face_geometry(mesh);
+	bool has_face_geometry;
+	boost::tie(face_normals, has_face_geometry) = mesh.property_map<Surface_mesh::Face_index, K::Vector_3>("f:normal");
+	assert(has_face_geometry);
+	boost::tie(face_areas, has_face_geometry) = mesh.property_map<Surface_mesh::Face_index, K::FT>("f:area");
+	assert(has_face_geometry);
+
 	if (beta > 0 || gamma > 0 || params.semantic_border_optimization > 0) {
 		// Add label to face
 		bool created_label;
@@ -1835,39 +2701,42 @@ void My_visitor::OnStarted (Surface_mesh&) {
 
 	if(created_point_in_face) {
 		AABB_tree mesh_tree;
-		PMP::build_AABB_tree(mesh, mesh_tree);
-		for (const auto &ph: point_cloud) {
-			auto p = type_converter(point_cloud.point(ph));
-			auto location = PMP::locate_with_AABB_tree(p, mesh_tree, mesh);
-			point_in_face[location.first].push_back(ph);
-			if (created_face_costs && alpha > 0) face_costs[location.first] += alpha * CGAL::squared_distance(p, PMP::construct_point(location, mesh));
-		}
+		PointLocation::build_tree(mesh, mesh_tree);
+		PointLocation::associate_points(mesh, mesh_tree, point_cloud, point_in_face, created_face_costs ? &face_costs : nullptr, alpha);
 	} else if (created_face_costs && alpha > 0) {
+		DistanceKernel::Point_batch points;
+		std::vector<float> distances;
 		for (const auto &face: mesh.faces()) {
 			auto r = mesh.vertices_around_face(mesh.halfedge(face)).begin();
 			K::Triangle_3 triangle_face(mesh.point(*r++), mesh.point(*r++), mesh.point(*r++));
-			for (const auto &ph: point_in_face[face]) {
-				auto p = type_converter(point_cloud.point(ph));
-				face_costs[face] += alpha * CGAL::squared_distance(p, triangle_face);
+			points.clear();
+			for (const auto &ph: point_in_face[face]) points.push_back(point_cloud.point(ph));
+			distances.resize(points.size());
+			DistanceKernel::squared_distances(points, DistanceKernel::Triangle(triangle_face), distances.data());
+			for (const auto &d: distances) {
+				face_costs[face] += alpha * d;
 			}
 		}
 	}
+
+	// Label histograms of the faces, kept up to date with their points
+	if (beta > 0 || gamma > 0 || params.label_preservation > 0 || params.semantic_border_optimization > 0) {
+		boost::tie(face_histograms, has_face_histograms) = mesh.property_map<Surface_mesh::Face_index, Label_histogram>("f:histogram");
+		if (created_point_in_face || !has_face_histograms) {
+			face_histograms = compute_face_histograms(mesh, point_cloud);
+			has_face_histograms = true;
+		}
+	}
+
 	if (created_face_costs && beta > 0) {
 		for (const auto &face: mesh.faces()) {
 			K::FT min_point = 0;
 			if (min_point_per_area > 0) {
-				auto r = mesh.vertices_around_face(mesh.halfedge(face)).begin();
-				K::FT face_area = CGAL::sqrt(K::Triangle_3(mesh.point(*r++), mesh.point(*r++), mesh.point(*r++)).squared_area());
-				min_point = min_point_per_area * face_area;
+				min_point = min_point_per_area * face_areas[face];
 			}
 			if (point_in_face[face].size() > 0) {
 				if (point_in_face[face].size() > min_point) {
-					int face_label[LABELS.size()] = {0};
-					for (const auto &point: point_in_face[face]) {
-						face_label[point_cloud_label[point]]++;
-					}
-					auto argmax = std::max_element(face_label, face_label+LABELS.size());
-					face_costs[face] += beta * (point_in_face[face].size() - *argmax);
+					face_costs[face] += beta * (point_in_face[face].size() - face_histograms[face].max());
 				} else { // We don't have information about this face.
 					face_costs[face] += beta * point_in_face[face].size();
 				}
@@ -1881,23 +2750,16 @@ void My_visitor::OnStarted (Surface_mesh&) {
 		Point_set::Property_map<bool> isborder;
 		boost::tie (isborder, created_point_isborder) = point_cloud.add_property_map<bool>("p:isborder", false);
 		if (created_point_isborder) {
-			int N = 10;
-			Point_tree point_tree(point_cloud.begin(), point_cloud.end(), Point_tree::Splitter(), TreeTraits(point_cloud.point_map()));
-			Neighbor_search::Distance tr_dist(point_cloud.point_map());
-			for (const auto &point: point_cloud) {
-				Neighbor_search search(point_tree, point_cloud.point(point), N, 0, true, tr_dist, false);
-				unsigned char l = point_cloud_label[search.begin()->first];
-				for (auto it = search.begin() + 1; it != search.end() && !isborder[point]; ++it) {
-					if (point_cloud_label[it->first] != l) isborder[point] = true;
-				}
-			}
-			std::cout << "Border points computed" << std::endl;
+			TimerUtils::Timer border_timer;
+			border_timer.start();
+			bool raster = compute_border_points(point_cloud, isborder);
+			std::cout << "Border points computed" << (raster ? " on the raster" : "") << " in " << border_timer.getElapsedTime() << "s" << std::endl;
 		} else {
-			std::cout << "Border points found" << std::endl;
+			if (!quiet) std::cout << "Border points found" << std::endl;
 		}
 	}
 
-	{// Save point cloud
+	if (setup) {// Save point cloud
 		if (ablation.border_point) {
 			total_timer.pause();
 			Point_set output_point_cloud(point_cloud);
@@ -1954,163 +2816,194 @@ void My_visitor::OnStarted (Surface_mesh&) {
 	}
 
 
-	if (beta > 0 || gamma > 0 || params.semantic_border_optimization > 0) {
+	if (setup && (beta > 0 || gamma > 0 || params.semantic_border_optimization > 0)) {
 		add_label(mesh, point_cloud, min_point_per_area);
 
 		// Subdivide wrong face
 		if (ablation.subdivide) {
+			TimerUtils::Timer subdivide_timer;
+			subdivide_timer.start();
+			std::size_t rounds = 0, subdivided = 0;
+
 			std::set<Surface_mesh::Face_index> face_to_divide;
 			for (const auto &face: mesh.faces()) {
 				face_to_divide.insert(face);
 			}
 
+			/*
+			 * By rounds: the faces to subdivide whose neighbourhoods (the face
+			 * and its three neighbours, removed by subdivide_face) do not
+			 * overlap are taken in the order of face_to_divide, their SVM are
+			 * solved in parallel, then the mesh is edited sequentially.
+			 */
+			std::vector<Surface_mesh::Face_index> batch;
+			std::vector<K::Plane_3> planes;
+			std::vector<int> batch_labels;
+			std::vector<std::size_t> reserved;
 			while (face_to_divide.size() > 0) {
-				auto face = *face_to_divide.begin();
-
-				if (point_in_face[face].size() > 1) {
-
-					int face_label[LABELS.size()] = {0};
-
-					for (const auto &point: point_in_face[face]) {
-						face_label[point_cloud_label[point]]++;
+				rounds++;
+				batch.clear();
+				batch_labels.clear();
+				reserved.resize(mesh.num_faces(), 0);
+				std::vector<Surface_mesh::Face_index> not_to_divide;
+				for (const auto &face: face_to_divide) {
+					if (point_in_face[face].size() > 1) {
+
+						// Points of several labels
+						if (face_histograms[face].counts.size() > 1) {
+							std::array<Surface_mesh::Face_index, 4> neighbourhood = {face, mesh.face(mesh.opposite(mesh.halfedge(face))), mesh.face(mesh.opposite(mesh.next(mesh.halfedge(face)))), mesh.face(mesh.opposite(mesh.prev(mesh.halfedge(face))))};
+							bool independent = true;
+							for (const auto &f: neighbourhood) {
+								if (f != mesh.null_face() && reserved[f] == rounds) independent = false;
+							}
+							if (independent) {
+								for (const auto &f: neighbourhood) {
+									if (f != mesh.null_face()) reserved[f] = rounds;
+								}
+								batch.push_back(face);
+								batch_labels.push_back(face_histograms[face].argmax());
+							}
+						} else {
+							not_to_divide.push_back(face);
+						}
+					} else {
+						not_to_divide.push_back(face);
 					}
+				}
+				for (const auto &face: not_to_divide) {
+					face_to_divide.erase(face);
+				}
 
-					auto argmax = std::max_element(face_label, face_label+LABELS.size());
+				planes.resize(batch.size());
+				ParallelUtils::for_each_index(batch.size(), [&](std::size_t b) {
+					planes[b] = subdivision_plane(mesh, batch[b], batch_labels[b], point_cloud);
+				}, 1);
 
-					if (*argmax < point_in_face[face].size()) {
-						auto h0 = mesh.halfedge(face);
-						auto h1 = mesh.next(h0);
-						auto h2 = mesh.next(h1);
+				for (std::size_t b = 0; b < batch.size(); b++) {
+					auto face = batch[b];
+					subdivided++;
+					auto h0 = mesh.halfedge(face);
+					auto h1 = mesh.next(h0);
+					auto h2 = mesh.next(h1);
 
-						std::set<Point_set::Index> points_to_be_change;
-						points_to_be_change.insert(point_in_face[face].begin(), point_in_face[face].end());
-						if (!mesh.is_border(mesh.edge(h0))) points_to_be_change.insert(point_in_face[mesh.face(mesh.opposite(h0))].begin(), point_in_face[mesh.face(mesh.opposite(h0))].end());
-						if (!mesh.is_border(mesh.edge(h1))) points_to_be_change.insert(point_in_face[mesh.face(mesh.opposite(h1))].begin(), point_in_face[mesh.face(mesh.opposite(h1))].end());
-						if (!mesh.is_border(mesh.edge(h2))) points_to_be_change.insert(point_in_face[mesh.face(mesh.opposite(h2))].begin(), point_in_face[mesh.face(mesh.opposite(h2))].end());
+					std::set<Point_set::Index> points_to_be_change;
+					points_to_be_change.insert(point_in_face[face].begin(), point_in_face[face].end());
+					if (!mesh.is_border(mesh.edge(h0))) points_to_be_change.insert(point_in_face[mesh.face(mesh.opposite(h0))].begin(), point_in_face[mesh.face(mesh.opposite(h0))].end());
+					if (!mesh.is_border(mesh.edge(h1))) points_to_be_change.insert(point_in_face[mesh.face(mesh.opposite(h1))].begin(), point_in_face[mesh.face(mesh.opposite(h1))].end());
+					if (!mesh.is_border(mesh.edge(h2))) points_to_be_change.insert(point_in_face[mesh.face(mesh.opposite(h2))].begin(), point_in_face[mesh.face(mesh.opposite(h2))].end());
 
-						face_to_divide.erase(face);
-						face_to_divide.erase(mesh.face(mesh.opposite(h0)));
-						face_to_divide.erase(mesh.face(mesh.opposite(h1)));
-						face_to_divide.erase(mesh.face(mesh.opposite(h2)));
+					face_to_divide.erase(face);
+					face_to_divide.erase(mesh.face(mesh.opposite(h0)));
+					face_to_divide.erase(mesh.face(mesh.opposite(h1)));
+					face_to_divide.erase(mesh.face(mesh.opposite(h2)));
 
-						auto new_faces = subdivide_face(mesh, face, argmax - face_label, point_cloud);
+					auto new_faces = subdivide_face(mesh, face, planes[b]);
+					for (const auto &new_face: new_faces) update_face_geometry(mesh, face_normals, face_areas, new_face);
 
-						std::vector<K::Triangle_3> new_faces_triangle;
-						for (const auto &new_face: new_faces) {
-							auto r = mesh.vertices_around_face(mesh.halfedge(new_face)).begin();
-							new_faces_triangle.push_back(K::Triangle_3(mesh.point(*r++), mesh.point(*r++), mesh.point(*r++)));
-						}
-
-						// geometric error
-						for (const auto &ph: points_to_be_change) {
-							auto point = type_converter(point_cloud.point(ph));
-							K::FT min_d = std::numeric_limits<K::FT>::max();
-							std::size_t closest_face = 0;
-							for(std::size_t face_id = 0; face_id < new_faces_triangle.size(); face_id++) {
-								auto d = CGAL::squared_distance(point, new_faces_triangle[face_id]);
-								if (d < min_d) {
-									min_d = d;
-									closest_face = face_id;
-								}
-							}
-							point_in_face[new_faces[closest_face]].push_back(ph);
-							if (alpha > 0) {
-								face_costs[new_faces[closest_face]] += alpha * min_d;
-							}
-						}
+					std::vector<DistanceKernel::Triangle> new_faces_triangle;
+					for (const auto &new_face: new_faces) {
+						auto r = mesh.vertices_around_face(mesh.halfedge(new_face)).begin();
+						new_faces_triangle.push_back(K::Triangle_3(mesh.point(*r++), mesh.point(*r++), mesh.point(*r++)));
+					}
 
-						for (const auto &new_face: new_faces) {
-							if (point_in_face[new_face].size() > 0) face_to_divide.insert(new_face);
+					// geometric error
+					DistanceKernel::Point_batch points;
+					for (const auto &ph: points_to_be_change) points.push_back(point_cloud.point(ph));
+					std::vector<std::uint32_t> closest_faces (points.size());
+					std::vector<float> min_ds (points.size());
+					DistanceKernel::nearest_triangle(points, new_faces_triangle, closest_faces.data(), min_ds.data());
+					std::size_t i = 0;
+					for (const auto &ph: points_to_be_change) {
+						auto closest_face = closest_faces[i];
+						auto min_d = min_ds[i++];
+						point_in_face[new_faces[closest_face]].push_back(ph);
+						face_histograms[new_faces[closest_face]].add(point_cloud_label[ph]);
+						if (alpha > 0) {
+							face_costs[new_faces[closest_face]] += alpha * min_d;
 						}
+					}
 
-						// semantic error
-						if (beta > 0 || gamma > 0 || params.semantic_border_optimization > 0) {
-							// label new face and semantic error
-							std::set<Surface_mesh::Face_index> faces_with_no_label;
-							for (const auto &face: new_faces) {
-								K::FT min_point = 0;
-								if (min_point_per_area > 0) {
-									auto r = mesh.vertices_around_face(mesh.halfedge(face)).begin();
-									K::FT face_area = CGAL::sqrt(K::Triangle_3(mesh.point(*r++), mesh.point(*r++), mesh.point(*r++)).squared_area());
-									min_point = min_point_per_area * face_area;
-								}
-								if (point_in_face[face].size() > 0) {
-
-									if (point_in_face[face].size() > min_point) {
+					for (const auto &new_face: new_faces) {
+						if (point_in_face[new_face].size() > 0) face_to_divide.insert(new_face);
+					}
 
-										int face_label[LABELS.size()] = {0};
+					// semantic error
+					if (beta > 0 || gamma > 0 || params.semantic_border_optimization > 0) {
+						// label new face and semantic error
+						std::set<Surface_mesh::Face_index> faces_with_no_label;
+						for (const auto &face: new_faces) {
+							K::FT min_point = 0;
+							if (min_point_per_area > 0) {
+								min_point = min_point_per_area * face_areas[face];
+							}
+							if (point_in_face[face].size() > 0) {
 
-										for (const auto &point: point_in_face[face]) {
-											face_label[point_cloud_label[point]]++;
-										}
+								if (point_in_face[face].size() > min_point) {
 
-										auto argmax = std::max_element(face_label, face_label+LABELS.size());
-										face_costs[face] += beta * (point_in_face[face].size() - *argmax);
-										mesh_label[face] = argmax - face_label;
+									face_costs[face] += beta * (point_in_face[face].size() - face_histograms[face].max());
+									mesh_label[face] = face_histograms[face].argmax();
 
-									} else { // We don't have information about this face.
-										mesh_label[face] = LABEL_UNKNOWN;
-										face_costs[face] += beta * point_in_face[face].size();
-									}
-								} else {
-									if (min_point <= 1) { // It's probable that there is no point
-										faces_with_no_label.insert(face);
-									} else { // We don't have information about this face.
-										mesh_label[face] = LABEL_UNKNOWN;
-									}
+								} else { // We don't have information about this face.
+									mesh_label[face] = LABEL_UNKNOWN;
+									face_costs[face] += beta * point_in_face[face].size();
+								}
+							} else {
+								if (min_point <= 1) { // It's probable that there is no point
+									faces_with_no_label.insert(face);
+								} else { // We don't have information about this face.
+									mesh_label[face] = LABEL_UNKNOWN;
 								}
 							}
-							while(faces_with_no_label.size() > 0) {
-								std::list<Surface_mesh::Face_index> face_to_be_removed;
-								for (const auto &face: faces_with_no_label) {
-									K::FT face_label[LABELS.size()] = {0};
-									bool no_neighbor = true;
-									for (const auto &he: mesh.halfedges_around_face(mesh.halfedge(face))) {
-										if (!mesh.is_border(Surface_mesh::Edge_index(he))) {
-											no_neighbor = false;
-											if (faces_with_no_label.count(mesh.face(mesh.opposite(he))) == 0) {
-												face_label[mesh_label[mesh.face(mesh.opposite(he))]] += CGAL::sqrt(CGAL::squared_distance(mesh.point(mesh.source(he)), mesh.point(mesh.target(he))));
-											}
+						}
+						while(faces_with_no_label.size() > 0) {
+							std::list<Surface_mesh::Face_index> face_to_be_removed;
+							for (const auto &face: faces_with_no_label) {
+								K::FT face_label[LABELS.size()] = {0};
+								bool no_neighbor = true;
+								for (const auto &he: mesh.halfedges_around_face(mesh.halfedge(face))) {
+									if (!mesh.is_border(Surface_mesh::Edge_index(he))) {
+										no_neighbor = false;
+										if (faces_with_no_label.count(mesh.face(mesh.opposite(he))) == 0) {
+											face_label[mesh_label[mesh.face(mesh.opposite(he))]] += CGAL::sqrt(CGAL::squared_distance(mesh.point(mesh.source(he)), mesh.point(mesh.target(he))));
 										}
 									}
-									if (no_neighbor) {
-										mesh_label[face] = LABEL_UNKNOWN;
+								}
+								if (no_neighbor) {
+									mesh_label[face] = LABEL_UNKNOWN;
+									face_to_be_removed.push_back(face);
+								} else {
+									auto argmax = std::max_element(face_label, face_label+LABELS.size());
+									if (*argmax > 0) {
+										mesh_label[face] = argmax - face_label;
 										face_to_be_removed.push_back(face);
-									} else {
-										auto argmax = std::max_element(face_label, face_label+LABELS.size());
-										if (*argmax > 0) {
-											mesh_label[face] = argmax - face_label;
-											face_to_be_removed.push_back(face);
-										}
 									}
 								}
-								for (const auto &face: face_to_be_removed) {
-									faces_with_no_label.erase(face);
-								}
-								if (face_to_be_removed.size() == 0) {
-									for (const auto &face_id: faces_with_no_label) {
-										mesh_label[face_id] = LABEL_UNKNOWN;
-									}
-									break;
-								} else {
-									face_to_be_removed.clear();
+							}
+							for (const auto &face: face_to_be_removed) {
+								faces_with_no_label.erase(face);
+							}
+							if (face_to_be_removed.size() == 0) {
+								for (const auto &face_id: faces_with_no_label) {
+									mesh_label[face_id] = LABEL_UNKNOWN;
 								}
+								break;
+							} else {
+								face_to_be_removed.clear();
 							}
 						}
-					} else {
-						face_to_divide.erase(face);
 					}
-				} else {
-					face_to_divide.erase(face);
 				}
 			}
+
+			if (!quiet) std::cout << subdivided << " faces subdivided in " << rounds << " rounds in " << subdivide_timer.getElapsedTime() << "s" << std::endl;
 		}
 	}
 
-	total_timer.pause();
-	mesh_info.save_mesh(mesh, "initial-mesh.ply");
-
-	total_timer.resume();
+	if (setup) {
+		total_timer.pause();
+		mesh_info.save_mesh(mesh, "initial-mesh.ply");
+		total_timer.resume();
+	}
 
 /*{
 	K::FT face_cost = 0;
@@ -2133,11 +3026,30 @@ void My_visitor::OnStarted (Surface_mesh&) {
 	std::cerr << "Initial cost_explain\t\t" << face_cost << "\t" << edge_cost << "\n";
 }*/
 
+	if (has_volume_or_boundary_terms(params)) {
+		bool created_vertex_quadrics;
+		boost::tie(vertex_quadrics, created_vertex_quadrics) = mesh.add_property_map<Surface_mesh::Vertex_index, Vertex_quadric>("v:quadric");
+		has_vertex_quadrics = true;
+		std::vector<Surface_mesh::Vertex_index> vertices (mesh.vertices().begin(), mesh.vertices().end());
+		ParallelUtils::for_each_index(vertices.size(), [&](std::size_t i) {
+			vertex_quadrics[vertices[i]] = vertex_quadric(params, mesh, vertices[i]);
+		}, 1024);
+	}
+
+	if (initial_placement != nullptr && initial_cost != nullptr) {
+		TimerUtils::Timer precompute_timer;
+		precompute_timer.start();
+		precompute_collapse_datas(mesh, *initial_placement, *initial_cost);
+		precomputed_pending = true;
+		if (!quiet) std::cout << "Initial costs computed in " << precompute_timer.getElapsedTime() << "s" << std::endl;
+	}
+
 	collected_timer.start();
 }
 
 void My_visitor::OnFinished (Surface_mesh &mesh) {
-	std::cout << "\rMesh simplified                                               " << std::endl;
+	if (!remove_properties) return;
+	if (!quiet) std::cout << "\rMesh simplified                                               " << std::endl;
 
 	Surface_mesh::Property_map<Surface_mesh::Face_index, std::list<Point_set::Index>> point_in_face;
 	bool has_point_in_face;
@@ -2247,19 +3159,37 @@ void My_visitor::OnFinished (Surface_mesh &mesh) {
 	mesh.remove_property_map<Surface_mesh::Face_index, std::list<Point_set::Index>>(point_in_face);
 	mesh.remove_property_map<Surface_mesh::Face_index, K::FT>(face_costs);
 	mesh.remove_property_map<Surface_mesh::Edge_index, CollapseData>(collapse_datas);
+
+	Surface_mesh::Property_map<Surface_mesh::Vertex_index, Vertex_quadric> vertex_quadrics;
+	bool has_vertex_quadrics;
+	boost::tie(vertex_quadrics, has_vertex_quadrics) = mesh.property_map<Surface_mesh::Vertex_index, Vertex_quadric>("v:quadric");
+	if (has_vertex_quadrics) mesh.remove_property_map<Surface_mesh::Vertex_index, Vertex_quadric>(vertex_quadrics);
+
+	Surface_mesh::Property_map<Surface_mesh::Face_index, Label_histogram> face_histograms;
+	bool has_face_histograms;
+	boost::tie(face_histograms, has_face_histograms) = mesh.property_map<Surface_mesh::Face_index, Label_histogram>("f:histogram");
+	if (has_face_histograms) mesh.remove_property_map<Surface_mesh::Face_index, Label_histogram>(face_histograms);
+
+	remove_face_geometry(mesh);
 }
 
 void My_visitor::OnCollected(const SMS::Edge_profile<Surface_mesh>&, const boost::optional< SMS::Edge_profile<Surface_mesh>::FT >&) {
 	collapsing_timer.start();
 	i_collecte++;
-	if (i_collecte%1000 == 0) {
+	if (!quiet && i_collecte%1000 == 0) {
 		auto time = collected_timer.getElapsedTime();
 		std::cout << "\rCollecte: " << i_collecte << "/" << mesh.number_of_edges() << " (" << ((int) (((float) i_collecte)/mesh.number_of_edges()*100)) << "%)" << " still " << (((float) mesh.number_of_edges() - i_collecte) * time / i_collecte) << "s" << " (" << (((float) i_collecte) / time) << " op/s)" << std::flush;
 	}
 }
 
 void My_visitor::OnSelected (const SMS::Edge_profile<Surface_mesh>&, boost::optional< SMS::Edge_profile<Surface_mesh>::FT > cost, const SMS::Edge_profile<Surface_mesh>::edges_size_type initial_edge_count, const SMS::Edge_profile<Surface_mesh>::edges_size_type current_edge_count) {
-	if (current_edge_count%100 == 0) {
+	// The collection is over, the remaining precomputed values are never used
+	if (precomputed_pending) {
+		discard_precomputed_collapse_datas(mesh);
+		precomputed_pending = false;
+	}
+
+	if (!quiet && current_edge_count%100 == 0) {
 		auto time = collapsing_timer.getElapsedTime();
 		std::cout << "\rCollapse: " << (initial_edge_count-current_edge_count) << "/" << initial_edge_count << " (" << ((int) (((float) (initial_edge_count-current_edge_count))/initial_edge_count*100)) << "%)" << " still " << (((float) current_edge_count) * time / (initial_edge_count-current_edge_count)) << "s" << " (" << (((float) (initial_edge_count-current_edge_count)) / time) << " op/s)";
 		if (cost) {
@@ -2267,7 +3197,7 @@ void My_visitor::OnSelected (const SMS::Edge_profile<Surface_mesh>&, boost::opti
 		}
 	}
 
-	if (cost && ablation.step_mesh) {
+	if (cost && ablation.step_mesh && !quiet) {
 // std::cerr << "Try collapsing " << profile.v0_v1() << "\t\t" << *cost << "\n";
 // c_cost = *cost;
 
@@ -2490,8 +3420,14 @@ void My_visitor::OnSelected (const SMS::Edge_profile<Surface_mesh>&, boost::opti
 
 }
 
-void My_visitor::OnCollapsing (const SMS::Edge_profile<Surface_mesh> &profile, const boost::optional<SMS::Edge_profile<Surface_mesh>::Point>&) {
+void My_visitor::OnCollapsing (const SMS::Edge_profile<Surface_mesh> &profile, const boost::optional<SMS::Edge_profile<Surface_mesh>::Point> &placement) {
 	// Called when an edge is about to be collapsed and replaced by a vertex whose position is *placement
+	if (precomputed_pending) {
+		discard_precomputed_collapse_datas(mesh);
+		precomputed_pending = false;
+	}
+	// Before the points of the old faces are cleared
+	if (commit_cost != nullptr) commit_cost->commit(profile, placement);
 	if (alpha > 0 || beta > 0 || gamma > 0 || params.semantic_border_optimization > 0) {
 		for (const auto &face: profile.triangles()) {
 			auto fh = mesh.face(mesh.halfedge(face.v0, face.v1));
@@ -2505,6 +3441,7 @@ void My_visitor::OnCollapsing (const SMS::Edge_profile<Surface_mesh> &profile, c
 			}*/
 
 			point_in_face[fh].clear();
+			if (has_face_histograms) face_histograms[fh].counts.clear();
 			face_costs[fh] = 0;
 		}
 	}
@@ -2515,14 +3452,26 @@ void My_visitor::OnCollapsed (const SMS::Edge_profile<Surface_mesh>& prof, const
 
 	// change point_in_face and face_costs
 	if (alpha > 0 || beta > 0 || gamma > 0 || params.semantic_border_optimization > 0) {
-		for (const auto &element: collapse_datas[Surface_mesh::Edge_index(prof.v0_v1())].elements) {
+		const CollapseData &collapse_data = collapse_datas[Surface_mesh::Edge_index(prof.v0_v1())];
+		for (const auto &element: collapse_data.elements) {
 			auto face = mesh.face(element.halfedge);
-			for (const auto &ph: element.points) point_in_face[face].push_back(ph);
+			for (std::size_t i = element.points_begin; i < element.points_end; i++) point_in_face[face].push_back(collapse_data.points[i]);
+			if (has_face_histograms) {
+				for (std::size_t i = element.points_begin; i < element.points_end; i++) face_histograms[face].add(point_cloud_label[collapse_data.points[i]]);
+			}
 			face_costs[face] = element.cost;
 			if (beta > 0 || gamma > 0 || params.semantic_border_optimization > 0) mesh_label[face] = element.label;
 		}
 	}
 
+	for (const auto &face: mesh.faces_around_target(mesh.halfedge(vd))) {
+		if (face != Surface_mesh::null_face()) update_face_geometry(mesh, face_normals, face_areas, face);
+	}
+
+	if (has_vertex_quadrics) update_vertex_quadrics(params, mesh, vertex_quadrics, vd);
+
+	if (commit_cost != nullptr) collapse_datas[Surface_mesh::Edge_index(prof.v0_v1())].release();
+
 /*{
 	std::cerr << "Collapsed cost\t" << c_cost << "\n";
 
@@ -2580,14 +3529,11 @@ void associate_mesh_point_cloud (Surface_mesh& mesh, Point_set& point_cloud) {
 	assert(created_point_in_face);
 
 	AABB_tree mesh_tree;
-	PMP::build_AABB_tree(mesh, mesh_tree);
-
-	CGAL::Cartesian_converter<Point_set_kernel, K> type_converter;
+	PointLocation::build_tree(mesh, mesh_tree);
 
-	for (auto &ph: point_cloud) {
-		auto p = type_converter(point_cloud.point(ph));
-		auto location = PMP::locate_with_AABB_tree(p, mesh_tree, mesh);
-		if (created_point_label) point_cloud_label[ph] = mesh_label[location.first];
-		point_in_face[location.first].push_back(ph);
+	auto locations = PointLocation::associate_points(mesh, mesh_tree, point_cloud, point_in_face);
+	if (created_point_label) {
+		std::size_t i = 0;
+		for (auto &ph: point_cloud) point_cloud_label[ph] = mesh_label[locations[i++].first];
 	}
 }
@@ -4,9 +4,12 @@
 #include "header.hpp"
 #include "timer.hpp"
 
+#include <array>
 #include <chrono>
+#include <utility>
 #include <vector>
 #include <set>
+#include <atomic>
 
 #include <CGAL/Surface_mesh_simplification/edge_collapse.h>
 #include <CGAL/Surface_mesh_simplification/Edge_collapse_visitor_base.h>
@@ -17,6 +20,39 @@ void add_label(Surface_mesh &mesh, const Point_set &point_cloud, const K::FT min
 
 K::FT get_mean_point_per_area(Surface_mesh &mesh, const Point_set &point_cloud);
 
+// Normal of each face, CGAL::orthogonal_vector of its vertices from
+// mesh.halfedge(face) (its length is twice the area), and area, kept in
+// "f:normal" and "f:area" while the mesh is simplified so that they are
+// only computed again for the faces that change.
+void compute_face_geometry(Surface_mesh &mesh);
+
+void update_face_geometry(const Surface_mesh &mesh, Surface_mesh::Property_map<Surface_mesh::Face_index, K::Vector_3> face_normals, Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> face_areas, Surface_mesh::Face_index face);
+
+void remove_face_geometry(Surface_mesh &mesh);
+
+// Area of face, from "f:area" if face_areas is set
+K::FT face_area(const Surface_mesh &mesh, const Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> *face_areas, Surface_mesh::Face_index face);
+
+// Number of points of each label in a face ("f:histogram"), kept up to date
+// with the points of the face ("f:points")
+struct Label_histogram {
+	// (label, number of points) of the labels present, sorted by label
+	std::vector<std::pair<unsigned char, unsigned int>> counts;
+
+	void add(unsigned char label);
+
+	// Label with the most points, the lowest one on ties
+	unsigned char argmax() const;
+
+	// Number of points of argmax()
+	unsigned int max() const;
+};
+
+Label_histogram label_histogram(const std::list<Point_set::Index> &points, const Point_set::Property_map<unsigned char> &label);
+
+// Sets "f:histogram" of every face from its "f:points", in parallel, and returns it
+Surface_mesh::Property_map<Surface_mesh::Face_index, Label_histogram> compute_face_histograms(Surface_mesh &mesh, const Point_set &point_cloud);
+
 struct LindstromTurk_param {
 	float volume_preservation;
 	float boundary_preservation;
@@ -48,43 +84,209 @@ struct Ablation_study {
 
 void compute_stat(Surface_mesh &mesh, const Ablation_study &ablation, TimerUtils::Timer &timer, K::FT cost);
 
+// Energy minimised by the edge collapse, with each point of the point cloud on its closest face
+K::FT compute_energy(const Surface_mesh &mesh, const Point_set &point_cloud, const K::FT alpha, const K::FT beta, const K::FT gamma);
+
 struct CollapseDataElement{
 	Surface_mesh::Halfedge_index halfedge;
 	unsigned char label;
 	K::FT cost;
-	std::vector<Point_set::Index> points;
+	// CGAL::orthogonal_vector of the new face
+	K::Vector_3 normal;
+	// range of this element in CollapseData::points
+	std::size_t points_begin;
+	std::size_t points_end;
 };
 
 struct CollapseData {
 	K::FT cost;
 	K::FT placement_cost;
 	std::vector<CollapseDataElement> elements;
+	std::vector<Point_set::Index> points;
+	// Placement of the new faces of elements, if they are set
+	boost::optional<Point_3> elements_placement;
+
+	// Placement and cost computed before the collapse starts, returned by
+	// the next evaluation of precomputed_halfedge
+	bool precomputed = false;
+	Surface_mesh::Halfedge_index precomputed_halfedge;
+	boost::optional<Point_3> precomputed_placement;
+	boost::optional<K::FT> precomputed_cost;
+
+	// Frees elements and points, the cost and the placement cost are kept
+	void release();
+};
+
+// Volume and boundary terms of Custom_placement summed over the faces and
+// the border edges around a vertex, relative to the position of the vertex:
+// the normal equations (A^T A, A^T B, B^T B) of the optimisation rows, and
+// the sums making the preservation rows. The terms of an edge are the ones
+// of its two vertices minus the ones of the faces and border edge they share.
+struct Vertex_quadric {
+	// Upper triangle of A^T A: xx, xy, xz, yy, yz, zz
+	std::array<double, 6> AtA {};
+	std::array<double, 3> AtB {};
+	double BtB = 0;
+	// Volume preservation
+	std::array<double, 3> normal {};
+	double det = 0;
+	// Boundary preservation
+	std::array<double, 3> e1 {};
+	std::array<double, 3> e2 {};
+	std::size_t border_edges = 0;
+};
+
+// Property handles used to evaluate an edge, looked up once per run
+// instead of by name at each evaluation.
+struct Collapse_properties {
+	bool ready = false;
+	Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> face_costs;
+	Surface_mesh::Property_map<Surface_mesh::Face_index, std::list<Point_set::Index>> point_in_face;
+	Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> mesh_label;
+	Point_set::Property_map<unsigned char> point_cloud_label;
+	Point_set::Property_map<bool> isborder;
+	Surface_mesh::Property_map<Surface_mesh::Face_index, Label_histogram> face_histograms;
+	Surface_mesh::Property_map<Surface_mesh::Vertex_index, Vertex_quadric> vertex_quadrics;
+	Surface_mesh::Property_map<Surface_mesh::Face_index, K::Vector_3> face_normals;
+	bool has_face_costs = false, has_point_in_face = false, has_mesh_label = false, has_point_cloud_label = false, has_isborder = false, has_face_histograms = false, has_vertex_quadrics = false, has_face_normals = false;
+
+	void prepare(const Surface_mesh &mesh, const Point_set &point_cloud);
+};
+
+#ifdef COUNT_ALLOCATIONS
+// Heap allocations made while evaluating edges. The counters are only
+// incremented by an executable replacing the global operator new.
+struct Evaluation_statistics {
+	static std::atomic<std::size_t> evaluations;
+	static std::atomic<std::size_t> allocations;
+	static std::atomic<std::size_t> allocating_evaluations;
+	static thread_local bool in_evaluation;
+	static thread_local std::size_t thread_allocations;
+};
+#endif
+
+// Optional rows of the placement, as the template parameter of
+// Custom_placement::place: a row is compiled in only if its weight is set.
+enum Placement_term : unsigned {
+	PLACEMENT_SHAPE = 1,           // params.triangle_shape_optimization
+	PLACEMENT_LABEL = 2,           // params.label_preservation
+	PLACEMENT_SEMANTIC_BORDER = 4, // params.semantic_border_optimization
+	PLACEMENT_TERMS = 7
 };
 
 class Custom_placement {
+	typedef boost::optional<SMS::Edge_profile<Surface_mesh>::Point> (Custom_placement::*Evaluation)(const SMS::Edge_profile<Surface_mesh>&) const;
+
 	const LindstromTurk_param &params;
 	Surface_mesh::Property_map<Surface_mesh::Edge_index, CollapseData> collapse_datas;
 	const Point_set &point_cloud;
 	const Ablation_study ablation;
+	mutable Collapse_properties properties;
+	// place<Terms> for the rows enabled by params
+	Evaluation evaluation;
+
+	template <unsigned Terms>
+	boost::optional<SMS::Edge_profile<Surface_mesh>::Point> place(const SMS::Edge_profile<Surface_mesh>& profile) const;
+
+	template <std::size_t... Terms>
+	static Evaluation evaluation_for(unsigned terms, std::index_sequence<Terms...>);
 
 	public:
 		Custom_placement (const LindstromTurk_param &params, Surface_mesh &mesh, const Point_set &point_cloud, const Ablation_study ablation = Ablation_study());
 
+		// Look up the property maps, done lazily at the first evaluation otherwise
+		void prepare(const Surface_mesh &mesh) const;
+
 		boost::optional<SMS::Edge_profile<Surface_mesh>::Point> operator()(const SMS::Edge_profile<Surface_mesh>& profile) const;
 };
 
+// Interval expected to hold the cost of an edge, see Custom_cost::estimate
+struct Cost_estimate {
+	K::FT low;
+	K::FT high;
+};
+
+// Terms of the energy, as the template parameter of Custom_cost::evaluate:
+// the code of a term is compiled in only if its weight is set.
+enum Cost_term : unsigned {
+	COST_DISTANCE = 1,            // alpha
+	COST_SEMANTIC = 2,            // beta
+	COST_SEMANTIC_BORDER = 4,     // gamma
+	COST_BORDER_OPTIMIZATION = 8, // params.semantic_border_optimization, the new faces are labelled
+	COST_TERMS = 15
+};
+
 class Custom_cost {
+	typedef boost::optional<SMS::Edge_profile<Surface_mesh>::FT> (Custom_cost::*Evaluation)(const SMS::Edge_profile<Surface_mesh>&, const boost::optional<SMS::Edge_profile<Surface_mesh>::Point>&) const;
+
 	const LindstromTurk_param &params;
 	const K::FT alpha, beta, gamma, delta;
 	const K::FT min_point_per_area;
 	const Point_set &point_cloud;
 	Surface_mesh::Property_map<Surface_mesh::Edge_index, CollapseData> collapse_datas;
 	char *next_mesh;
+	mutable Collapse_properties properties;
+	// evaluate<Terms> for the terms enabled by the weights
+	Evaluation evaluation;
+	bool on_commit = false;
+
+	template <unsigned Terms>
+	boost::optional<SMS::Edge_profile<Surface_mesh>::FT> evaluate(const SMS::Edge_profile<Surface_mesh>& profile, const boost::optional<SMS::Edge_profile<Surface_mesh>::Point>& placement) const;
+
+	template <std::size_t... Terms>
+	static Evaluation evaluation_for(unsigned terms, std::index_sequence<Terms...>);
 
 	public:
 		Custom_cost (const LindstromTurk_param &params, const K::FT alpha, const K::FT beta, const K::FT gamma, const K::FT delta, K::FT min_point_per_area, Surface_mesh &mesh, const Point_set &point_cloud, char *next_mesh = nullptr);
 
+		// Look up the property maps, done lazily at the first evaluation otherwise
+		void prepare(const Surface_mesh &mesh) const;
+
 		boost::optional<SMS::Edge_profile<Surface_mesh>::FT> operator()(const SMS::Edge_profile<Surface_mesh>& profile, const boost::optional<SMS::Edge_profile<Surface_mesh>::Point>& placement) const;
+
+		// operator() then only keeps the cost and the placement cost of an
+		// edge in e:c_datas: the new faces and the reassignment of the
+		// points are computed again by commit for the edges that collapse.
+		void compute_on_commit();
+
+		// Evaluate the edge again on placement, keeping its new faces and
+		// points in e:c_datas, before it collapses.
+		void commit(const SMS::Edge_profile<Surface_mesh>& profile, const boost::optional<SMS::Edge_profile<Surface_mesh>::Point>& placement) const;
+
+		// Lower bound of operator() whatever the placement, without
+		// locating the points or labelling the new faces: the distances and
+		// the semantic errors are at least 0, every semantic border around
+		// the edge can disappear, and the placement cost is at least the
+		// residual of the volume and boundary rows alone.
+		K::FT lower_bound(const SMS::Edge_profile<Surface_mesh>& profile) const;
+
+		// Interval of operator() from about sample_size points, sampled
+		// from each face around the edge in proportion to its points: the
+		// distances and the semantic errors are estimated within three
+		// standard deviations, the semantic border length is only bounded.
+		// The old face costs and the placement cost are exact, placement
+		// must be the one of Custom_placement for this edge. None if the
+		// edge has no more than sample_size points or no cost.
+		boost::optional<Cost_estimate> estimate(const SMS::Edge_profile<Surface_mesh>& profile, const boost::optional<SMS::Edge_profile<Surface_mesh>::Point>& placement, std::size_t sample_size) const;
+};
+
+// Evaluate the placement and the cost of every edge in parallel and keep
+// them in e:c_datas, for the collection phase of SMS::edge_collapse.
+void precompute_collapse_datas(Surface_mesh &mesh, const Custom_placement &placement, const Custom_cost &cost);
+
+// Drop the values left by precompute_collapse_datas.
+void discard_precomputed_collapse_datas(Surface_mesh &mesh);
+
+// False if a face kept around the edge turns by 90° or more when the edge
+// collapses on placement, as in SMS::Bounded_normal_change_filter. The old
+// normals come from "f:normal" and the new ones from the last evaluation of
+// Custom_cost on this placement, when they are there.
+bool is_normal_change_bounded(const SMS::Edge_profile<Surface_mesh>& profile, const Point_3 &placement);
+
+// SMS::Bounded_normal_change_filter with is_normal_change_bounded
+class Normal_change_filter {
+	public:
+		boost::optional<SMS::Edge_profile<Surface_mesh>::Point> operator()(const SMS::Edge_profile<Surface_mesh>& profile, boost::optional<SMS::Edge_profile<Surface_mesh>::Point> placement) const;
 };
 
 class Cost_stop_predicate {
@@ -122,12 +324,42 @@ struct My_visitor : SMS::Edge_collapse_visitor_base<Surface_mesh> {
 		Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> mesh_label;
 		Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> face_costs;
 		Surface_mesh::Property_map<Surface_mesh::Face_index, std::list<Point_set::Index>> point_in_face;
+		Surface_mesh::Property_map<Surface_mesh::Face_index, Label_histogram> face_histograms;
+		bool has_face_histograms = false;
 		Surface_mesh::Property_map<Surface_mesh::Edge_index, CollapseData> collapse_datas;
+		Surface_mesh::Property_map<Surface_mesh::Vertex_index, Vertex_quadric> vertex_quadrics;
+		bool has_vertex_quadrics = false;
 		Point_set::Property_map<unsigned char> point_cloud_label;
+		Surface_mesh::Property_map<Surface_mesh::Face_index, K::Vector_3> face_normals;
+		Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> face_areas;
+
+		const Custom_placement *initial_placement = nullptr;
+		const Custom_cost *initial_cost = nullptr;
+		bool precomputed_pending = false;
+		// Evaluates the collapsed edges again, see Custom_cost::compute_on_commit
+		const Custom_cost *commit_cost = nullptr;
+
+		bool setup = true;
+		bool remove_properties = true;
+		bool quiet = false;
 
 	public:
 		My_visitor(const LindstromTurk_param &params, const K::FT alpha, const K::FT beta, const K::FT gamma, const K::FT min_point_per_area, Surface_mesh &mesh, const Surface_mesh_info &mesh_info, Point_set &point_cloud, const Ablation_study ablation = Ablation_study());
 
+		// Compute the initial placements and costs in parallel at the end of OnStarted
+		void collect_in_parallel(const Custom_placement &placement, const Custom_cost &cost);
+
+		// The labels, f:points and f:cost were already set up on this mesh by another visitor:
+		// OnStarted only looks them up. With keep_properties, OnFinished leaves them on the mesh,
+		// and with quiet nothing is printed or saved while collapsing.
+		void reuse_setup(bool keep_properties = false, bool quiet = false);
+
+		// Set up the labels, f:points and f:cost in OnStarted, and leave them on the mesh in OnFinished for the visitors of reuse_setup
+		void keep_setup();
+
+		// Switch cost to Custom_cost::compute_on_commit and commit the collapsed edges, before the collapse starts
+		void compute_on_commit(Custom_cost &cost);
+
 		void OnStarted (Surface_mesh&);
 
 		void OnFinished (Surface_mesh&);
@@ -1,9 +1,9 @@
 #include "header.hpp"
 #include "raster.hpp"
 #include "edge_collapse.hpp"
+#include "collapse_engine.hpp"
 
 #include <CGAL/Polygon_mesh_processing/orientation.h>
-#include <CGAL/Surface_mesh_simplification/Policies/Edge_collapse/Bounded_normal_change_filter.h>
 #include <CGAL/Surface_mesh_simplification/Policies/Edge_collapse/Count_stop_predicate.h>
 
 #include <getopt.h>
@@ -28,6 +28,7 @@ Surface_mesh_info::Surface_mesh_info(OGRSpatialReference crs, double x_0, double
 
 void Surface_mesh_info::save_mesh(const Surface_mesh &mesh, const char *filename) const {
 	Surface_mesh output_mesh (mesh);
+	remove_face_geometry(output_mesh);
 
 	Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> label;
 	bool has_label;
@@ -185,15 +186,19 @@ std::tuple<Surface_mesh, std::tuple<Surface_mesh, Point_set>> compute_meshes(con
 
 	float alpha = 2, beta = 1, gamma = 0.01;
 
+	compute_face_geometry(mesh);
+	Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> face_areas;
+	bool has_face_areas;
+	boost::tie(face_areas, has_face_areas) = mesh.property_map<Surface_mesh::Face_index, K::FT>("f:area");
+	assert(has_face_areas);
+
 	K::FT mean_point_per_area = get_mean_point_per_area(mesh, point_cloud);
 	K::FT min_point_per_area = mean_point_per_area / 2;
 
 	for(auto face: mesh.faces()) {
 		K::FT min_point = 0;
 		if (min_point_per_area > 0) {
-			auto r = mesh.vertices_around_face(mesh.halfedge(face)).begin();
-			K::FT face_area = CGAL::sqrt(K::Triangle_3(mesh.point(*r++), mesh.point(*r++), mesh.point(*r++)).squared_area());
-			min_point = min_point_per_area * face_area;
+			min_point = min_point_per_area * face_areas[face];
 		}	
 		if (point_in_face[face].size() > 0) {
 			if (point_in_face[face].size() > min_point) {
@@ -213,6 +218,7 @@ std::tuple<Surface_mesh, std::tuple<Surface_mesh, Point_set>> compute_meshes(con
 	// Return mesh if coords are in reverse order
 	if ((x_1-x_0)*(y_1-y_0) < 0) {
 		CGAL::Polygon_mesh_processing::reverse_face_orientations(mesh); 	
+		compute_face_geometry(mesh);
 	}
 
 	Cost_stop_predicate stop(5);
@@ -221,7 +227,8 @@ std::tuple<Surface_mesh, std::tuple<Surface_mesh, Point_set>> compute_meshes(con
 	Custom_placement pf(params, mesh, point_cloud);
 	Custom_cost cf(params, alpha, beta, gamma, 0.01, min_point_per_area, mesh, point_cloud);
 	My_visitor mv (params, alpha, beta, gamma, min_point_per_area, mesh, mesh_info, point_cloud);
-	SMS::Bounded_normal_change_filter<> filter;
+	mv.collect_in_parallel(pf, cf);
+	Normal_change_filter filter;
 	SMS::edge_collapse(mesh, stop, CGAL::parameters::get_cost(cf).filter(filter).get_placement(pf).visitor(mv));
 
 	mesh_info.save_mesh(mesh, "final-mesh.ply");
@@ -240,6 +247,11 @@ int main(int argc, char **argv) {
 		{"orthophoto", required_argument, NULL, 'i'},
 		{"mesh", required_argument, NULL, 'M'},
 		{"point_cloud", required_argument, NULL, 'P'},
+		{"link_cluster_radius", required_argument, NULL, 'c'},
+		{"refine_links", no_argument, NULL, 'r'},
+		{"bridge_telemetry", required_argument, NULL, 'T'},
+		{"collapse_chunks", required_argument, NULL, 'k'},
+		{"collapse_engine", required_argument, NULL, 'e'},
 		{NULL, 0, 0, '\0'}
 	};
 
@@ -250,8 +262,13 @@ int main(int argc, char **argv) {
 	char *orthophoto = NULL;
 	char *MESH = NULL;
 	char *POINT_CLOUD = NULL;
+	float link_cluster_radius = 5;
+	bool refine_links = false;
+	char *bridge_telemetry = NULL;
+	int collapse_chunks = 0;
+	std::string collapse_engine = "cgal";
 
-	while ((opt = getopt_long(argc, argv, "hs:t:l:0:i:M:P:", options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "hs:t:l:0:i:M:P:c:rT:k:e:", options, NULL)) != -1) {
 		switch(opt) {
 			case 'h':
 				std::cout << "Usage: " << argv[0] << " [OPTIONS] -s DSM -t DTM -l land_use_map" << std::endl;
@@ -265,6 +282,11 @@ int main(int argc, char **argv) {
 				std::cout << " -i, --orthophoto=/file/path.tiff   RGB orthophoto as TIFF file." << std::endl;
 				std::cout << " -M, --mesh=/file/path.ply          mesh as PLY file." << std::endl;
 				std::cout << " -P, --point_cloud=/file/path.ply   point cloud as PLY file." << std::endl;
+				std::cout << " -c, --link_cluster_radius=5        Radius to cluster nearby links, one bridge is computed per cluster (0 to disable)." << std::endl;
+				std::cout << " -r, --refine_links                 Also compute the other links of the clusters with an accepted bridge." << std::endl;
+				std::cout << " -T, --bridge_telemetry=/file/path  Save bridge solver telemetry in /file/path.csv and /file/path.json." << std::endl;
+				std::cout << " -k, --collapse_chunks=0            Simplify the final mesh by this number of chunks in parallel (0 or 1 to disable)." << std::endl;
+				std::cout << " -e, --collapse_engine=cgal         Simplify the final mesh with SMS::edge_collapse (cgal) or heap_edge_collapse (heap)." << std::endl;
 				return EXIT_SUCCESS;
 				break;
 			case 's':
@@ -288,9 +310,30 @@ int main(int argc, char **argv) {
 			case 'P':
 				POINT_CLOUD = optarg;
 				break;
+			case 'c':
+				link_cluster_radius = atof(optarg);
+				break;
+			case 'r':
+				refine_links = true;
+				break;
+			case 'T':
+				bridge_telemetry = optarg;
+				Bridge_telemetry::enable();
+				break;
+			case 'k':
+				collapse_chunks = atoi(optarg);
+				break;
+			case 'e':
+				collapse_engine = optarg;
+				break;
 		}
 	}
 
+	if (collapse_engine != "cgal" && collapse_engine != "heap") {
+		std::cerr << "Unknown collapse engine " << collapse_engine << ", use cgal or heap" << std::endl;
+		return EXIT_FAILURE;
+	}
+
 	if (DSM == NULL || DTM == NULL || land_use_map == NULL) {
 		std::cerr << "DSM, DTM and land_use_map are mandatory" << std::endl;
 		std::cerr << "Usage: " << argv[0] << " [OPTIONS] -s DSM -t DTM -l land_use_map" << std::endl;
@@ -362,11 +405,13 @@ int main(int argc, char **argv) {
 		std::cout << "Mesh and point cloud associate" << std::endl;
 	}
 
+	compute_face_geometry(mesh);
 	change_vertical_faces(mesh);
 	mesh_info.save_mesh(mesh, "final-mesh-without-facade.ply");
 	std::cout << "Label set for vertical face" << std::endl;
 
 	compute_normal_angle_coef(mesh);
+	remove_face_geometry(mesh);
 	mesh_info.save_mesh(mesh, "final-mesh-with-normal-angle-ceof.ply");
 	std::cout << "Normal angle coef computed" << std::endl;
 
@@ -393,19 +438,39 @@ int main(int argc, char **argv) {
 
 	AABB_tree tree = index_surface_mesh(mesh);
 
+	std::vector<std::vector<pathLink>> link_clusters = cluster_links(links, link_cluster_radius);
+
 	std::vector<pathBridge> bridges_to_add;
 	int i = 0;
-	std::cout << "Computing " << links.size() << " bridges" << std::endl;
-	for (auto link: links) {
-//if (link.first.path != 164 || link.second.path != 309 /*|| abs(link.first.point.x() - 121) > 1 || abs(link.second.point.x() + 110) > 1*/) continue;
-		std::cout << "\rBridge " << i++ << "/" << links.size() << "               ";
+	std::size_t solves = 0;
+	std::cout << "Computing " << link_clusters.size() << " bridges" << std::endl;
+	for (const auto &cluster: link_clusters) {
+		std::cout << "\rBridge " << i++ << "/" << link_clusters.size() << "               ";
 		std::cout.flush();
-		pathBridge bridge_result = bridge(link, mesh, tree, mesh_info);
-		if (bridge_result.cost < 10) {
-			bridges_to_add.push_back(bridge_result);
+		std::vector<pathBridge> candidates;
+		candidates.push_back(bridge(cluster.front(), mesh, tree, mesh_info));
+		solves++;
+		std::size_t best = 0;
+		if (refine_links && candidates[0].cost < 10) {
+			for (std::size_t j = 1; j < cluster.size(); j++) {
+				candidates.push_back(bridge(cluster[j], mesh, tree, mesh_info));
+				solves++;
+				if (candidates[j].cost < candidates[best].cost) best = j;
+			}
+		}
+		if (candidates[best].cost < 10) {
+			bridges_to_add.push_back(candidates[best]);
+		}
+		for (std::size_t j = 0; j < candidates.size(); j++) {
+			Bridge_telemetry::record(candidates[j], j == best && candidates[j].cost < 10);
 		}
 	}
 	std::cout << "\rBridges computed               " << std::endl;
+	if (bridge_telemetry != NULL) {
+		Bridge_telemetry::save_csv((std::string(bridge_telemetry) + ".csv").c_str());
+		Bridge_telemetry::save_json((std::string(bridge_telemetry) + ".json").c_str());
+	}
+	std::cout << links.size() << " links, " << link_clusters.size() << " clusters, " << solves << " solves, " << bridges_to_add.size() << " bridges accepted" << std::endl;
 
 	Surface_mesh::Property_map<Surface_mesh::Edge_index, bool> edge_blocked;
 	bool created_edge_blocked;
@@ -425,6 +490,7 @@ int main(int argc, char **argv) {
 	std::cout << "Bridges added to mesh" << std::endl;
 
 	float alpha = 2, beta = 1, gamma = 0.01;
+	compute_face_geometry(mesh);
 	K::FT mean_point_per_area = get_mean_point_per_area(mesh, point_cloud);
 	K::FT min_point_per_area = mean_point_per_area / 2;
 	Ablation_study ablation (false);
@@ -432,11 +498,22 @@ int main(int argc, char **argv) {
 	Cost_stop_predicate stop(5);
 	//SMS::Count_stop_predicate<Surface_mesh> stop(50);
 	const LindstromTurk_param params (10,1,10,1,0.000001,1,0.01);
-	Custom_placement pf(params, mesh, point_cloud);
-	Custom_cost cf(params, alpha, beta, gamma, 0.01, min_point_per_area, mesh, point_cloud);
-	My_visitor mv (params, alpha, beta, gamma, min_point_per_area, mesh, mesh_info, point_cloud, ablation);
-	SMS::Bounded_normal_change_filter<> filter;
-	SMS::edge_collapse(mesh, stop, CGAL::parameters::get_cost(cf).filter(filter).get_placement(pf).visitor(mv).edge_is_constrained_map(edge_blocked));
+	Normal_change_filter filter;
+	if (collapse_chunks > 1) {
+		Collapse_setup setup (params, alpha, beta, gamma, 0.01, min_point_per_area, mesh_info, point_cloud, ablation);
+		setup.heap_engine = (collapse_engine == "heap");
+		partitioned_edge_collapse(mesh, setup, stop, filter, collapse_chunks, &edge_blocked);
+	} else {
+		Custom_placement pf(params, mesh, point_cloud);
+		Custom_cost cf(params, alpha, beta, gamma, 0.01, min_point_per_area, mesh, point_cloud);
+		My_visitor mv (params, alpha, beta, gamma, min_point_per_area, mesh, mesh_info, point_cloud, ablation);
+		if (collapse_engine == "heap") {
+			heap_edge_collapse(mesh, stop, pf, cf, mv, filter, &edge_blocked);
+		} else {
+			mv.collect_in_parallel(pf, cf);
+			SMS::edge_collapse(mesh, stop, CGAL::parameters::get_cost(cf).filter(filter).get_placement(pf).visitor(mv).edge_is_constrained_map(edge_blocked));
+		}
+	}
 
 	mesh_info.save_mesh(mesh, "final-closed-mesh-with-path-and-bridges-simplified.ply");
 
@@ -1,38 +1,69 @@
 #include "header.hpp"
 #include "edge_collapse.hpp"
+#include "border_points.hpp"
+#include "collapse_engine.hpp"
+#include "distance_kernel.hpp"
+#include "point_location.hpp"
+#include "svm.hpp"
 
 #include <CGAL/Surface_mesh_simplification/Policies/Edge_collapse/GarlandHeckbert_policies.h>
 #include <CGAL/Surface_mesh_simplification/Policies/Edge_collapse/Bounded_normal_change_filter.h>
 #include <CGAL/Surface_mesh_simplification/Policies/Edge_collapse/Count_stop_predicate.h>
 #include <CGAL/random_simplify_point_set.h>
-#include <CGAL/Orthogonal_k_neighbor_search.h>
-#include <CGAL/Search_traits_3.h>
-#include <CGAL/Search_traits_adapter.h>
 #include <CGAL/Polygon_mesh_processing/locate.h>
 #include <CGAL/AABB_tree.h>
 #include <CGAL/AABB_traits.h>
 #include <CGAL/AABB_face_graph_triangle_primitive.h>
 
 #include <getopt.h>
+#include <sys/resource.h>
+#include <functional>
 #include <cstdlib>
+#include <new>
 #include <random>
 #include <filesystem>
 
-typedef CGAL::Search_traits_3<Point_set_kernel>             Traits_base;
-typedef CGAL::Search_traits_adapter<Point_set::Index, Point_set::Point_map, Traits_base> TreeTraits;
-typedef CGAL::Orthogonal_k_neighbor_search<TreeTraits>      Neighbor_search;
-typedef Neighbor_search::Tree                               Point_tree;
-
 typedef CGAL::AABB_face_graph_triangle_primitive<Surface_mesh> AABB_face_graph_primitive;
 typedef CGAL::AABB_traits<K, AABB_face_graph_primitive>        AABB_face_graph_traits;
 typedef CGAL::AABB_tree<AABB_face_graph_traits>                AABB_tree;
 
 namespace PMP = CGAL::Polygon_mesh_processing;
 
+#ifdef COUNT_ALLOCATIONS
+// Count the heap allocations made while evaluating an edge (see Evaluation_statistics)
+void *operator new(std::size_t size) {
+	if (Evaluation_statistics::in_evaluation) Evaluation_statistics::thread_allocations++;
+	if (size == 0) size = 1;
+	if (void *ptr = std::malloc(size)) return ptr;
+	throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+	std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept {
+	std::free(ptr);
+}
+#endif
+
 Surface_mesh_info::Surface_mesh_info() : x_0(0), y_0(0) {}
 
 void Surface_mesh_info::save_mesh(const Surface_mesh &mesh, const char *filename) const {
 	Surface_mesh output_mesh (mesh);
+	remove_face_geometry(output_mesh);
 
 	Surface_mesh::Property_map<Surface_mesh::Face_index, unsigned char> label;
 	bool has_label;
@@ -60,6 +91,17 @@ void Surface_mesh_info::save_mesh(const Surface_mesh &mesh, const char *filename
 	mesh_ofile.close();
 }
 
+// Both meshes have the same vertex positions, whatever their order
+static bool same_vertices(const Surface_mesh &mesh_a, const Surface_mesh &mesh_b) {
+	if (mesh_a.number_of_vertices() != mesh_b.number_of_vertices()) return false;
+	std::vector<Point_3> points_a, points_b;
+	for (const auto &v: mesh_a.vertices()) points_a.push_back(mesh_a.point(v));
+	for (const auto &v: mesh_b.vertices()) points_b.push_back(mesh_b.point(v));
+	std::sort(points_a.begin(), points_a.end());
+	std::sort(points_b.begin(), points_b.end());
+	return points_a == points_b;
+}
+
 int main(int argc, char **argv) {
 	std::ofstream myfile;
 	myfile.open ("commande_line.txt");
@@ -93,6 +135,16 @@ int main(int argc, char **argv) {
 		{"no_border_point", no_argument, NULL, 0},
 		{"save_step_mesh", no_argument, NULL, 0},
 		{"next_mesh", required_argument, NULL, 0},
+		{"round_fraction", required_argument, NULL, 0},
+		{"chunks", required_argument, NULL, 0},
+		{"compare_monolithic", no_argument, NULL, 0},
+		{"record_svm", required_argument, NULL, 0},
+		{"lazy", no_argument, NULL, 0},
+		{"sample_size", required_argument, NULL, 0},
+		{"voxel_subsample", required_argument, NULL, 0},
+		{"compute_on_commit", no_argument, NULL, 0},
+		{"engine", required_argument, NULL, 0},
+		{"compare_cgal", no_argument, NULL, 0},
 		{NULL, 0, 0, '\0'}
 	};
 
@@ -105,6 +157,16 @@ int main(int argc, char **argv) {
 	float min_point_factor = 10;
 	bool subdivide = true, direct_search = true, border_point = true, step_mesh = false;
 	char *next_mesh = NULL;
+	float round_fraction = 0;
+	int chunks = 0;
+	bool compare_monolithic = false;
+	char *record_svm = NULL;
+	bool lazy = false;
+	int sample_size = 0;
+	float voxel_size = 0;
+	bool compute_on_commit = false;
+	std::string engine = "cgal";
+	bool compare_cgal = false;
 
 	while ((opt = getopt_long(argc, argv, "hm:p:", options, &option_index)) != -1) {
 		switch(opt) {
@@ -173,6 +235,36 @@ int main(int argc, char **argv) {
 					case 23:
 						next_mesh = optarg;
 						break;
+					case 24:
+						round_fraction = atof(optarg);
+						break;
+					case 25:
+						chunks = atoi(optarg);
+						break;
+					case 26:
+						compare_monolithic = true;
+						break;
+					case 27:
+						record_svm = optarg;
+						break;
+					case 28:
+						lazy = true;
+						break;
+					case 29:
+						sample_size = atoi(optarg);
+						break;
+					case 30:
+						voxel_size = atof(optarg);
+						break;
+					case 31:
+						compute_on_commit = true;
+						break;
+					case 32:
+						engine = optarg;
+						break;
+					case 33:
+						compare_cgal = true;
+						break;
 				}
 				break;
 			case 'h':
@@ -193,6 +285,18 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	// --lazy and --round_fraction select their engine
+	if (lazy) {
+		engine = "lazy";
+	} else if (round_fraction > 0 && engine == "cgal") {
+		engine = "round";
+	}
+	if (engine != "cgal" && engine != "heap" && engine != "lazy" && engine != "round") {
+		std::cerr << "Unknown engine " << engine << ", use cgal, heap, lazy or round" << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (engine == "round" && round_fraction <= 0) round_fraction = 0.05;
+
 	if (mesh_file == NULL) {
 		std::cerr << "mesh is mandatory" << std::endl;
 		std::cerr << "Usage: " << argv[0] << " [OPTIONS] -m mesh" << std::endl;
@@ -223,6 +327,18 @@ int main(int argc, char **argv) {
 	std::cout << "subdivide=" << int(subdivide) << "\n";
 	std::cout << "direct_search=" << int(direct_search) << "\n";
 	std::cout << "border_point=" << int(border_point) << "\n";
+	if (round_fraction > 0) std::cout << "round_fraction=" << round_fraction << "\n";
+	if (chunks > 1) std::cout << "chunks=" << chunks << "\n";
+	if (lazy) std::cout << "lazy=1\n";
+	if (sample_size > 0) std::cout << "sample_size=" << sample_size << "\n";
+	if (voxel_size > 0) std::cout << "voxel_subsample=" << voxel_size << "\n";
+	if (compute_on_commit) std::cout << "compute_on_commit=1\n";
+	if (engine != "cgal") std::cout << "engine=" << engine << "\n";
+	if (compare_cgal) std::cout << "compare_cgal=1\n";
+	if (record_svm != NULL) {
+		std::cout << "Record SVM problems in " << record_svm << "\n";
+		SVM::record(record_svm);
+	}
 	
 	myfile << "Mesh=" << mesh_file << std::endl;
 	if (point_cloud_file != NULL) {
@@ -342,6 +458,12 @@ int main(int argc, char **argv) {
 	TimerUtils::Timer total_timer;
 	total_timer.start();
 
+	compute_face_geometry(mesh);
+	Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> face_areas;
+	bool has_face_areas;
+	boost::tie(face_areas, has_face_areas) = mesh.property_map<Surface_mesh::Face_index, K::FT>("f:area");
+	assert(has_face_areas);
+
 	K::FT min_point_per_area;
 	if (min_point_factor > 0) {
 		K::FT mean_point_per_area = get_mean_point_per_area(mesh, point_cloud);
@@ -350,6 +472,27 @@ int main(int argc, char **argv) {
 		min_point_per_area = 0;
 	}
 
+	if (voxel_size > 0) {
+		// Keep the border points, when the label preservation uses them, and one point per label and voxel elsewhere
+		bool use_border_points = l6 > 0 && border_point;
+		bool created_point_isborder;
+		Point_set::Property_map<bool> isborder;
+		boost::tie (isborder, created_point_isborder) = point_cloud.add_property_map<bool>("p:isborder", false);
+		if (use_border_points && created_point_isborder) {
+			TimerUtils::Timer border_timer;
+			border_timer.start();
+			bool raster = compute_border_points(point_cloud, isborder);
+			std::cout << "Border points computed" << (raster ? " on the raster" : "") << " in " << border_timer.getElapsedTime() << "s" << std::endl;
+		}
+
+		std::size_t initial_size = point_cloud.size();
+		std::size_t removed = voxel_subsample(point_cloud, voxel_size, isborder);
+		if (initial_size > 0) min_point_per_area *= (K::FT) point_cloud.size() / initial_size;
+		if (!use_border_points && created_point_isborder) point_cloud.remove_property_map(isborder);
+
+		std::cout << "Points subsampled with voxels of " << voxel_size << ": " << removed << " of " << initial_size << " points removed." << std::endl;
+	}
+
 	if (subsample >= 0) {
 		//subsample point cloud
 
@@ -367,7 +510,6 @@ int main(int argc, char **argv) {
 			Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> face_costs;
 			boost::tie(face_costs, created_face_costs) = mesh.add_property_map<Surface_mesh::Face_index, K::FT>("f:cost", 0);
 
-			CGAL::Cartesian_converter<Point_set_kernel,K> type_converter;
 			float alpha = c1;
 			float beta = c2;
 
@@ -376,17 +518,10 @@ int main(int argc, char **argv) {
 			Point_set::Property_map<bool> isborder;
 			boost::tie (isborder, created_point_isborder) = point_cloud.add_property_map<bool>("p:isborder", false);
 			if (border_point && created_point_isborder) {
-				int N = 10;
-				Point_tree point_tree(point_cloud.begin(), point_cloud.end(), Point_tree::Splitter(), TreeTraits(point_cloud.point_map()));
-				Neighbor_search::Distance tr_dist(point_cloud.point_map());
-				for (auto point: point_cloud) {
-					Neighbor_search search(point_tree, point_cloud.point(point), N, 0, true, tr_dist, false);
-					unsigned char l = point_cloud_label[search.begin()->first];
-					for(auto it = search.begin() + 1; it != search.end() && !isborder[point]; ++it) {
-						if (point_cloud_label[it->first] != l) isborder[point] = true;
-					}
-				}
-				std::cout << "Border points computed" << std::endl;
+				TimerUtils::Timer border_timer;
+				border_timer.start();
+				bool raster = compute_border_points(point_cloud, isborder);
+				std::cout << "Border points computed" << (raster ? " on the raster" : "") << " in " << border_timer.getElapsedTime() << "s" << std::endl;
 			}
 
 			// drop points in face to keep only subsample points per face
@@ -408,39 +543,33 @@ int main(int argc, char **argv) {
 
 			if(created_point_in_face) {
 				AABB_tree mesh_tree;
-				PMP::build_AABB_tree(mesh, mesh_tree);
-				for(auto ph: point_cloud) {
-					auto p = type_converter(point_cloud.point(ph));
-					auto location = PMP::locate_with_AABB_tree(p, mesh_tree, mesh);
-					point_in_face[location.first].push_back(ph);
-					if (created_face_costs && alpha > 0) face_costs[location.first] += alpha * CGAL::squared_distance(p, PMP::construct_point(location, mesh));
-				}
+				PointLocation::build_tree(mesh, mesh_tree);
+				PointLocation::associate_points(mesh, mesh_tree, point_cloud, point_in_face, created_face_costs ? &face_costs : nullptr, alpha);
 			} else if (created_face_costs && alpha > 0) {
+				DistanceKernel::Point_batch points;
+				std::vector<float> distances;
 				for (auto face: mesh.faces()) {
 					auto r = mesh.vertices_around_face(mesh.halfedge(face)).begin();
 					K::Triangle_3 triangle_face(mesh.point(*r++), mesh.point(*r++), mesh.point(*r++));
-					for (auto ph: point_in_face[face]) {
-						auto p = type_converter(point_cloud.point(ph));
-						face_costs[face] += alpha * CGAL::squared_distance(p, triangle_face);
+					points.clear();
+					for (auto ph: point_in_face[face]) points.push_back(point_cloud.point(ph));
+					distances.resize(points.size());
+					DistanceKernel::squared_distances(points, DistanceKernel::Triangle(triangle_face), distances.data());
+					for (auto d: distances) {
+						face_costs[face] += alpha * d;
 					}
 				}
 			}
 			if (created_face_costs && beta > 0) {
+				auto face_histograms = compute_face_histograms(mesh, point_cloud);
 				for(auto face: mesh.faces()) {
 					K::FT min_point = 0;
 					if (min_point_per_area > 0) {
-						auto r = mesh.vertices_around_face(mesh.halfedge(face)).begin();
-						K::FT face_area = CGAL::sqrt(K::Triangle_3(mesh.point(*r++), mesh.point(*r++), mesh.point(*r++)).squared_area());
-						min_point = min_point_per_area * face_area;
+						min_point = min_point_per_area * face_areas[face];
 					}
 					if (point_in_face[face].size() > 0) {
 						if (point_in_face[face].size() > min_point) {
-							int face_label[LABELS.size()] = {0};
-							for (auto point: point_in_face[face]) {
-								face_label[point_cloud_label[point]]++;
-							}
-							auto argmax = std::max_element(face_label, face_label+LABELS.size());
-							face_costs[face] += beta * (point_in_face[face].size() - *argmax);
+							face_costs[face] += beta * (point_in_face[face].size() - face_histograms[face].max());
 						} else { // We don't have information about this face.
 							face_costs[face] += beta * point_in_face[face].size();
 						}
@@ -470,19 +599,147 @@ int main(int argc, char **argv) {
 	Custom_placement pf(params, mesh, point_cloud, ablation);
 	Custom_cost cf(params, c1, c2, c3, c4, min_point_per_area, mesh, point_cloud, next_mesh);
 	My_visitor mv(params, c1, c2, c3, min_point_per_area, mesh, mesh_info, point_cloud, ablation);
-	SMS::Bounded_normal_change_filter<> filter;
-	if (ns > 0) {
+	if (compute_on_commit) mv.compute_on_commit(cf);
+	// The lazy engine evaluates the edges only when they reach the top of its queue, the heap engine evaluates them in parallel itself
+	if ((engine != "lazy" && engine != "heap") || chunks > 1) mv.collect_in_parallel(pf, cf);
+	Normal_change_filter filter;
+
+	Surface_mesh cgal_mesh;
+	if (compare_cgal && chunks <= 1 && engine != "cgal") {
+		// Set up the labels, f:points and f:cost once, so that both runs start from the same mesh
+		My_visitor setup_mv(params, c1, c2, c3, min_point_per_area, mesh, mesh_info, point_cloud, ablation);
+		setup_mv.keep_setup();
+		setup_mv.OnStarted(mesh);
+		setup_mv.OnFinished(mesh);
+		mv.reuse_setup();
+		cgal_mesh = mesh;
+	}
+	TimerUtils::Timer engine_timer;
+	engine_timer.start();
+
+	if (chunks > 1) {
+		Surface_mesh monolithic_mesh;
+		if (compare_monolithic) monolithic_mesh = mesh;
+
+		Round_stop_predicate stop;
+		if (ns > 0) {
+			stop = SMS::Count_stop_predicate<Surface_mesh>(ns);
+		} else {
+			stop = Cost_stop_predicate(cs);
+		}
+
+		TimerUtils::Timer partition_timer;
+		partition_timer.start();
+		Collapse_setup setup (params, c1, c2, c3, c4, min_point_per_area, mesh_info, point_cloud, ablation);
+		setup.compute_on_commit = compute_on_commit;
+		setup.heap_engine = (engine == "heap");
+		partitioned_edge_collapse(mesh, setup, stop, filter, chunks);
+		double partition_time = partition_timer.getElapsedTime();
+
+		if (compare_monolithic) {
+			total_timer.pause();
+			TimerUtils::Timer monolithic_timer;
+			monolithic_timer.start();
+			Custom_placement monolithic_pf(params, monolithic_mesh, point_cloud, ablation);
+			Custom_cost monolithic_cf(params, c1, c2, c3, c4, min_point_per_area, monolithic_mesh, point_cloud);
+			My_visitor monolithic_mv(params, c1, c2, c3, min_point_per_area, monolithic_mesh, mesh_info, point_cloud, ablation);
+			if (compute_on_commit) monolithic_mv.compute_on_commit(monolithic_cf);
+			monolithic_mv.collect_in_parallel(monolithic_pf, monolithic_cf);
+			SMS::edge_collapse(monolithic_mesh, stop, CGAL::parameters::get_cost(monolithic_cf).filter(filter).get_placement(monolithic_pf).visitor(monolithic_mv));
+			double monolithic_time = monolithic_timer.getElapsedTime();
+
+			std::cout << "Partitioned: " << mesh.number_of_faces() << " faces, energy " << compute_energy(mesh, point_cloud, c1, c2, c3) << ", " << partition_time << "s" << std::endl;
+			std::cout << "Monolithic: " << monolithic_mesh.number_of_faces() << " faces, energy " << compute_energy(monolithic_mesh, point_cloud, c1, c2, c3) << ", " << monolithic_time << "s" << std::endl;
+			total_timer.resume();
+		}
+	} else if (engine == "lazy") {
+		Lazy_collapse_statistics statistics;
+		if (ns > 0) {
+			SMS::Count_stop_predicate<Surface_mesh> stop(ns);
+			lazy_edge_collapse(mesh, stop, pf, cf, mv, filter, std::max(sample_size, 0), &statistics);
+		} else {
+			Cost_stop_predicate stop(cs);
+			lazy_edge_collapse(mesh, stop, pf, cf, mv, filter, std::max(sample_size, 0), &statistics);
+		}
+		std::cout << "Lower bounds: " << statistics.lower_bounds << ", estimates: " << statistics.estimates << ", evaluations: " << statistics.evaluations << ", collapses: " << statistics.collapses << std::endl;
+	} else if (engine == "round") {
+		Round_collapse_statistics statistics;
+		if (ns > 0) {
+			SMS::Count_stop_predicate<Surface_mesh> stop(ns);
+			round_edge_collapse(mesh, stop, pf, cf, mv, filter, round_fraction, &statistics);
+		} else {
+			Cost_stop_predicate stop(cs);
+			round_edge_collapse(mesh, stop, pf, cf, mv, filter, round_fraction, &statistics);
+		}
+		std::cout << "Rounds: " << statistics.rounds << ", collapses: " << statistics.collapses << ", evaluations: " << statistics.evaluations << std::endl;
+	} else if (engine == "heap") {
+		Heap_collapse_statistics statistics;
+		if (ns > 0) {
+			SMS::Count_stop_predicate<Surface_mesh> stop(ns);
+			heap_edge_collapse(mesh, stop, pf, cf, mv, filter, nullptr, &statistics);
+		} else {
+			Cost_stop_predicate stop(cs);
+			heap_edge_collapse(mesh, stop, pf, cf, mv, filter, nullptr, &statistics);
+		}
+		std::cout << "Evaluations: " << statistics.evaluations << ", stale entries: " << statistics.stale << ", collapses: " << statistics.collapses << std::endl;
+	} else if (ns > 0) {
 		SMS::Count_stop_predicate<Surface_mesh> stop(ns);
 		SMS::edge_collapse(mesh, stop, CGAL::parameters::get_cost(cf).filter(filter).get_placement(pf).visitor(mv));
 	} else {
 		Cost_stop_predicate stop(cs);
 		SMS::edge_collapse(mesh, stop, CGAL::parameters::get_cost(cf).filter(filter).get_placement(pf).visitor(mv));
 	}
+	double engine_time = engine_timer.getElapsedTime();
+
+	if (compare_cgal && chunks <= 1 && engine != "cgal") {
+		// Same run with SMS::edge_collapse on a copy of the input
+		total_timer.pause();
+		TimerUtils::Timer cgal_timer;
+		cgal_timer.start();
+		Custom_placement cgal_pf(params, cgal_mesh, point_cloud, ablation);
+		Custom_cost cgal_cf(params, c1, c2, c3, c4, min_point_per_area, cgal_mesh, point_cloud);
+		My_visitor cgal_mv(params, c1, c2, c3, min_point_per_area, cgal_mesh, mesh_info, point_cloud, ablation);
+		cgal_mv.reuse_setup();
+		if (compute_on_commit) cgal_mv.compute_on_commit(cgal_cf);
+		cgal_mv.collect_in_parallel(cgal_pf, cgal_cf);
+		if (ns > 0) {
+			SMS::Count_stop_predicate<Surface_mesh> stop(ns);
+			SMS::edge_collapse(cgal_mesh, stop, CGAL::parameters::get_cost(cgal_cf).filter(filter).get_placement(cgal_pf).visitor(cgal_mv));
+		} else {
+			Cost_stop_predicate stop(cs);
+			SMS::edge_collapse(cgal_mesh, stop, CGAL::parameters::get_cost(cgal_cf).filter(filter).get_placement(cgal_pf).visitor(cgal_mv));
+		}
+		double cgal_time = cgal_timer.getElapsedTime();
+
+		std::cout << engine << ": " << mesh.number_of_faces() << " faces, energy " << compute_energy(mesh, point_cloud, c1, c2, c3) << ", " << engine_time << "s" << std::endl;
+		std::cout << "cgal: " << cgal_mesh.number_of_faces() << " faces, energy " << compute_energy(cgal_mesh, point_cloud, c1, c2, c3) << ", " << cgal_time << "s" << std::endl;
+		std::cout << "Same vertices as cgal: " << (same_vertices(mesh, cgal_mesh) ? "yes" : "no") << std::endl;
+		total_timer.resume();
+	}
 
 	total_timer.pause();
 	compute_stat(mesh, ablation, total_timer, 0);
 
+	{
+		// ru_maxrss is in kilobytes on Linux
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) == 0) std::cout << "Peak resident set size: " << usage.ru_maxrss / 1024 << " MB" << std::endl;
+	}
+
+#ifdef COUNT_ALLOCATIONS
+	{
+		std::size_t evaluations = Evaluation_statistics::evaluations;
+		std::size_t allocations = Evaluation_statistics::allocations;
+		std::size_t allocating_evaluations = Evaluation_statistics::allocating_evaluations;
+		std::cout << "Edge evaluations: " << evaluations << std::endl;
+		std::cout << "Heap allocations while evaluating: " << allocations << " (" << (evaluations > 0 ? ((float) allocations) / evaluations : 0) << " per edge)" << std::endl;
+		std::cout << "Cost or placement calls with at least one allocation: " << allocating_evaluations << std::endl;
+	}
+#endif
+
 	mesh_info.save_mesh(mesh, "final-mesh.ply");
 
+	if (record_svm != NULL) SVM::stop_recording();
+
 	return EXIT_SUCCESS;
 }
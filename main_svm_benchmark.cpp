@@ -0,0 +1,126 @@
+#include "header.hpp"
+#include "svm.hpp"
+#include "timer.hpp"
+
+#include <getopt.h>
+#include <map>
+#include <tuple>
+
+int main(int argc, char **argv) {
+
+	int opt;
+	const struct option options[] = {
+		{"help", no_argument, NULL, 'h'},
+		{"no_exact", no_argument, NULL, 'n'},
+		{NULL, 0, 0, '\0'}
+	};
+
+	bool exact = true;
+
+	while ((opt = getopt_long(argc, argv, "hn", options, NULL)) != -1) {
+		switch(opt) {
+			case 'h':
+				std::cout << "Usage: " << argv[0] << " [OPTIONS] PROBLEMS" << std::endl;
+				std::cout << "Time the SVM solvers on the problems recorded by do-edge-collapse --record_svm." << std::endl;
+				std::cout << "OPTIONS:" << std::endl;
+				std::cout << " -h, --help         Print this help anq quit." << std::endl;
+				std::cout << " -n, --no_exact     Do not solve the exact QP." << std::endl;
+				return EXIT_SUCCESS;
+				break;
+			case 'n':
+				exact = false;
+				break;
+		}
+	}
+
+	if (optind >= argc) {
+		std::cerr << "Usage: " << argv[0] << " [OPTIONS] PROBLEMS" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	auto problems = SVM::load(argv[optind]);
+	std::cout << problems.size() << " problems" << std::endl;
+
+	TimerUtils::Timer cold_timer, warm_timer, exact_timer;
+	cold_timer.start();
+	cold_timer.pause();
+	warm_timer.start();
+	warm_timer.pause();
+	exact_timer.start();
+	exact_timer.pause();
+
+	std::size_t points = 0;
+	std::size_t cold_methods[3] = {0}, warm_methods[3] = {0};
+	std::size_t disagreements = 0, side_changes = 0;
+	double max_difference = 0;
+
+	// Warm start as in compute_SVM, the points being identified by their coordinates
+	std::map<std::tuple<double, double, double, int>, double> previous;
+
+	std::vector<double> alpha, warm_alpha, exact_alpha;
+	for (auto &problem: problems) {
+		const auto &y = problem.y;
+		std::vector<SVM::Vector> raw = problem.x;
+		auto &x = problem.x;
+		SVM::center(x);
+		points += x.size();
+
+		alpha.assign(x.size(), 0);
+		cold_timer.resume();
+		cold_methods[SVM::solve(x, y, SVM::C, alpha)]++;
+		cold_timer.pause();
+
+		warm_alpha.assign(x.size(), 0);
+		bool warm_start = false;
+		for (std::size_t i = 0; i < x.size(); i++) {
+			auto it = previous.find(std::make_tuple(raw[i][0], raw[i][1], raw[i][2], y[i]));
+			if (it != previous.end()) {
+				warm_alpha[i] = it->second;
+				warm_start = true;
+			}
+		}
+		warm_timer.resume();
+		warm_methods[SVM::solve(x, y, SVM::C, warm_alpha, warm_start)]++;
+		warm_timer.pause();
+
+		previous.clear();
+		if (std::find(warm_alpha.begin(), warm_alpha.end(), SVM::C) == warm_alpha.end()) {
+			for (std::size_t i = 0; i < x.size(); i++) {
+				if (warm_alpha[i] > 0) previous[std::make_tuple(raw[i][0], raw[i][1], raw[i][2], y[i])] = warm_alpha[i];
+			}
+		}
+
+		if (exact) {
+			exact_timer.resume();
+			SVM::solve_exact(x, y, SVM::C, exact_alpha);
+			exact_timer.pause();
+
+			double exact_objective = SVM::dual_objective(x, y, exact_alpha);
+			auto exact_plane = SVM::plane(x, y, SVM::C, exact_alpha);
+			for (const auto &solution: {alpha, warm_alpha}) {
+				double difference = (SVM::dual_objective(x, y, solution) - exact_objective) / (1 + std::abs(exact_objective));
+				if (difference > max_difference) max_difference = difference;
+				if (difference > SVM::OBJECTIVE_TOLERANCE) disagreements++;
+
+				auto plane = SVM::plane(x, y, SVM::C, solution);
+				for (const auto &p: x) {
+					double v = plane.first[0]*p[0] + plane.first[1]*p[1] + plane.first[2]*p[2] + plane.second;
+					double exact_v = exact_plane.first[0]*p[0] + exact_plane.first[1]*p[1] + exact_plane.first[2]*p[2] + exact_plane.second;
+					if ((v < 0) != (exact_v < 0)) side_changes++;
+				}
+			}
+		}
+	}
+
+	std::cout << points << " points" << std::endl;
+	std::cout << "Cold: " << cold_timer.getElapsedTime() << "s (interior point + SMO: " << cold_methods[SVM::INTERIOR_POINT_SMO] << ", exact: " << cold_methods[SVM::EXACT] << ")" << std::endl;
+	std::cout << "Warm: " << warm_timer.getElapsedTime() << "s (warm SMO: " << warm_methods[SVM::WARM_SMO] << ", interior point + SMO: " << warm_methods[SVM::INTERIOR_POINT_SMO] << ", exact: " << warm_methods[SVM::EXACT] << ")" << std::endl;
+	if (exact) {
+		std::cout << "Exact: " << exact_timer.getElapsedTime() << "s" << std::endl;
+		std::cout << "Max relative difference of the dual objective: " << max_difference << std::endl;
+		std::cout << "Solutions beyond " << SVM::OBJECTIVE_TOLERANCE << ": " << disagreements << std::endl;
+		std::cout << "Points changing side: " << side_changes << std::endl;
+	}
+
+	return EXIT_SUCCESS;
+}
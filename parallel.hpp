@@ -0,0 +1,107 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <atomic>
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef CGAL_LINKED_WITH_TBB
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#endif
+
+namespace ParallelUtils {
+
+    /**
+    * Number of threads used by for_each_index when TBB is not available.
+    */
+    inline std::size_t number_of_threads() {
+        std::size_t n = std::thread::hardware_concurrency();
+        return n > 0 ? n : 1;
+    }
+
+    /**
+    * True on a thread running the body of a for_each_index.
+    */
+    inline bool &in_parallel_region() {
+        static thread_local bool in_region = false;
+        return in_region;
+    }
+
+    /**
+    * Marks the calling thread as running the body of a for_each_index.
+    */
+    class Region_guard {
+        bool previous;
+    public:
+        Region_guard() : previous(in_parallel_region()) { in_parallel_region() = true; }
+        ~Region_guard() { in_parallel_region() = previous; }
+    };
+
+    /**
+    * Calls f(i) for each i in [0, n), in parallel and in no particular order.
+    * Uses TBB when CGAL is linked with it, std::thread otherwise.
+    * Calls nested in the body of another for_each_index run sequentially,
+    * so that f can use per-thread buffers without a task of the outer loop
+    * running on the same thread in the meantime.
+    *
+    * @param n Number of indices.
+    * @param f Function called with each index, must be safe to call concurrently.
+    * @param grain Number of consecutive indices handled by a thread at once.
+    */
+    template <typename Function>
+    void for_each_index(std::size_t n, const Function &f, std::size_t grain = 64) {
+        if (n == 0) return;
+        grain = std::max<std::size_t>(grain, 1);
+
+        if (in_parallel_region()) {
+            for (std::size_t i = 0; i < n; i++) f(i);
+            return;
+        }
+
+#ifdef CGAL_LINKED_WITH_TBB
+        tbb::parallel_for(tbb::blocked_range<std::size_t>(0, n, grain), [&f](const tbb::blocked_range<std::size_t> &range) {
+            Region_guard guard;
+            for (std::size_t i = range.begin(); i < range.end(); i++) f(i);
+        });
+#else
+        std::size_t n_threads = std::min(number_of_threads(), (n + grain - 1) / grain);
+        if (n_threads <= 1) {
+            Region_guard guard;
+            for (std::size_t i = 0; i < n; i++) f(i);
+            return;
+        }
+
+        std::atomic<std::size_t> next (0);
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto worker = [&]() {
+            Region_guard guard;
+            try {
+                for (std::size_t begin = next.fetch_add(grain); begin < n; begin = next.fetch_add(grain)) {
+                    std::size_t end = std::min(begin + grain, n);
+                    for (std::size_t i = begin; i < end; i++) f(i);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock (error_mutex);
+                if (!error) error = std::current_exception();
+                next = n;
+            }
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve(n_threads - 1);
+        for (std::size_t t = 1; t < n_threads; t++) threads.emplace_back(worker);
+        worker();
+        for (auto &thread: threads) thread.join();
+
+        if (error) std::rethrow_exception(error);
+#endif
+    }
+}
+
+#endif  /* !PARALLEL_H_ */
@@ -0,0 +1,141 @@
+#ifndef POINT_LOCATION_H_
+#define POINT_LOCATION_H_
+
+#include "header.hpp"
+#include "parallel.hpp"
+
+#include <cstdint>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <CGAL/Polygon_mesh_processing/locate.h>
+
+/*
+ * Location of many points (or rays) on a mesh with an AABB tree.
+ *
+ * The queries are sorted in Morton order so that consecutive queries go
+ * down the same branches of the tree, and run in parallel by chunks of
+ * consecutive queries. The locations are returned in the order of the
+ * queries: accumulating them sequentially afterwards gives the same
+ * result, to the last bit, as the sequential loop over
+ * PMP::locate_with_AABB_tree.
+ */
+namespace PointLocation {
+
+	typedef CGAL::Polygon_mesh_processing::Face_location<Surface_mesh, K::FT> Location;
+
+	// Number of consecutive queries in Morton order located by a thread at once
+	const std::size_t CHUNK = 256;
+
+	// Interleaves the 21 lower bits of x with two zero bits
+	inline std::uint64_t spread_bits(std::uint64_t x) {
+		x &= 0x1fffff;
+		x = (x | x << 32) & 0x1f00000000ffff;
+		x = (x | x << 16) & 0x1f0000ff0000ff;
+		x = (x | x << 8) & 0x100f00f00f00f00f;
+		x = (x | x << 4) & 0x10c30c30c30c30c3;
+		x = (x | x << 2) & 0x1249249249249249;
+		return x;
+	}
+
+	// Morton code of p on a grid of 2^21 cells per axis over bbox
+	inline std::uint64_t morton_code(const K::Point_3 &p, const CGAL::Bbox_3 &bbox) {
+		std::uint64_t code = 0;
+		for (int i = 0; i < 3; i++) {
+			double extent = bbox.max(i) - bbox.min(i);
+			double t = (extent > 0) ? (p[i] - bbox.min(i)) / extent : 0;
+			std::uint64_t cell = (std::uint64_t) std::clamp(t * 0x1fffff, 0., (double) 0x1fffff);
+			code |= spread_bits(cell) << i;
+		}
+		return code;
+	}
+
+	inline const K::Point_3 &query_point(const K::Point_3 &p) { return p; }
+	inline K::Point_3 query_point(const K::Ray_3 &r) { return r.source(); }
+
+	// Positions of the queries sorted by the Morton code of their point (the source of a ray)
+	template <typename Query>
+	std::vector<std::size_t> morton_order(const std::vector<Query> &queries) {
+		CGAL::Bbox_3 bbox;
+		for (const auto &q: queries) bbox += query_point(q).bbox();
+
+		std::vector<std::pair<std::uint64_t, std::size_t>> codes (queries.size());
+		ParallelUtils::for_each_index(queries.size(), [&](std::size_t i) {
+			codes[i] = std::make_pair(morton_code(query_point(queries[i]), bbox), i);
+		}, 4096);
+		std::sort(codes.begin(), codes.end());
+
+		std::vector<std::size_t> order (queries.size());
+		for (std::size_t i = 0; i < codes.size(); i++) order[i] = codes[i].second;
+		return order;
+	}
+
+	/*
+	 * Builds the AABB tree of mesh, with the search tree of the distance
+	 * queries, so that the queries of locate only read it.
+	 */
+	template <typename Tree>
+	void build_tree(const Surface_mesh &mesh, Tree &tree) {
+		CGAL::Polygon_mesh_processing::build_AABB_tree(mesh, tree);
+		tree.accelerate_distance_queries();
+	}
+
+	/*
+	 * PMP::locate_with_AABB_tree for each query, locations[i] being the
+	 * location of queries[i]. The tree must come from build_tree.
+	 */
+	template <typename Query, typename Tree>
+	void locate(const std::vector<Query> &queries, const Tree &tree, const Surface_mesh &mesh, std::vector<Location> &locations) {
+		auto order = morton_order(queries);
+		locations.resize(queries.size());
+		ParallelUtils::for_each_index(queries.size(), [&](std::size_t i) {
+			locations[order[i]] = CGAL::Polygon_mesh_processing::locate_with_AABB_tree(queries[order[i]], tree, mesh);
+		}, CHUNK);
+	}
+
+	template <typename Query, typename Tree>
+	std::vector<Location> locate(const std::vector<Query> &queries, const Tree &tree, const Surface_mesh &mesh) {
+		std::vector<Location> locations;
+		locate(queries, tree, mesh, locations);
+		return locations;
+	}
+
+	/*
+	 * Locates the points of point_cloud on mesh, then appends them to the
+	 * point_in_face list of their face and, if alpha > 0, adds alpha times
+	 * their squared distance to face_costs. The lists and the sums are
+	 * filled sequentially in the order of the point cloud, as the loop
+	 * they replace did.
+	 * Returns the locations, in the order of the point cloud.
+	 */
+	template <typename Tree>
+	std::vector<Location> associate_points(const Surface_mesh &mesh, const Tree &tree, const Point_set &point_cloud, Surface_mesh::Property_map<Surface_mesh::Face_index, std::list<Point_set::Index>> point_in_face, Surface_mesh::Property_map<Surface_mesh::Face_index, K::FT> *face_costs = nullptr, K::FT alpha = 0) {
+		CGAL::Cartesian_converter<Point_set_kernel, K> type_converter;
+		std::vector<Point_set::Index> indices (point_cloud.begin(), point_cloud.end());
+		std::vector<K::Point_3> points (indices.size());
+		for (std::size_t i = 0; i < indices.size(); i++) points[i] = type_converter(point_cloud.point(indices[i]));
+
+		auto locations = locate(points, tree, mesh);
+
+		// Distances computed in parallel in the slot of each point
+		std::vector<K::FT> distances;
+		bool costs = face_costs != nullptr && alpha > 0;
+		if (costs) {
+			distances.resize(points.size());
+			ParallelUtils::for_each_index(points.size(), [&](std::size_t i) {
+				distances[i] = CGAL::squared_distance(points[i], CGAL::Polygon_mesh_processing::construct_point(locations[i], mesh));
+			}, CHUNK);
+		}
+
+		for (std::size_t i = 0; i < indices.size(); i++) {
+			point_in_face[locations[i].first].push_back(indices[i]);
+			if (costs) (*face_costs)[locations[i].first] += alpha * distances[i];
+		}
+
+		return locations;
+	}
+}
+
+#endif  /* !POINT_LOCATION_H_ */
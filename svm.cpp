@@ -0,0 +1,551 @@
+#include "svm.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <fstream>
+#include <limits>
+#include <mutex>
+
+#include <CGAL/QP_models.h>
+#include <CGAL/QP_functions.h>
+
+#ifdef CGAL_USE_GMP
+#include <CGAL/Gmpzf.h>
+typedef CGAL::Gmpzf ET;
+#else
+#include <CGAL/MP_Float.h>
+typedef CGAL::MP_Float ET;
+#endif
+
+typedef CGAL::Quadratic_program<ET>                         Program;
+typedef CGAL::Quadratic_program_solution<ET>                Solution;
+
+namespace SVM {
+
+	static inline double dot(const Vector &a, const Vector &b) {
+		return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+	}
+
+	static Vector compute_w(const std::vector<Vector> &x, const std::vector<int> &y, const std::vector<double> &alpha) {
+		Vector w = {0, 0, 0};
+		for (std::size_t i = 0; i < x.size(); i++) {
+			if (alpha[i] == 0) continue;
+			for (int k = 0; k < 3; k++) w[k] += y[i] * alpha[i] * x[i][k];
+		}
+		return w;
+	}
+
+	bool solve_smo(const std::vector<Vector> &x, const std::vector<int> &y, double c, std::vector<double> &alpha, double tolerance, std::size_t max_iterations, std::size_t *iterations) {
+		const std::size_t n = x.size();
+		assert(y.size() == n);
+		assert(alpha.size() == n);
+		const double TAU = 1e-12;
+
+		if (iterations != nullptr) *iterations = 0;
+		if (n == 0) return true;
+		if (max_iterations == 0) max_iterations = 100 * n + 1000;
+
+		// Kept between the calls, as compute_SVM is called during the edge evaluations
+		thread_local std::vector<double> diagonal, gradient;
+		diagonal.resize(n);
+		gradient.resize(n);
+		for (std::size_t t = 0; t < n; t++) diagonal[t] = dot(x[t], x[t]);
+
+		Vector w = compute_w(x, y, alpha);
+
+		bool converged = false;
+		std::size_t iteration = 0;
+		for (; iteration < max_iterations; iteration++) {
+			// w is updated incrementally, compute it again from time to time
+			if (iteration > 0 && iteration % (10 * n) == 0) w = compute_w(x, y, alpha);
+
+			// i maximises -y G over I_up
+			double g_max = -std::numeric_limits<double>::infinity();
+			std::size_t i = n;
+			for (std::size_t t = 0; t < n; t++) {
+				gradient[t] = y[t] * dot(w, x[t]) - 1;
+				if (y[t] > 0 ? alpha[t] < c : alpha[t] > 0) {
+					if (-y[t] * gradient[t] >= g_max) {
+						g_max = -y[t] * gradient[t];
+						i = t;
+					}
+				}
+			}
+
+			// j gives the largest decrease of the objective over I_low
+			double g_max2 = -std::numeric_limits<double>::infinity();
+			double objective_min = std::numeric_limits<double>::infinity();
+			std::size_t j = n;
+			for (std::size_t t = 0; t < n; t++) {
+				if (y[t] > 0 ? alpha[t] > 0 : alpha[t] < c) {
+					double g = y[t] * gradient[t];
+					if (g >= g_max2) g_max2 = g;
+					double b = g_max + g;
+					if (b > 0) {
+						double a = diagonal[i] + diagonal[t] - 2 * dot(x[i], x[t]);
+						if (a <= 0) a = TAU;
+						if (-b*b/a <= objective_min) {
+							objective_min = -b*b/a;
+							j = t;
+						}
+					}
+				}
+			}
+
+			if (i == n || j == n || g_max + g_max2 < tolerance) {
+				converged = true;
+				break;
+			}
+
+			double old_alpha_i = alpha[i], old_alpha_j = alpha[j];
+			double Q_ij = y[i] * y[j] * dot(x[i], x[j]);
+			if (y[i] != y[j]) {
+				double a = diagonal[i] + diagonal[j] + 2 * Q_ij;
+				if (a <= 0) a = TAU;
+				double delta = (-gradient[i] - gradient[j]) / a;
+				double diff = alpha[i] - alpha[j];
+				alpha[i] += delta;
+				alpha[j] += delta;
+				if (diff > 0) {
+					if (alpha[j] < 0) {
+						alpha[j] = 0;
+						alpha[i] = diff;
+					}
+				} else {
+					if (alpha[i] < 0) {
+						alpha[i] = 0;
+						alpha[j] = -diff;
+					}
+				}
+				if (diff > 0) {
+					if (alpha[i] > c) {
+						alpha[i] = c;
+						alpha[j] = c - diff;
+					}
+				} else {
+					if (alpha[j] > c) {
+						alpha[j] = c;
+						alpha[i] = c + diff;
+					}
+				}
+			} else {
+				double a = diagonal[i] + diagonal[j] - 2 * Q_ij;
+				if (a <= 0) a = TAU;
+				double delta = (gradient[i] - gradient[j]) / a;
+				double sum = alpha[i] + alpha[j];
+				alpha[i] -= delta;
+				alpha[j] += delta;
+				if (sum > c) {
+					if (alpha[i] > c) {
+						alpha[i] = c;
+						alpha[j] = sum - c;
+					}
+				} else {
+					if (alpha[j] < 0) {
+						alpha[j] = 0;
+						alpha[i] = sum;
+					}
+				}
+				if (sum > c) {
+					if (alpha[j] > c) {
+						alpha[j] = c;
+						alpha[i] = sum - c;
+					}
+				} else {
+					if (alpha[i] < 0) {
+						alpha[i] = 0;
+						alpha[j] = sum;
+					}
+				}
+			}
+
+			double delta_i = (alpha[i] - old_alpha_i) * y[i], delta_j = (alpha[j] - old_alpha_j) * y[j];
+			for (int k = 0; k < 3; k++) w[k] += delta_i * x[i][k] + delta_j * x[j][k];
+		}
+
+		if (iterations != nullptr) *iterations = iteration;
+		return converged;
+	}
+
+	bool solve_interior_point(const std::vector<Vector> &x, const std::vector<int> &y, double c, std::vector<double> &alpha, std::size_t max_iterations, std::size_t *iterations) {
+		const std::size_t n = x.size();
+		assert(y.size() == n);
+		const double GAP = 1e-10;
+		const double STEP = 0.995;
+
+		if (iterations != nullptr) *iterations = 0;
+
+		// With a single class, sum(y alpha) = 0 gives alpha = 0
+		std::size_t positives = std::count_if(y.begin(), y.end(), [](int v) { return v > 0; });
+		if (positives == 0 || positives == n) {
+			alpha.assign(n, 0);
+			return true;
+		}
+
+		// Lagrange multipliers of alpha >= 0 (s), alpha <= c (r) and sum(y alpha) = 0 (lambda)
+		thread_local std::vector<double> a, s, r, last_s, last_r;
+		a.assign(n, c/2);
+		s.assign(n, 1);
+		r.assign(n, 1);
+		double lambda = 0;
+
+		thread_local std::vector<double> residual, d, h, m_h, m_y, da, ds, dr, da_affine, ds_affine, dr_affine;
+		for (auto v: {&residual, &d, &h, &m_h, &m_y, &da, &ds, &dr, &da_affine, &ds_affine, &dr_affine}) v->resize(n);
+		double dlambda;
+
+		// (D + Z Z^T)^-1 v with Z = (y_i x_i) and D = diag(d), by Sherman-Morrison-Woodbury
+		double L[3][3];
+		auto solve_newton = [&](const std::vector<double> &v, std::vector<double> &out) {
+			double u[3] = {0, 0, 0};
+			for (std::size_t i = 0; i < n; i++) {
+				for (int k = 0; k < 3; k++) u[k] += y[i] * x[i][k] * v[i] / d[i];
+			}
+			// L L^T q = u
+			for (int k = 0; k < 3; k++) {
+				for (int l = 0; l < k; l++) u[k] -= L[k][l] * u[l];
+				u[k] /= L[k][k];
+			}
+			for (int k = 2; k >= 0; k--) {
+				for (int l = k + 1; l < 3; l++) u[k] -= L[l][k] * u[l];
+				u[k] /= L[k][k];
+			}
+			for (std::size_t i = 0; i < n; i++) {
+				out[i] = (v[i] - y[i] * dot(x[i], {u[0], u[1], u[2]})) / d[i];
+			}
+		};
+
+		double mu, rp;
+		auto direction = [&](double sigma, bool corrector) {
+			for (std::size_t i = 0; i < n; i++) {
+				double t = c - a[i];
+				ds[i] = - a[i] * s[i] + sigma * mu - (corrector ? da_affine[i] * ds_affine[i] : 0);
+				dr[i] = - t * r[i] + sigma * mu + (corrector ? da_affine[i] * dr_affine[i] : 0);
+				h[i] = - residual[i] + ds[i] / a[i] - dr[i] / t;
+			}
+			solve_newton(h, m_h);
+			double y_m_h = 0, y_m_y = 0;
+			for (std::size_t i = 0; i < n; i++) {
+				y_m_h += y[i] * m_h[i];
+				y_m_y += y[i] * m_y[i];
+			}
+			dlambda = (y_m_h + rp) / y_m_y;
+			for (std::size_t i = 0; i < n; i++) {
+				da[i] = m_h[i] - dlambda * m_y[i];
+				ds[i] = (ds[i] - s[i] * da[i]) / a[i];
+				dr[i] = (dr[i] + r[i] * da[i]) / (c - a[i]);
+			}
+		};
+
+		// Longest steps keeping the variables and their multipliers inside the bounds
+		auto step_length = [&]() {
+			double primal = 1, dual = 1;
+			for (std::size_t i = 0; i < n; i++) {
+				if (da[i] < 0) primal = std::min(primal, -a[i] / da[i]);
+				if (da[i] > 0) primal = std::min(primal, (c - a[i]) / da[i]);
+				if (ds[i] < 0) dual = std::min(dual, -s[i] / ds[i]);
+				if (dr[i] < 0) dual = std::min(dual, -r[i] / dr[i]);
+			}
+			return std::make_pair(primal, dual);
+		};
+
+		bool converged = false;
+		bool finite = false;
+		std::size_t iteration = 0;
+		for (; iteration < max_iterations; iteration++) {
+			Vector w = compute_w(x, y, a);
+			double sum = 0;
+			rp = 0;
+			mu = 0;
+			for (std::size_t i = 0; i < n; i++) {
+				residual[i] = y[i] * dot(w, x[i]) - 1 + lambda * y[i] - s[i] + r[i];
+				rp += y[i] * a[i];
+				mu += a[i] * s[i] + (c - a[i]) * r[i];
+				sum += a[i];
+			}
+			mu /= 2 * n;
+			double objective = dot(w, w) / 2 - sum;
+
+			// Close to the optimum, the Newton system is badly conditioned: keep the last finite iterate
+			if (!std::isfinite(mu) || !std::isfinite(objective)) break;
+			alpha = a;
+			last_s = s;
+			last_r = r;
+			finite = true;
+			if (2 * n * mu < GAP * (1 + std::abs(objective))) {
+				converged = true;
+				break;
+			}
+
+			double B[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+			for (std::size_t i = 0; i < n; i++) {
+				d[i] = s[i] / a[i] + r[i] / (c - a[i]);
+				for (int k = 0; k < 3; k++) {
+					for (int l = 0; l <= k; l++) B[k][l] += x[i][k] * x[i][l] / d[i];
+				}
+			}
+			for (int k = 0; k < 3; k++) {
+				for (int l = 0; l <= k; l++) {
+					double v = B[k][l];
+					for (int m = 0; m < l; m++) v -= L[k][m] * L[l][m];
+					L[k][l] = (k == l) ? std::sqrt(v) : v / L[l][l];
+				}
+			}
+			std::vector<double> &y_double = h;
+			for (std::size_t i = 0; i < n; i++) y_double[i] = y[i];
+			solve_newton(y_double, m_y);
+
+			// Predictor
+			direction(0, false);
+			auto step = step_length();
+			double mu_affine = 0;
+			for (std::size_t i = 0; i < n; i++) {
+				mu_affine += (a[i] + step.first * da[i]) * (s[i] + step.second * ds[i]) + (c - a[i] - step.first * da[i]) * (r[i] + step.second * dr[i]);
+			}
+			mu_affine /= 2 * n;
+			double sigma = std::pow(mu_affine / mu, 3);
+
+			// Corrector
+			da_affine.swap(da);
+			ds_affine.swap(ds);
+			dr_affine.swap(dr);
+			direction(sigma, true);
+			step = step_length();
+			double primal = std::min(1., STEP * step.first), dual = std::min(1., STEP * step.second);
+			for (std::size_t i = 0; i < n; i++) {
+				a[i] += primal * da[i];
+				s[i] += dual * ds[i];
+				r[i] += dual * dr[i];
+			}
+			lambda += dual * dlambda;
+		}
+
+		// Not even the starting point is finite: alpha = 0 is feasible, leave the rest to SMO
+		if (!finite) {
+			alpha.assign(n, 0);
+			if (iterations != nullptr) *iterations = iteration;
+			return false;
+		}
+
+		// The multiplier of a bound going to zero means the variable does not
+		for (std::size_t i = 0; i < n; i++) {
+			if (alpha[i] < last_s[i]) {
+				alpha[i] = 0;
+			} else if (c - alpha[i] < last_r[i]) {
+				alpha[i] = c;
+			}
+		}
+		project(y, c, alpha);
+
+		if (iterations != nullptr) *iterations = iteration;
+		return converged;
+	}
+
+	Method solve(const std::vector<Vector> &x, const std::vector<int> &y, double c, std::vector<double> &alpha, bool warm_start) {
+		if (warm_start) {
+			project(y, c, alpha);
+			if (solve_smo(x, y, c, alpha, TOLERANCE, x.size() + 100)) return WARM_SMO;
+		}
+		solve_interior_point(x, y, c, alpha);
+		if (solve_smo(x, y, c, alpha)) return INTERIOR_POINT_SMO;
+		solve_exact(x, y, c, alpha);
+		return EXACT;
+	}
+
+	bool solve_exact(const std::vector<Vector> &x, const std::vector<int> &y, double c, std::vector<double> &alpha) {
+		assert(x.size() == y.size());
+
+		Program qp (CGAL::EQUAL, true, 0, true, c);
+
+		for (std::size_t i = x.size() - 1; i < x.size(); i--) {
+			qp.set_d(i, i, dot(x[i], x[i]));
+			for (std::size_t j = 0; j < i; j++) {
+				qp.set_d(i, j, y[i] * y[j] * dot(x[i], x[j]));
+			}
+			qp.set_c(i, -1);
+			qp.set_a(i, 0,  y[i]);
+		}
+		Solution s = CGAL::solve_quadratic_program(qp, ET());
+		assert (s.solves_quadratic_program(qp));
+
+		alpha.resize(x.size());
+		auto value = s.variable_values_begin();
+		for (std::size_t i = 0; i < x.size(); i++) {
+			alpha[i] = CGAL::to_double(*(value++));
+		}
+		return s.solves_quadratic_program(qp);
+	}
+
+	void project(const std::vector<int> &y, double c, std::vector<double> &alpha) {
+		double positive = 0, negative = 0;
+		for (std::size_t i = 0; i < alpha.size(); i++) {
+			alpha[i] = std::min(std::max(alpha[i], 0.), c);
+			if (y[i] > 0) {
+				positive += alpha[i];
+			} else {
+				negative += alpha[i];
+			}
+		}
+		if (positive == negative) return;
+		int heaviest = positive > negative ? 1 : -1;
+		double scale = positive > negative ? negative / positive : positive / negative;
+		for (std::size_t i = 0; i < alpha.size(); i++) {
+			if (y[i] == heaviest) alpha[i] *= scale;
+		}
+	}
+
+	double dual_objective(const std::vector<Vector> &x, const std::vector<int> &y, const std::vector<double> &alpha) {
+		Vector w = compute_w(x, y, alpha);
+		double sum = 0;
+		for (const auto &a: alpha) sum += a;
+		return dot(w, w) / 2 - sum;
+	}
+
+	std::pair<Vector, double> plane(const std::vector<Vector> &x, const std::vector<int> &y, double c, const std::vector<double> &alpha, float *quality) {
+		Vector w = compute_w(x, y, alpha);
+
+		double b = 0;
+		int count = 0;
+		double min_positive = std::numeric_limits<double>::max();
+		double max_negative = std::numeric_limits<double>::lowest();
+		for (std::size_t i = 0; i < x.size(); i++) {
+			double v = dot(w, x[i]);
+			if (y[i] > 0 && v < min_positive) min_positive = v;
+			if (y[i] < 0 && v > max_negative) max_negative = v;
+		}
+		if (max_negative < min_positive) {
+			b += - (max_negative + min_positive) / 2;
+			count = 1;
+		}
+		if (count == 0) {
+			for (std::size_t i = 0; i < x.size(); i++) {
+				if (alpha[i] > 0 && alpha[i] < c) {
+					b += y[i] - dot(w, x[i]);
+					count++;
+				}
+			}
+		}
+		if (count == 0) {
+			for (std::size_t i = 0; i < x.size(); i++) {
+				if (alpha[i] > 0) {
+					b += y[i] - dot(w, x[i]);
+					count++;
+				}
+			}
+		}
+		if (count == 0) {
+			for (std::size_t i = 0; i < x.size(); i++) {
+				b += y[i] - dot(w, x[i]);
+				count++;
+			}
+		}
+		assert(count > 0);
+		b /= count;
+
+		if (quality != nullptr) {
+			*quality = 0;
+			for (std::size_t i = 0; i < x.size(); i++) {
+				if (alpha[i] > 0) {
+					double v = dot(w, x[i]);
+					if (y[i] > 0 && v < -b) *quality += 1;
+					if (y[i] < 0 && v > -b) *quality += 1;
+				}
+			}
+			*quality = 1 - *quality/x.size();
+		}
+
+		return std::make_pair(w, b);
+	}
+
+	Vector center(std::vector<Vector> &x) {
+		Vector mean = {0, 0, 0};
+		for (const auto &p: x) {
+			for (int k = 0; k < 3; k++) mean[k] += p[k];
+		}
+		if (x.size() > 0) {
+			for (int k = 0; k < 3; k++) mean[k] /= x.size();
+		}
+		for (auto &p: x) {
+			for (int k = 0; k < 3; k++) p[k] -= mean[k];
+		}
+		return mean;
+	}
+
+	static std::mutex record_mutex;
+	static std::ofstream *record_file = nullptr;
+	static std::atomic<bool> recording (false);
+
+	void record(const char *filename) {
+		std::lock_guard<std::mutex> lock (record_mutex);
+		delete record_file;
+		record_file = new std::ofstream(filename, std::ios::app);
+		record_file->precision(17);
+		recording = true;
+	}
+
+	void stop_recording() {
+		std::lock_guard<std::mutex> lock (record_mutex);
+		delete record_file;
+		record_file = nullptr;
+		recording = false;
+	}
+
+	static void record_problem(const std::vector<Vector> &x, const std::vector<int> &y) {
+		if (!recording) return;
+		std::lock_guard<std::mutex> lock (record_mutex);
+		if (record_file == nullptr) return;
+		*record_file << x.size() << "\n";
+		for (std::size_t i = 0; i < x.size(); i++) {
+			*record_file << x[i][0] << " " << x[i][1] << " " << x[i][2] << " " << y[i] << "\n";
+		}
+	}
+
+	std::vector<Problem> load(const char *filename) {
+		std::vector<Problem> problems;
+		std::ifstream file (filename);
+		std::size_t n;
+		while (file >> n) {
+			Problem problem;
+			problem.x.resize(n);
+			problem.y.resize(n);
+			for (std::size_t i = 0; i < n; i++) {
+				file >> problem.x[i][0] >> problem.x[i][1] >> problem.x[i][2] >> problem.y[i];
+			}
+			if (!file) break;
+			problems.push_back(std::move(problem));
+		}
+		return problems;
+	}
+}
+
+std::pair<K::Vector_3, K::FT> compute_SVM(const std::vector<Point_set::Index> &points_for_svm, const std::vector<int> &y, const Point_set &point_cloud, float * quality) {
+	assert(points_for_svm.size() == y.size());
+
+	thread_local std::vector<SVM::Vector> x;
+	thread_local std::vector<double> alpha;
+	x.resize(points_for_svm.size());
+	for (std::size_t i = 0; i < points_for_svm.size(); i++) {
+		const auto &p = point_cloud.point(points_for_svm[i]);
+		x[i] = {p.x(), p.y(), p.z()};
+	}
+	SVM::record_problem(x, y);
+	SVM::Vector mean = SVM::center(x);
+
+	alpha.assign(points_for_svm.size(), 0);
+	SVM::solve(x, y, SVM::C, alpha);
+
+	auto plane = SVM::plane(x, y, SVM::C, alpha, quality);
+
+#ifdef CHECK_SVM
+	std::vector<double> exact_alpha;
+	SVM::solve_exact(x, y, SVM::C, exact_alpha);
+	double objective = SVM::dual_objective(x, y, alpha);
+	double exact_objective = SVM::dual_objective(x, y, exact_alpha);
+	if (objective - exact_objective > SVM::OBJECTIVE_TOLERANCE * (1 + std::abs(exact_objective))) {
+		std::cerr << "SVM of " << x.size() << " points: dual objective " << objective << " instead of " << exact_objective << "\n";
+	}
+#endif
+
+	// Back to the original coordinates
+	double b = plane.second - SVM::dot(plane.first, mean);
+	return std::pair<K::Vector_3, K::FT>(K::Vector_3(plane.first[0], plane.first[1], plane.first[2]), -b);
+}
@@ -0,0 +1,114 @@
+#ifndef SVM_H_
+#define SVM_H_
+
+#include "header.hpp"
+
+#include <array>
+#include <vector>
+
+/*
+ * Linear soft margin SVM separating the points with y = 1 from the points
+ * with y = -1. Returns the plane (w, d) with w.p = d.
+ * If quality is given, it gets the fraction of the points not being a
+ * misclassified support vector.
+ *
+ * The dual is solved in double precision by SVM::solve. Define CHECK_SVM
+ * to compare every solution with the exact QP.
+ */
+std::pair<K::Vector_3, K::FT> compute_SVM(const std::vector<Point_set::Index> &points_for_svm, const std::vector<int> &y, const Point_set &point_cloud, float *quality = nullptr);
+
+/*
+ * Dual of the linear soft margin SVM:
+ *   min 1/2 |sum(y_i alpha_i x_i)|^2 - sum(alpha_i)
+ *   with sum(y_i alpha_i) = 0 and 0 <= alpha_i <= c
+ * The solution does not depend on a translation of the points, they should
+ * be centered before solving.
+ */
+namespace SVM {
+
+	// Regularisation of the soft margin
+	const double C = 10000;
+
+	// SMO stops when the maximal violation of the KKT conditions, in units
+	// of the margin, is below this tolerance (the default of LIBSVM)
+	const double TOLERANCE = 1e-3;
+
+	// Relative difference of the dual objective with the exact QP above
+	// which CHECK_SVM and svm-benchmark report a disagreement. SMO at
+	// TOLERANCE gave differences below 1e-7, and up to 4e-5 from a warm
+	// start, on random problems of up to 300 points.
+	const double OBJECTIVE_TOLERANCE = 1e-4;
+
+	typedef std::array<double, 3> Vector;
+
+	struct Problem {
+		std::vector<Vector> x;
+		std::vector<int> y;
+	};
+
+	enum Method {
+		WARM_SMO,
+		INTERIOR_POINT_SMO,
+		EXACT
+	};
+
+	/*
+	 * Solver used by compute_SVM. The interior point method gives a
+	 * starting point close to the optimum to SMO, the exact QP is the last
+	 * resort if SMO does not converge from it.
+	 *
+	 * If warm_start, SMO first starts from alpha (made feasible by project)
+	 * and gets about one pass over the points. compute_SVM does not use it:
+	 * on problems sharing most of their points with the previous one, the
+	 * failed attempts cost more than the successful ones save (see
+	 * svm-benchmark).
+	 * Returns the method which gave the solution.
+	 */
+	Method solve(const std::vector<Vector> &x, const std::vector<int> &y, double c, std::vector<double> &alpha, bool warm_start = false);
+
+	/*
+	 * SMO with the second order working set selection of LIBSVM (Fan, Chen
+	 * and Lin 2005). As the kernel is linear, w is kept up to date and the
+	 * gradient is computed from it, in O(n) per iteration without any
+	 * kernel matrix.
+	 *
+	 * alpha is the starting point, it must be feasible.
+	 * Returns false if the tolerance is not reached after max_iterations
+	 * (100 n + 1000 if 0).
+	 */
+	bool solve_smo(const std::vector<Vector> &x, const std::vector<int> &y, double c, std::vector<double> &alpha, double tolerance = TOLERANCE, std::size_t max_iterations = 0, std::size_t *iterations = nullptr);
+
+	/*
+	 * Mehrotra predictor-corrector interior point method. The kernel
+	 * matrix has rank 3, so each Newton step is solved in O(n) with the
+	 * Sherman-Morrison-Woodbury formula and a 3x3 system. It converges in
+	 * a few tens of iterations whatever c, where SMO can need millions on
+	 * points which are not separable, but never reaches the bounds: the
+	 * variables going to a bound are set to it at the end.
+	 * Returns false if the duality gap is not small enough.
+	 */
+	bool solve_interior_point(const std::vector<Vector> &x, const std::vector<int> &y, double c, std::vector<double> &alpha, std::size_t max_iterations = 50, std::size_t *iterations = nullptr);
+
+	// Exact QP of CGAL, as in the original implementation. Returns false if CGAL gives no solution
+	bool solve_exact(const std::vector<Vector> &x, const std::vector<int> &y, double c, std::vector<double> &alpha);
+
+	// Clamps alpha to [0, c] and scales down the alpha of the heaviest class so that sum(y alpha) = 0
+	void project(const std::vector<int> &y, double c, std::vector<double> &alpha);
+
+	double dual_objective(const std::vector<Vector> &x, const std::vector<int> &y, const std::vector<double> &alpha);
+
+	// Plane (w, b) with w.x + b = 0 from the dual solution
+	std::pair<Vector, double> plane(const std::vector<Vector> &x, const std::vector<int> &y, double c, const std::vector<double> &alpha, float *quality = nullptr);
+
+	// Moves the points so that their mean is at the origin, returns the mean
+	Vector center(std::vector<Vector> &x);
+
+	// Appends every problem solved by compute_SVM to filename, until stop_recording
+	void record(const char *filename);
+	void stop_recording();
+
+	// Reads the problems written by record
+	std::vector<Problem> load(const char *filename);
+}
+
+#endif  /* !SVM_H_ */
@@ -0,0 +1,82 @@
+#include "../border_points.hpp"
+
+#include <array>
+#include <random>
+
+#include <CGAL/Orthogonal_k_neighbor_search.h>
+#include <CGAL/Search_traits_3.h>
+#include <CGAL/Search_traits_adapter.h>
+
+typedef CGAL::Search_traits_3<Point_set_kernel> Traits_base;
+typedef CGAL::Search_traits_adapter<Point_set::Index, Point_set::Point_map, Traits_base> TreeTraits;
+typedef CGAL::Orthogonal_k_neighbor_search<TreeTraits> Neighbor_search;
+typedef Neighbor_search::Tree Point_tree;
+
+/*
+ * Random points in a box of width x height x depth, labelled by stripes
+ * along X with some noise. The coordinates are random doubles, so no two
+ * neighbours are at the same distance and the grid search must give the
+ * result of the kd-tree exactly.
+ */
+static Point_set random_cloud(std::mt19937 &generator, std::size_t n, double width, double height, double depth) {
+	std::uniform_real_distribution<double> x (0, width), y (0, height), z (0, depth), noise (0, 1);
+	Point_set point_cloud;
+	Point_set::Property_map<unsigned char> label;
+	bool created;
+	boost::tie(label, created) = point_cloud.add_property_map<unsigned char>("p:label", 0);
+	assert(created);
+	for (std::size_t k = 0; k < n; k++) {
+		auto ph = *point_cloud.insert(Point_set_kernel::Point_3(x(generator), y(generator), z(generator)));
+		double stripe = point_cloud.point(ph).x() / width * 8;
+		label[ph] = ((int) stripe) % 3 + (noise(generator) < 0.05 ? 1 : 0);
+	}
+	return point_cloud;
+}
+
+// Number of points whose border flag differs from the one of the kd-tree
+static std::size_t differences(const Point_set &point_cloud) {
+	Point_set::Property_map<unsigned char> label = point_cloud.property_map<unsigned char>("p:label").first;
+	Point_set copy (point_cloud);
+	Point_set::Property_map<bool> isborder;
+	bool created;
+	boost::tie(isborder, created) = copy.add_property_map<bool>("p:isborder", false);
+	assert(created);
+	compute_border_points(copy, isborder);
+
+	Point_tree point_tree (point_cloud.begin(), point_cloud.end(), Point_tree::Splitter(), TreeTraits(point_cloud.point_map()));
+	Neighbor_search::Distance tr_dist (point_cloud.point_map());
+	std::size_t count = 0;
+	for (const auto &ph: point_cloud) {
+		Neighbor_search search (point_tree, point_cloud.point(ph), BORDER_NEIGHBOURS, 0, true, tr_dist, false);
+		unsigned char l = label[search.begin()->first];
+		bool tree_border = false;
+		for (auto it = search.begin() + 1; it != search.end() && !tree_border; ++it) {
+			if (label[it->first] != l) tree_border = true;
+		}
+		if (tree_border != isborder[ph]) count++;
+	}
+	return count;
+}
+
+int main() {
+	std::mt19937 generator (42);
+	bool failed = false;
+
+	// Square, then clouds elongated enough for the columns or the rows of the grid to be capped
+	const std::vector<std::pair<const char *, std::array<double, 3>>> boxes = {
+		{"square", {100, 100, 10}},
+		{"wide", {1000, 0.01, 1}},
+		{"tall", {0.01, 1000, 1}},
+		{"small", {1, 1, 0}}
+	};
+	for (const auto &box: boxes) {
+		for (std::size_t n: {20, 5000}) {
+			Point_set point_cloud = random_cloud(generator, n, box.second[0], box.second[1], box.second[2]);
+			std::size_t d = differences(point_cloud);
+			std::cout << box.first << ", " << n << " points: " << d << " border points differ from the kd-tree" << std::endl;
+			if (d > 0) failed = true;
+		}
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,182 @@
+#include "../distance_kernel.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#include <CGAL/squared_distance_3.h>
+
+// Same float, to the last bit (any NaN equals any NaN)
+static bool same_bits(float a, float b) {
+	if (a != a && b != b) return true;
+	return std::memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+// Random triangles and degenerate ones: flat, collinear, with two or three equal vertices
+static std::vector<K::Triangle_3> test_triangles(std::mt19937 &generator) {
+	std::uniform_real_distribution<float> coordinate (-10, 10);
+	auto random_point = [&]() {
+		return K::Point_3(coordinate(generator), coordinate(generator), coordinate(generator));
+	};
+
+	std::vector<K::Triangle_3> triangles;
+	for (int i = 0; i < 200; i++) {
+		triangles.emplace_back(random_point(), random_point(), random_point());
+	}
+	for (int i = 0; i < 50; i++) {
+		K::Point_3 a = random_point(), b = random_point();
+		triangles.emplace_back(a, b, K::Point_3(a.x(), b.y(), a.z()));
+		triangles.emplace_back(a, b, CGAL::midpoint(a, b));
+		triangles.emplace_back(a, a, b);
+		triangles.emplace_back(a, b, b);
+		triangles.emplace_back(a, a, a);
+	}
+	return triangles;
+}
+
+// Random points and the vertices, edge midpoints and centroid of the triangle
+static void test_points(std::mt19937 &generator, const K::Triangle_3 &triangle, DistanceKernel::Point_batch &points) {
+	std::uniform_real_distribution<float> coordinate (-12, 12);
+	points.clear();
+	for (int i = 0; i < 61; i++) {
+		points.push_back(K::Point_3(coordinate(generator), coordinate(generator), coordinate(generator)));
+	}
+	for (int i = 0; i < 3; i++) {
+		points.push_back(triangle.vertex(i));
+		points.push_back(CGAL::midpoint(triangle.vertex(i), triangle.vertex(i + 1)));
+	}
+	points.push_back(CGAL::centroid(triangle));
+}
+
+// Mismatches of squared_distances and squared_distance with CGAL
+static std::size_t distance_mismatches(std::mt19937 &generator, std::size_t &count) {
+	std::size_t mismatches = 0;
+	DistanceKernel::Point_batch points;
+	std::vector<float> d;
+	for (const auto &triangle: test_triangles(generator)) {
+		DistanceKernel::Triangle kernel_triangle (triangle);
+		// CGAL on the float vertices the kernel works with
+		K::Triangle_3 float_triangle (K::Point_3(kernel_triangle.t0[0], kernel_triangle.t0[1], kernel_triangle.t0[2]), K::Point_3(kernel_triangle.t1[0], kernel_triangle.t1[1], kernel_triangle.t1[2]), K::Point_3(kernel_triangle.t2[0], kernel_triangle.t2[1], kernel_triangle.t2[2]));
+
+		test_points(generator, triangle, points);
+		d.resize(points.size());
+		// Vector version on the first multiple of 8 points when available, scalar one on the others
+		DistanceKernel::squared_distances(points, kernel_triangle, d.data());
+
+		for (std::size_t i = 0; i < points.size(); i++) {
+			K::Point_3 p (points.x[i], points.y[i], points.z[i]);
+			float expected = CGAL::squared_distance(p, float_triangle);
+			float scalar = DistanceKernel::squared_distance(kernel_triangle, points.x[i], points.y[i], points.z[i]);
+			count++;
+			if (!same_bits(expected, d[i]) || !same_bits(expected, scalar)) {
+				if (mismatches < 10) std::cerr << "Mismatch: " << p << " / " << float_triangle << ": " << d[i] << " (batch), " << scalar << " (scalar) instead of " << expected << std::endl;
+				mismatches++;
+			}
+		}
+	}
+	return mismatches;
+}
+
+/*
+ * Fan of triangles (t0, t1, t2) around the apex t2, counterclockwise in XY,
+ * as the faces around a vertex of a height field: closed, or open over a
+ * part of the turn when border is true.
+ */
+static std::vector<DistanceKernel::Triangle> test_fan(std::mt19937 &generator, bool border) {
+	std::uniform_int_distribution<int> size (4, 10);
+	std::uniform_real_distribution<double> unit (0, 1), height (-2, 2);
+	int n = size(generator);
+	double span = border ? M_PI * (1 + unit(generator)) : 2 * M_PI;
+	double start = 2 * M_PI * unit(generator);
+
+	// Angles of the ring, each step below pi
+	std::vector<double> angles;
+	for (int k = 0; k <= n; k++) angles.push_back(start + span * (k + 0.6 * unit(generator) - 0.3) / n);
+	angles.front() = start;
+	angles.back() = start + span;
+
+	std::vector<K::Point_3> ring;
+	for (int k = 0; k <= n; k++) {
+		double radius = 1 + 4 * unit(generator);
+		ring.emplace_back(radius * std::cos(angles[k]), radius * std::sin(angles[k]), height(generator));
+	}
+	if (!border) ring.back() = ring.front();
+
+	K::Point_3 apex (0, 0, height(generator));
+	std::vector<DistanceKernel::Triangle> triangles;
+	for (int k = 0; k < n; k++) triangles.emplace_back(K::Triangle_3(ring[k], ring[k + 1], apex));
+	return triangles;
+}
+
+// Mismatches of nearest_triangle_xy with nearest_triangle, on points above and below random fans
+static std::size_t fan_mismatches(std::mt19937 &generator, std::size_t &count, std::size_t &shortcuts) {
+	std::uniform_real_distribution<float> coordinate (-6, 6), height (-3, 3), unit (0, 1), noise (-0.2, 0.2);
+	std::size_t mismatches = 0;
+	DistanceKernel::Point_batch points;
+	DistanceKernel::Fan_scratch scratch;
+	for (int f = 0; f < 200; f++) {
+		std::vector<DistanceKernel::Triangle> triangles = test_fan(generator, f % 2 == 1);
+
+		// Random points, and points close to a random triangle of the fan
+		points.clear();
+		for (int i = 0; i < 50; i++) {
+			points.push_back(K::Point_3(coordinate(generator), coordinate(generator), height(generator)));
+		}
+		std::uniform_int_distribution<std::size_t> triangle (0, triangles.size() - 1);
+		for (int i = 0; i < 50; i++) {
+			const DistanceKernel::Triangle &t = triangles[triangle(generator)];
+			float a = unit(generator), b = unit(generator);
+			if (a + b > 1) {
+				a = 1 - a;
+				b = 1 - b;
+			}
+			float p[3];
+			for (int k = 0; k < 3; k++) p[k] = t.t0[k] + a * (t.t1[k] - t.t0[k]) + b * (t.t2[k] - t.t0[k]);
+			points.push_back(K::Point_3(p[0], p[1], p[2] + noise(generator)));
+		}
+		std::vector<std::uint32_t> argmin (points.size()), xy_argmin (points.size());
+		std::vector<float> min_d (points.size()), xy_min_d (points.size());
+		DistanceKernel::nearest_triangle(points, triangles, argmin.data(), min_d.data());
+		if (!DistanceKernel::nearest_triangle_xy(points, triangles, scratch, xy_argmin.data(), xy_min_d.data())) {
+			std::cerr << "Fan " << f << " of " << triangles.size() << " triangles not recognised" << std::endl;
+			mismatches++;
+			continue;
+		}
+		shortcuts += points.size() - scratch.pending.size();
+
+		for (std::size_t i = 0; i < points.size(); i++) {
+			count++;
+			if (argmin[i] != xy_argmin[i] || !same_bits(min_d[i], xy_min_d[i])) {
+				if (mismatches < 10) std::cerr << "Mismatch: fan " << f << ", point " << i << ": " << xy_argmin[i] << " at " << xy_min_d[i] << " in XY instead of " << argmin[i] << " at " << min_d[i] << std::endl;
+				mismatches++;
+			}
+		}
+
+		// Reversed, the fan is clockwise and must be refused
+		std::vector<DistanceKernel::Triangle> reversed;
+		for (auto it = triangles.rbegin(); it != triangles.rend(); ++it) {
+			reversed.emplace_back(K::Triangle_3(K::Point_3(it->t1[0], it->t1[1], it->t1[2]), K::Point_3(it->t0[0], it->t0[1], it->t0[2]), K::Point_3(it->t2[0], it->t2[1], it->t2[2])));
+		}
+		if (DistanceKernel::nearest_triangle_xy(points, reversed, scratch, xy_argmin.data(), xy_min_d.data())) {
+			std::cerr << "Clockwise fan " << f << " accepted" << std::endl;
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+int main() {
+	std::mt19937 generator (42);
+
+	std::size_t count = 0;
+	std::size_t mismatches = distance_mismatches(generator, count);
+	std::cout << mismatches << " mismatches out of " << count << " distances" << std::endl;
+
+	std::size_t fan_count = 0, shortcuts = 0;
+	std::size_t fan_errors = fan_mismatches(generator, fan_count, shortcuts);
+	std::cout << fan_errors << " mismatches out of " << fan_count << " nearest triangles in XY, " << shortcuts << " without the full search" << std::endl;
+	// The points above the fans must mostly avoid the full search, or the shortcut is not tested
+	if (shortcuts == 0) fan_errors++;
+
+	return mismatches == 0 && fan_errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
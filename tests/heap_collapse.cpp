@@ -0,0 +1,130 @@
+#include "../header.hpp"
+#include "../edge_collapse.hpp"
+#include "../collapse_engine.hpp"
+
+#include <random>
+
+#include <CGAL/Surface_mesh_simplification/Policies/Edge_collapse/Count_stop_predicate.h>
+
+// Defined by each executable, nothing is saved here
+Surface_mesh_info::Surface_mesh_info() : x_0(0), y_0(0) {}
+
+void Surface_mesh_info::save_mesh(const Surface_mesh &, const char *) const {}
+
+const unsigned char GROUND = 10;
+const unsigned char BUILDING = 41;
+
+static bool in_building(double x, double y) {
+	return x > 6.5 && x < 13.5 && y > 5.5 && y < 12.5;
+}
+
+/*
+ * Height field of a building on a slope, with some noise so that no two
+ * edges have the same cost: the order of SMS::edge_collapse among ties is
+ * not specified.
+ */
+static Surface_mesh height_field(std::mt19937 &generator, int size) {
+	std::uniform_real_distribution<double> noise (-0.05, 0.05);
+	std::bernoulli_distribution diagonal;
+	Surface_mesh mesh;
+	std::vector<Surface_mesh::Vertex_index> vertices;
+	for (int j = 0; j <= size; j++) {
+		for (int i = 0; i <= size; i++) {
+			double z = 0.1 * i + (in_building(i, j) ? 5 : 0) + noise(generator);
+			vertices.push_back(mesh.add_vertex(Point_3(i + noise(generator), j + noise(generator), z)));
+		}
+	}
+	for (int j = 0; j < size; j++) {
+		for (int i = 0; i < size; i++) {
+			auto v00 = vertices[j * (size + 1) + i], v10 = vertices[j * (size + 1) + i + 1];
+			auto v01 = vertices[(j + 1) * (size + 1) + i], v11 = vertices[(j + 1) * (size + 1) + i + 1];
+			if (diagonal(generator)) {
+				mesh.add_face(v00, v10, v11);
+				mesh.add_face(v00, v11, v01);
+			} else {
+				mesh.add_face(v00, v10, v01);
+				mesh.add_face(v10, v11, v01);
+			}
+		}
+	}
+	return mesh;
+}
+
+// Labelled points on the true surface
+static Point_set point_cloud_of(std::mt19937 &generator, int size) {
+	std::uniform_real_distribution<double> coordinate (0, size), noise (-0.02, 0.02);
+	Point_set point_cloud;
+	Point_set::Property_map<unsigned char> label;
+	bool created;
+	boost::tie(label, created) = point_cloud.add_property_map<unsigned char>("p:label", 0);
+	assert(created);
+	for (int k = 0; k < 8 * size * size; k++) {
+		double x = coordinate(generator), y = coordinate(generator);
+		bool building = in_building(x, y);
+		auto ph = *point_cloud.insert(Point_set_kernel::Point_3(x, y, 0.1 * x + (building ? 5 : 0) + noise(generator)));
+		label[ph] = building ? BUILDING : GROUND;
+	}
+	return point_cloud;
+}
+
+static std::vector<Point_3> sorted_points(const Surface_mesh &mesh) {
+	std::vector<Point_3> points;
+	for (const auto &v: mesh.vertices()) points.push_back(mesh.point(v));
+	std::sort(points.begin(), points.end());
+	return points;
+}
+
+int main() {
+	std::mt19937 generator (42);
+	const int size = 20;
+	Surface_mesh mesh = height_field(generator, size);
+	Point_set point_cloud = point_cloud_of(generator, size);
+
+	const LindstromTurk_param params (10, 1, 10, 1, 0.00001, 1, 0.01);
+	const K::FT c1 = 2, c2 = 1, c3 = 0.01, c4 = 0.01;
+	const K::FT min_point_per_area = 0;
+	const Surface_mesh_info mesh_info;
+	// No subdivision, and no border points, whose setup saves point clouds
+	const Ablation_study ablation (false, true, false);
+
+	// The border edges are constrained, to test the constrained edges and keep the borders out of the comparison
+	Surface_mesh::Property_map<Surface_mesh::Edge_index, bool> constrained;
+	bool created;
+	boost::tie(constrained, created) = mesh.add_property_map<Surface_mesh::Edge_index, bool>("e:constrained", false);
+	assert(created);
+	for (const auto &edge: mesh.edges()) constrained[edge] = mesh.is_border(edge);
+
+	// Set up once, both runs start from a copy
+	{
+		My_visitor setup_mv(params, c1, c2, c3, min_point_per_area, mesh, mesh_info, point_cloud, ablation);
+		setup_mv.keep_setup();
+		setup_mv.OnStarted(mesh);
+		setup_mv.OnFinished(mesh);
+	}
+	Surface_mesh heap_mesh (mesh), cgal_mesh (mesh);
+	SMS::Count_stop_predicate<Surface_mesh> stop (mesh.number_of_edges() / 4);
+	Normal_change_filter filter;
+
+	Custom_placement heap_pf(params, heap_mesh, point_cloud, ablation);
+	Custom_cost heap_cf(params, c1, c2, c3, c4, min_point_per_area, heap_mesh, point_cloud);
+	My_visitor heap_mv(params, c1, c2, c3, min_point_per_area, heap_mesh, mesh_info, point_cloud, ablation);
+	heap_mv.reuse_setup(false, true);
+	auto heap_constrained = heap_mesh.property_map<Surface_mesh::Edge_index, bool>("e:constrained").first;
+	int heap_removed = heap_edge_collapse(heap_mesh, stop, heap_pf, heap_cf, heap_mv, filter, &heap_constrained);
+
+	Custom_placement cgal_pf(params, cgal_mesh, point_cloud, ablation);
+	Custom_cost cgal_cf(params, c1, c2, c3, c4, min_point_per_area, cgal_mesh, point_cloud);
+	My_visitor cgal_mv(params, c1, c2, c3, min_point_per_area, cgal_mesh, mesh_info, point_cloud, ablation);
+	cgal_mv.reuse_setup(false, true);
+	auto cgal_constrained = cgal_mesh.property_map<Surface_mesh::Edge_index, bool>("e:constrained").first;
+	int cgal_removed = SMS::edge_collapse(cgal_mesh, stop, CGAL::parameters::get_cost(cgal_cf).filter(filter).get_placement(cgal_pf).visitor(cgal_mv).edge_is_constrained_map(cgal_constrained));
+
+	std::cout << "heap: " << heap_removed << " edges removed, " << heap_mesh.number_of_faces() << " faces" << std::endl;
+	std::cout << "cgal: " << cgal_removed << " edges removed, " << cgal_mesh.number_of_faces() << " faces" << std::endl;
+
+	bool same_vertices = sorted_points(heap_mesh) == sorted_points(cgal_mesh);
+	std::cout << "Same vertices: " << (same_vertices ? "yes" : "no") << std::endl;
+
+	bool failed = heap_removed == 0 || heap_removed != cgal_removed || heap_mesh.number_of_faces() != cgal_mesh.number_of_faces() || !same_vertices;
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}